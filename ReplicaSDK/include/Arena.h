@@ -0,0 +1,131 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Bump allocator for the CPU buffers of a mesh load, in chunks backed by huge
+// pages so they fault in 2MB at a time. Reset once a load batch is uploaded,
+// later batches and loads reuse pages that are already mapped.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+enum class HugePages {
+  None,
+  Transparent, // madvise(MADV_HUGEPAGE), needs THP in madvise or always mode
+  Explicit // MAP_HUGETLB from vm.nr_hugepages, else Transparent
+};
+
+class Arena {
+ public:
+  explicit Arena(
+      const HugePages hugePages = HugePages::Transparent,
+      const size_t chunkBytes = 64 << 20);
+
+  // All blocks must have been released
+  ~Arena();
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  struct Stats {
+    size_t allocations = 0; // since construction
+    size_t resets = 0;
+    size_t usedBytes = 0; // since the last reset
+    size_t peakUsedBytes = 0;
+    size_t mappedBytes = 0; // all chunks, kept across resets
+    size_t hugeTlbBytes = 0; // of mappedBytes, from MAP_HUGETLB
+  };
+
+  Stats GetStats() const;
+
+  // 64 byte aligned block, safe to call from any thread
+  void* Allocate(const size_t bytes);
+
+  // Memory is only reclaimed by Reset, this just tracks live blocks
+  void Release(void* ptr);
+
+  // Makes every chunk free again, keeping them mapped. All blocks must have
+  // been released.
+  void Reset();
+
+  // Allocations made through ArenaAllocator on the calling thread come from
+  // arena while the scope is alive, or the heap if it is null. Scopes nest,
+  // and OpenMP workers need one of their own.
+  class Scope {
+   public:
+    explicit Scope(Arena* arena);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    Arena* previous;
+  };
+
+  // Arena of the innermost Scope on the calling thread, null if none
+  static Arena* Current();
+
+ private:
+  struct Chunk {
+    uint8_t* data;
+    size_t bytes;
+    size_t used;
+    bool hugeTlb;
+  };
+
+  Chunk MapChunk(const size_t bytes);
+
+  const HugePages hugePages;
+  const size_t chunkBytes;
+
+  mutable std::mutex mutex;
+  std::vector<Chunk> chunks;
+  size_t liveBlocks = 0;
+  Stats stats;
+};
+
+// Blocks handed out by ArenaAllocator since the process started
+struct AllocationCounts {
+  size_t arena = 0;
+  size_t heap = 0;
+};
+
+AllocationCounts GetAllocationCounts();
+
+// From Arena::Current(), or the heap without one. Blocks record where they
+// came from, so may be freed on any thread and outside the scope.
+void* ArenaAllocate(const size_t bytes);
+void ArenaFree(void* ptr);
+
+// Stateless allocator over ArenaAllocate, for pangolin::ManagedImage and
+// std::vector
+template <typename T>
+struct ArenaAllocator {
+  typedef T value_type;
+
+  ArenaAllocator() {}
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>&) {}
+
+  T* allocate(const size_t n) {
+    return static_cast<T*>(ArenaAllocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, const size_t) {
+    ArenaFree(ptr);
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>&, const ArenaAllocator<U>&) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>&, const ArenaAllocator<U>&) {
+  return false;
+}
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
@@ -0,0 +1,22 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Files cached on disk across processes, shared by the program and mirror
+// mask caches
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+
+constexpr uint64_t kFnv1aBasis = 14695981039346656037ull;
+
+// 64-bit FNV-1a hash of data, continuing from hash
+uint64_t Fnv1a(uint64_t hash, const std::string& data);
+
+// $XDG_CACHE_HOME/replica or ~/.cache/replica, followed by /name if given,
+// empty if neither is set
+std::string CacheDir(const std::string& name = std::string());
+
+// Writes file, creating its directory, under a unique name first so readers
+// never see a partial file and concurrent writers don't share one, the last
+// rename winning. False if it couldn't be written.
+bool WriteCacheFile(const std::string& file, const std::function<void(std::ostream&)>& write);
@@ -1,34 +1,92 @@
 // Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
 #pragma once
 
+#include <memory>
 #include <string>
 
+enum class EGLPlatform {
+  Auto, // the selected device, else X11 if DISPLAY is set, else surfaceless
+  Device, // EGL_EXT_platform_device
+  Surfaceless, // EGL_MESA_platform_surfaceless, e.g. llvmpipe
+  X11
+};
+
+struct EGLOptions {
+  EGLPlatform platform = EGLPlatform::Auto;
+
+  // Device to render on, by the first of these that is set: its DRM node,
+  // e.g. /dev/dri/renderD128, its index as listed by PrintInformation, or its
+  // CUDA device number. A node or index matching no device is an error even
+  // with the Auto platform.
+  std::string drmNode;
+  int deviceIndex = -1;
+  int cudaDevice = 0;
+
+  // 1920x1080 pbuffer to draw to, not needed to render to framebuffer objects
+  bool createSurface = false;
+};
+
+// Failures throw std::runtime_error, or std::invalid_argument when no device
+// matches the options, instead of ending the process
 class EGLCtx {
  public:
-  EGLCtx(const bool createCtx = true, const int cudaDevice = 0, const bool createSurface = true);
+  explicit EGLCtx(const EGLOptions& options = EGLOptions());
   ~EGLCtx();
   EGLCtx(const EGLCtx&) = delete;
   EGLCtx& operator=(const EGLCtx&) = delete;
 
+  // Context sharing textures, buffers and programs with this one, for a
+  // render worker on another thread. It isn't current anywhere until that
+  // thread calls MakeCurrent, and must be destroyed before this context.
+  std::unique_ptr<EGLCtx> CreateSharedContext() const;
+
+  // Binds the context to the calling thread, which it must not be current on
+  // any other thread. The constructor does this for the first context.
+  void MakeCurrent();
+
+  // Unbinds whichever context is current on the calling thread
+  void Release();
+
+  // Whether this is the context current on the calling thread
+  bool IsCurrent() const;
+
   void* (*eglGetCurrentContext)(void);
 
   void PrintInformation();
 
  private:
-  void* display;
-  void* surface;
-  void* context;
-  void* handle;
+  explicit EGLCtx(const EGLCtx* share);
+
+  void Init(const EGLOptions& options);
+
+  // Frees whatever a full or failed construction created
+  void Destroy();
+
+  void LoadFunctions();
+
+  // Device picked by options, null if none matches
+  void* SelectDevice(const EGLOptions& options);
+
+  void* display = nullptr;
+  void* config = nullptr;
+  void* surface = nullptr;
+  void* context = nullptr;
+  void* handle = nullptr;
 
   const std::string lib;
-  const bool createdCtx;
+  const bool ownsDisplay;
+  bool displayInitialised = false;
+  bool initialised = false;
 
   unsigned int (*eglInitialize)(void*, int32_t*, int32_t*);
   unsigned int (*eglChooseConfig)(void*, const int32_t*, void**, int32_t, int32_t*);
   void (*(*eglGetProcAddress)(const char*))();
+  const char* (*eglQueryString)(void*, int32_t);
   void* (*eglCreatePbufferSurface)(void*, void*, const int32_t*);
   unsigned int (*eglBindAPI)(unsigned int);
   void* (*eglCreateContext)(void*, void*, void*, const int32_t*);
   unsigned int (*eglMakeCurrent)(void*, void*, void*, void*);
+  unsigned int (*eglDestroyContext)(void*, void*);
+  unsigned int (*eglDestroySurface)(void*, void*);
   unsigned int (*eglTerminate)(void*);
 };
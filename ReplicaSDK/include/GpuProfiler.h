@@ -0,0 +1,120 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// GPU timestamp and CPU timing of named render passes
+#pragma once
+#include <pangolin/gl/gl.h>
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+
+class GpuProfiler {
+ public:
+  // Frames kept for the rolling statistics
+  GpuProfiler(const size_t window = 120);
+  ~GpuProfiler();
+
+  GpuProfiler(const GpuProfiler&) = delete;
+  GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+  // Starts a new frame. Queries are double buffered, so this collects the
+  // results of the frame before last without waiting on the GPU, skipping
+  // that frame if the GPU hasn't finished it yet.
+  void BeginFrame();
+
+  // Waits for and collects all outstanding results
+  void Finish();
+
+  // Keep the times of every frame for WriteCsv and WriteJson, off by default
+  // so long sessions don't grow without bound
+  bool RecordHistory() const {
+    return recordHistory;
+  }
+
+  void SetRecordHistory(const bool& val) {
+    recordHistory = val;
+  }
+
+  // Frames dropped by BeginFrame as their results weren't ready
+  size_t SkippedFrames() const {
+    return skippedFrames;
+  }
+
+  // Times everything issued during its lifetime under the named pass, times
+  // of the same pass are summed per frame. Passes may nest, a null profiler
+  // does nothing.
+  class Scope {
+   public:
+    Scope(GpuProfiler* profiler, const char* pass);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    GpuProfiler* profiler;
+    size_t timing;
+    std::chrono::steady_clock::time_point start;
+  };
+
+  struct PassStats {
+    std::string name;
+    size_t frames = 0; // frames in the window the pass ran in
+    double gpuMeanMs = 0.0;
+    double gpuMaxMs = 0.0;
+    double cpuMeanMs = 0.0;
+    double cpuMaxMs = 0.0;
+  };
+
+  // Statistics over the last window frames with results
+  std::vector<PassStats> Stats() const;
+
+  // One row per recorded frame and pass: frame,pass,gpu_ms,cpu_ms
+  void WriteCsv(const std::string& filename) const;
+
+  // Statistics over all recorded frames and the times of each pass per frame
+  void WriteJson(const std::string& filename) const;
+
+ private:
+  // Times of one frame per pass, negative where the pass didn't run
+  struct FrameTimes {
+    size_t frame;
+    std::vector<double> gpuMs;
+    std::vector<double> cpuMs;
+  };
+
+  // Queries issued during one frame, reused once their results are read
+  struct QueryBuffer {
+    size_t frame = 0;
+    std::vector<GLuint> queries; // begin and end timestamp of each timing
+    std::vector<size_t> passes;
+    std::vector<double> cpuMs;
+  };
+
+  size_t PassIndex(const char* pass);
+
+  size_t Begin(const size_t pass);
+
+  void End(const size_t timing, const double cpuMs);
+
+  // Without wait, drops the frame if any of its results aren't available
+  void Collect(QueryBuffer& queryBuffer, const bool wait);
+
+  static std::vector<PassStats> Summarise(
+      const std::vector<std::string>& passes,
+      const std::deque<FrameTimes>& frames);
+
+  static constexpr size_t kNumBuffers = 2;
+
+  const size_t window;
+  bool recordHistory = false;
+
+  size_t frame = 0;
+  size_t skippedFrames = 0;
+  QueryBuffer buffers[kNumBuffers];
+
+  std::vector<std::string> passes;
+
+  std::deque<FrameTimes> recent;
+  std::deque<FrameTimes> history;
+};
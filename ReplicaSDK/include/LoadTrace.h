@@ -0,0 +1,81 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Timings of load stages written as a Chrome trace-event file
+#pragma once
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+class LoadTrace {
+ public:
+  LoadTrace();
+
+  // Records wall and process CPU time, bytes read and uploaded, minor page
+  // faults and the RSS high-water mark at its end as one trace event. Stages
+  // may nest, a null trace does nothing.
+  class Stage {
+   public:
+    Stage(LoadTrace* trace, const char* name);
+    ~Stage();
+
+    Stage(const Stage&) = delete;
+    Stage& operator=(const Stage&) = delete;
+
+    // Records the stage now rather than when destroyed
+    void End();
+
+    void AddBytesRead(const size_t bytes) {
+      bytesRead += bytes;
+    }
+
+    void AddBytesUploaded(const size_t bytes) {
+      bytesUploaded += bytes;
+    }
+
+    // Extra argument shown with the event, e.g. a submesh index
+    void SetArg(const char* key, const double value) {
+      if (trace)
+        args.emplace_back(key, value);
+    }
+
+   private:
+    LoadTrace* trace;
+    const char* name;
+    std::chrono::steady_clock::time_point start;
+    double startCpuSeconds = 0.0;
+    size_t startPageFaults = 0;
+    size_t bytesRead = 0;
+    size_t bytesUploaded = 0;
+    std::vector<std::pair<std::string, double>> args;
+  };
+
+  // Writes the events in the Chrome trace-event format, viewable in
+  // chrome://tracing or Perfetto
+  void Write(const std::string& filename) const;
+
+  // Peak resident set size of the process
+  static size_t PeakResidentBytes();
+
+  // CPU time of all threads of the process
+  static double ProcessCpuSeconds();
+
+  // Page faults of the process served without I/O, mostly first touches of
+  // newly allocated memory
+  static size_t MinorPageFaults();
+
+ private:
+  struct Event {
+    std::string name;
+    double startUs;
+    double durationUs;
+    double cpuMs;
+    size_t bytesRead;
+    size_t bytesUploaded;
+    size_t minorPageFaults;
+    size_t peakResidentBytes;
+    std::vector<std::pair<std::string, double>> args;
+  };
+
+  std::chrono::steady_clock::time_point origin;
+  std::vector<Event> events;
+};
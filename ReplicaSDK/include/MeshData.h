@@ -4,6 +4,8 @@
 #include <pangolin/image/managed_image.h>
 #include <Eigen/Core>
 
+#include "Arena.h"
+
 struct MeshData {
   MeshData(size_t polygonStride = 3) : polygonStride(polygonStride) {}
 
@@ -35,9 +37,13 @@ struct MeshData {
     polygonStride = other.polygonStride;
   }
 
-  pangolin::ManagedImage<Eigen::Vector4f> vbo;
-  pangolin::ManagedImage<uint32_t> ibo;
-  pangolin::ManagedImage<Eigen::Vector4f> nbo;
-  pangolin::ManagedImage<Eigen::Matrix<unsigned char, 4, 1>> cbo;
+  // from the calling thread's arena while loading, see Arena::Scope
+  template <typename T>
+  using Buffer = pangolin::ManagedImage<T, ArenaAllocator<T>>;
+
+  Buffer<Eigen::Vector4f> vbo;
+  Buffer<uint32_t> ibo;
+  Buffer<Eigen::Vector4f> nbo;
+  Buffer<Eigen::Matrix<unsigned char, 4, 1>> cbo;
   size_t polygonStride;
 };
@@ -3,8 +3,13 @@
 #pragma once
 #include <pangolin/gl/gl.h>
 #include <pangolin/gl/glsl.h>
-#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include "GpuProfiler.h"
 #include "MirrorSurface.h"
+#include "ProgramCache.h"
 
 class MirrorRenderer {
  public:
@@ -12,31 +17,35 @@ class MirrorRenderer {
       const std::vector<MirrorSurface>& mirrors,
       const int width,
       const int height,
-      const std::string shadir)
-      : surfaceOffset(0.0025f) {
-    // create render target
-    colorTex.Reinitialise(width, height, GL_RGBA8, true, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    depthTex.Reinitialise(
-        width, height, GL_DEPTH_COMPONENT24, true, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-
-    frameBuffer.AttachColour(colorTex);
-    frameBuffer.Bind();
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTex.tid, 0);
-    glDrawBuffer(GL_NONE);
-    ASSERT(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
-    frameBuffer.Unbind();
-
-    // load shader
+      const std::string shadir,
+      const std::string& surfaceFile = std::string(),
+      const int maskSize = 256)
+      : surfaceOffset(0.0025f), screenSize(width, height), reflections(mirrors.size()) {
+    // load shaders
     ASSERT(pangolin::FileExists(shadir), "Shader directory not found!");
-    shader.AddShaderFromFile(pangolin::GlSlVertexShader, shadir + "/mirror.vert", {}, {shadir});
-    shader.AddShaderFromFile(pangolin::GlSlFragmentShader, shadir + "/mirror.frag", {}, {shadir});
-    shader.Link();
-
-    // create masks
+    BuildProgram(
+        shader,
+        shadir,
+        {{pangolin::GlSlVertexShader, "mirror.vert", {}},
+         {pangolin::GlSlFragmentShader, "mirror.frag", {}}});
+
+    BuildProgram(
+        stencilShader,
+        shadir,
+        {{pangolin::GlSlVertexShader, "mirror.vert", {}},
+         {pangolin::GlSlFragmentShader, "mirror-stencil.frag", {}}});
+
+    // create masks, cached on disk when the mirrors' file is known
+    std::vector<pangolin::ManagedImage<uint8_t>> masks =
+        LoadOrGenerateMasks(mirrors, surfaceFile, maskSize, maskSize);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     maskTextures.resize(mirrors.size());
     for (size_t i = 0; i < mirrors.size(); i++) {
-      GenerateMaskTexture((MirrorSurface&)mirrors[i], maskTextures[i], 256, 256);
+      maskTextures[i].Reinitialise(
+          maskSize, maskSize, GL_LUMINANCE8, true, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, masks[i].ptr);
     }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
   }
 
   ~MirrorRenderer() {}
@@ -45,17 +54,146 @@ class MirrorRenderer {
     return maskTextures[i];
   }
 
+  // Fraction of the on screen resolution reflections are rendered at
+  float ResolutionScale() const {
+    return resolutionScale;
+  }
+
+  void SetResolutionScale(const float& val) {
+    resolutionScale = val;
+  }
+
+  // Times captures and composites when set, not owned
+  void SetProfiler(GpuProfiler* val) {
+    profiler = val;
+  }
+
+  // Draws the mirrors captured by the last CaptureReflections call
+  void Render(
+      const std::vector<MirrorSurface>& mirrors,
+      const pangolin::OpenGlRenderState& cam,
+      const bool drawDepth = false) {
+    ASSERT(mirrors.size() == reflections.size());
+    ASSERT(colorTex.IsValid(), "No reflections captured");
+
+    for (size_t i = 0; i < mirrors.size(); i++) {
+      if (reflections[i].visible) {
+        Render(mirrors[i], maskTextures[i], reflections[i], cam, drawDepth);
+      }
+    }
+  }
+
+  void DrawNormal(const MirrorSurface& surface, float len) {
+    Eigen::Vector3f p = surface.Boundary_w()[0] + surface.Equation().head<3>() * len;
+    glBegin(GL_LINES);
+    glVertex3fv((GLfloat*)surface.Boundary_w()[0].data());
+    glVertex3fv((GLfloat*)p.data());
+    glEnd();
+  }
+
+  // Renders the reflections of the mirrors in view into the atlas, each at a
+  // resolution matching its footprint on screen
+  void CaptureReflections(
+      const std::vector<MirrorSurface>& mirrors,
+      PTexMesh& ptexMesh,
+      const pangolin::OpenGlRenderState& cam,
+      GLenum frontFace,
+      const bool drawDepth = false,
+      const float depthScale = 1.0f) {
+    ASSERT(mirrors.size() == reflections.size());
+
+    // the atlas is only needed by this path
+    if (!colorTex.IsValid()) {
+      CreateAtlas();
+    }
+
+    for (size_t i = 0; i < mirrors.size(); i++) {
+      reflections[i].visible =
+          InView(mirrors[i], cam) && ScreenRect(mirrors[i], cam, reflections[i].screenRect);
+    }
+
+    PackAtlas();
+
+    BeginDrawScene(frontFace);
+    for (size_t i = 0; i < mirrors.size(); i++) {
+      if (reflections[i].visible) {
+        CaptureReflection(mirrors[i], reflections[i], ptexMesh, cam, drawDepth, depthScale);
+      }
+    }
+    EndDrawScene(frontFace);
+  }
+
+  // Alternative to CaptureReflections and Render drawing each reflection
+  // straight into the bound target, which must have a stencil buffer. The
+  // mirror's mask marks its visible pixels in the stencil and the reflected
+  // scene is only drawn there, blended by the mirror's Fresnel reflectance
+  // towards the eye.
+  void RenderInPlace(
+      const std::vector<MirrorSurface>& mirrors,
+      PTexMesh& ptexMesh,
+      const pangolin::OpenGlRenderState& cam,
+      GLenum frontFace,
+      const bool drawDepth = false,
+      const float depthScale = 1.0f) {
+    ASSERT(mirrors.size() == reflections.size());
+
+    glPushAttrib(
+        GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT | GL_ENABLE_BIT |
+        GL_VIEWPORT_BIT);
+    glEnable(GL_STENCIL_TEST);
+    glStencilMask(0xFF);
+    glDisable(GL_CULL_FACE);
+
+    for (size_t i = 0; i < mirrors.size(); i++) {
+      reflections[i].visible = InView(mirrors[i], cam);
+      if (reflections[i].visible) {
+        RenderInPlace(mirrors[i], maskTextures[i], ptexMesh, cam, frontFace, drawDepth, depthScale);
+      }
+    }
+
+    glPopAttrib();
+  }
+
+  void DisplayTexture() {
+    glDisable(GL_DEPTH_TEST);
+    colorTex.RenderToViewport();
+    glEnable(GL_DEPTH_TEST);
+  }
+
+ private:
+  // Where a mirror is on screen and where its reflection is in the atlas, in pixels
+  struct Reflection {
+    bool visible = false;
+    Eigen::AlignedBox2f screenRect;
+    Eigen::AlignedBox2f atlasRect;
+  };
+
   void Render(
       const MirrorSurface& surface,
       pangolin::GlTexture& maskTexture,
+      const Reflection& reflection,
       const pangolin::OpenGlRenderState& cam,
-      const bool drawDepth=false
-      ) {
+      const bool drawDepth) {
+    GpuProfiler::Scope scope(profiler, "mirror composite");
+
     shader.Bind();
     shader.SetUniform("MVP_matrix", cam.GetProjectionModelViewMatrix());
     shader.SetUniform("MV_matrix", cam.GetModelViewMatrix());
     shader.SetUniform("reflectivity", surface.Reflectivity());
     shader.SetUniform("texSize", (float)colorTex.width, (float)colorTex.height);
+    shader.SetUniform("screenSize", screenSize(0), screenSize(1));
+    shader.SetUniform(
+        "screenRect",
+        reflection.screenRect.min()(0),
+        reflection.screenRect.min()(1),
+        reflection.screenRect.max()(0),
+        reflection.screenRect.max()(1));
+    shader.SetUniform(
+        "atlasRect",
+        reflection.atlasRect.min()(0),
+        reflection.atlasRect.min()(1),
+        reflection.atlasRect.max()(0),
+        reflection.atlasRect.max()(1));
 
     glActiveTexture(GL_TEXTURE0);
     colorTex.Bind();
@@ -63,6 +201,9 @@ class MirrorRenderer {
     glActiveTexture(GL_TEXTURE1);
     maskTexture.Bind();
 
+    glActiveTexture(GL_TEXTURE2);
+    reflectionDepthTex.Bind();
+
     if (!drawDepth) {
       glEnable(GL_BLEND);
       glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -74,6 +215,8 @@ class MirrorRenderer {
 
     glDisable(GL_BLEND);
 
+    glActiveTexture(GL_TEXTURE2);
+    reflectionDepthTex.Unbind();
     glActiveTexture(GL_TEXTURE1);
     maskTexture.Unbind();
     glActiveTexture(GL_TEXTURE0);
@@ -82,26 +225,134 @@ class MirrorRenderer {
     shader.Unbind();
   }
 
-  void DrawNormal(const MirrorSurface& surface, float len) {
-    Eigen::Vector3f p = surface.Boundary_w()[0] + surface.Equation().head<3>() * len;
-    glBegin(GL_LINES);
-    glVertex3fv((GLfloat*)surface.Boundary_w()[0].data());
-    glVertex3fv((GLfloat*)p.data());
-    glEnd();
+  void RenderInPlace(
+      const MirrorSurface& mirror,
+      pangolin::GlTexture& maskTexture,
+      PTexMesh& ptexMesh,
+      const pangolin::OpenGlRenderState& cam,
+      const GLenum frontFace,
+      const bool drawDepth,
+      const float depthScale) {
+    GpuProfiler::Scope scope(profiler, "mirror in place");
+
+    stencilShader.Bind();
+    stencilShader.SetUniform("MVP_matrix", cam.GetProjectionModelViewMatrix());
+    stencilShader.SetUniform("MV_matrix", cam.GetModelViewMatrix());
+    glActiveTexture(GL_TEXTURE1);
+    maskTexture.Bind();
+
+    // mark the visible pixels inside the mask
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glStencilFunc(GL_ALWAYS, 1, 0xFF);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    Draw(mirror, surfaceOffset);
+
+    // push their depth to the far plane so the reflection can be drawn there
+    glStencilFunc(GL_EQUAL, 1, 0xFF);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_ALWAYS);
+    glDepthRange(1.0, 1.0);
+    Draw(mirror, surfaceOffset);
+    glDepthRange(0.0, 1.0);
+    glDepthFunc(GL_LESS);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    stencilShader.Unbind();
+    glActiveTexture(GL_TEXTURE0);
+
+    const Eigen::MatrixX4f cullPlanes = ReflectionCullPlanes(mirror, cam);
+
+    pangolin::OpenGlRenderState reflectCam(
+        cam.GetProjectionMatrix(), cam.GetModelViewMatrix() * GetReflectionMatrix(mirror));
+
+    const Eigen::Vector4d t =
+        ((Eigen::Matrix4d)cam.GetModelViewMatrix().Inverse()).topRightCorner(4, 1);
+    const double signFlip = mirror.Equation().cast<double>().dot(t) > 0 ? 1.0 : -1.0;
+
+    Eigen::Vector4f plane = mirror.Equation();
+    plane(3) -= surfaceOffset;
+
+    glFrontFace(frontFace == GL_CW ? GL_CCW : GL_CW); // reflection reverses facing
+    glEnable(GL_CLIP_DISTANCE0);
+
+    // timed as part of this pass only, not as ptex or depth too
+    GpuProfiler* meshProfiler = ptexMesh.Profiler();
+    ptexMesh.SetProfiler(nullptr);
+
+    if (drawDepth) {
+      ptexMesh.RenderDepth(reflectCam, depthScale, signFlip * plane, cullPlanes);
+    } else {
+      // with a depth prepass each pixel is only blended once
+      const bool depthPrepass = ptexMesh.DepthPrepass();
+      ptexMesh.SetDepthPrepass(true);
+
+      glEnable(GL_BLEND);
+      glBlendColor(0.0f, 0.0f, 0.0f, Reflectance(mirror, t.head<3>().cast<float>()));
+      glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+      glBlendFunci(1, GL_ONE, GL_ZERO); // depth output isn't blended
+
+      ptexMesh.Render(reflectCam, signFlip * plane, cullPlanes);
+
+      glDisable(GL_BLEND);
+      ptexMesh.SetDepthPrepass(depthPrepass);
+    }
+
+    ptexMesh.SetProfiler(meshProfiler);
+    glDisable(GL_CLIP_DISTANCE0);
+    glFrontFace(frontFace);
+
+    // restore the mirror's own depth and clear the stencil for the next one
+    stencilShader.Bind();
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glStencilOp(GL_KEEP, GL_ZERO, GL_ZERO);
+    glDepthFunc(GL_ALWAYS);
+    Draw(mirror, surfaceOffset);
+    glDepthFunc(GL_LESS);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    stencilShader.Unbind();
+
+    glActiveTexture(GL_TEXTURE1);
+    maskTexture.Unbind();
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  // Fresnel reflectance seen from eye at the mirror's centroid, as in mirror.frag
+  float Reflectance(const MirrorSurface& mirror, const Eigen::Vector3f& eye) {
+    const Eigen::Vector3f n = mirror.Equation().head<3>().normalized();
+    const Eigen::Vector3f v = (mirror.Centroid() - eye).normalized();
+    const float r = mirror.Reflectivity();
+    return r + (1.0f - r) * std::pow(1.0f - std::abs(n.dot(v)), 5.0f);
   }
 
   void CaptureReflection(
       const MirrorSurface& mirror,
+      const Reflection& reflection,
       PTexMesh& ptexMesh,
       const pangolin::OpenGlRenderState& cam,
-      GLenum frontFace,
-      const bool drawDepth=false,
-      const float depthScale=1.0f) {
-    if (!InView(mirror, cam))
-      return;
+      const bool drawDepth,
+      const float depthScale) {
+    GpuProfiler::Scope scope(profiler, "mirror capture");
+
+    // only geometry seen through the visible part of the mirror is drawn
+    const Eigen::MatrixX4f cullPlanes = ReflectionCullPlanes(mirror, cam);
+
+    // crop the projection to the mirror's footprint on screen
+    const Eigen::Vector2f ndcMin =
+        2.0f * reflection.screenRect.min().cwiseQuotient(screenSize) - Eigen::Vector2f::Ones();
+    const Eigen::Vector2f ndcMax =
+        2.0f * reflection.screenRect.max().cwiseQuotient(screenSize) - Eigen::Vector2f::Ones();
+
+    Eigen::Matrix4d crop = Eigen::Matrix4d::Identity();
+    for (int i = 0; i < 2; i++) {
+      crop(i, i) = 2.0 / (ndcMax(i) - ndcMin(i));
+      crop(i, 3) = -(ndcMax(i) + ndcMin(i)) / (ndcMax(i) - ndcMin(i));
+    }
+
     // render reflections to texture
     pangolin::OpenGlRenderState reflectCam(
-        cam.GetProjectionMatrix(), cam.GetModelViewMatrix() * GetReflectionMatrix(mirror));
+        pangolin::OpenGlMatrix(Eigen::Matrix4d(crop * (Eigen::Matrix4d)cam.GetProjectionMatrix())),
+        cam.GetModelViewMatrix() * GetReflectionMatrix(mirror));
 
     // Check which side of the surface we're on to render the right clip plane
     const Eigen::Vector4d t =
@@ -111,18 +362,102 @@ class MirrorRenderer {
     Eigen::Vector4f plane = mirror.Equation();
     plane(3) -= surfaceOffset;
 
-    BeginDrawScene(frontFace);
+    const Eigen::Vector2i offset = reflection.atlasRect.min().cast<int>();
+    const Eigen::Vector2i size = reflection.atlasRect.sizes().cast<int>();
+    glViewport(offset(0), offset(1), size(0), size(1));
+    glScissor(offset(0), offset(1), size(0), size(1));
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // timed as part of this pass only, not as ptex or depth too
+    GpuProfiler* meshProfiler = ptexMesh.Profiler();
+    ptexMesh.SetProfiler(nullptr);
+
+    // reflected scene depth goes to the atlas's second attachment
+    const bool extraOutputs = ptexMesh.ExtraOutputs();
+    ptexMesh.SetExtraOutputs(true);
+
     if (drawDepth)
-      ptexMesh.RenderDepth(reflectCam, depthScale, signFlip * plane);
+      ptexMesh.RenderDepth(reflectCam, depthScale, signFlip * plane, cullPlanes);
     else
-      ptexMesh.Render(reflectCam, signFlip * plane);
-    EndDrawScene(frontFace);
+      ptexMesh.Render(reflectCam, signFlip * plane, cullPlanes);
+
+    ptexMesh.SetExtraOutputs(extraOutputs);
+    ptexMesh.SetProfiler(meshProfiler);
   }
 
-  void DisplayTexture() {
-    glDisable(GL_DEPTH_TEST);
-    colorTex.RenderToViewport();
-    glEnable(GL_DEPTH_TEST);
+  // Pixel bounds of a mirror's bounding rectangle on screen, with a border for
+  // bilinear filtering
+  bool ScreenRect(
+      const MirrorSurface& surface,
+      const pangolin::OpenGlRenderState& cam,
+      Eigen::AlignedBox2f& rect) {
+    const Eigen::Matrix4d mvp = cam.GetProjectionModelViewMatrix();
+    const std::vector<Eigen::Vector3f>& corners = surface.BoundingRect_w();
+    const std::vector<Eigen::Vector3f> polygon =
+        ClipToFrustum({corners[0], corners[1], corners[3], corners[2]}, mvp);
+
+    if (polygon.size() < 3)
+      return false;
+
+    rect.setEmpty();
+    for (const Eigen::Vector3f& p : polygon) {
+      const Eigen::Vector4d clip = mvp * p.cast<double>().homogeneous();
+      const Eigen::Vector2f ndc = (clip.head<2>() / clip(3)).cast<float>();
+      rect.extend((0.5f * (ndc + Eigen::Vector2f::Ones())).cwiseProduct(screenSize));
+    }
+
+    rect.min() = (rect.min().array().floor() - 1.0f).max(0.0f);
+    rect.max() = (rect.max().array().ceil() + 1.0f).min(screenSize.array());
+
+    return (rect.sizes().array() > 0.0f).all();
+  }
+
+  // Shelf packs the visible reflections into the atlas, tallest first,
+  // shrinking them all until they fit
+  void PackAtlas() {
+    std::vector<size_t> order(reflections.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+      return reflections[a].screenRect.sizes()(1) > reflections[b].screenRect.sizes()(1);
+    });
+
+    const float atlasWidth = colorTex.width;
+    const float atlasHeight = colorTex.height;
+
+    for (float scale = resolutionScale; scale > 0.0f; scale *= 0.75f) {
+      float x = 0.0f;
+      float y = 0.0f;
+      float shelfHeight = 0.0f;
+      bool fits = true;
+
+      for (size_t i : order) {
+        Reflection& reflection = reflections[i];
+        if (!reflection.visible)
+          continue;
+
+        const Eigen::Vector2f size =
+            (reflection.screenRect.sizes() * scale).array().ceil().max(1.0f);
+
+        if (x + size(0) > atlasWidth) {
+          x = 0.0f;
+          y += shelfHeight;
+          shelfHeight = 0.0f;
+        }
+
+        if (size(0) > atlasWidth || y + size(1) > atlasHeight) {
+          fits = false;
+          break;
+        }
+
+        reflection.atlasRect = Eigen::AlignedBox2f(
+            Eigen::Vector2f(x, y), Eigen::Vector2f(x + size(0), y + size(1)));
+        x += size(0);
+        shelfHeight = std::max(shelfHeight, size(1));
+      }
+
+      if (fits)
+        break;
+    }
   }
 
  private:
@@ -164,14 +499,32 @@ class MirrorRenderer {
     glEnd();
   }
 
+  void CreateAtlas() {
+    const int width = screenSize(0);
+    const int height = screenSize(1);
+
+    colorTex.Reinitialise(width, height, GL_RGBA8, true, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    reflectionDepthTex.Reinitialise(width, height, GL_R32F, true, 0, GL_RED, GL_FLOAT, NULL);
+    depthTex.Reinitialise(
+        width, height, GL_DEPTH_COMPONENT24, true, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+
+    // reflected scene depth is written alongside colour by PTexMesh::Render
+    frameBuffer.AttachColour(colorTex);
+    frameBuffer.AttachColour(reflectionDepthTex);
+    frameBuffer.Bind();
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTex.tid, 0);
+    glDrawBuffer(GL_NONE);
+    ASSERT(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    frameBuffer.Unbind();
+  }
+
   void BeginDrawScene(const GLenum frontFace) {
     frameBuffer.Bind();
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glFrontFace(frontFace == GL_CW ? GL_CCW : GL_CW); // reflection reverses facing
     glEnable(GL_CLIP_DISTANCE0);
-    glPushAttrib(GL_VIEWPORT_BIT);
-    glViewport(0, 0, colorTex.width, colorTex.height);
+    glPushAttrib(GL_VIEWPORT_BIT | GL_SCISSOR_BIT);
+    glEnable(GL_SCISSOR_TEST); // clear only each reflection's part of the atlas
   }
 
   void EndDrawScene(const GLenum frontFace) {
@@ -181,39 +534,97 @@ class MirrorRenderer {
     glPopAttrib();
   }
 
-  bool InView(const MirrorSurface& surface, const pangolin::OpenGlRenderState& cam) {
-    const Eigen::Matrix4f mvp = ((Eigen::Matrix4d)cam.GetProjectionModelViewMatrix()).cast<float>();
+  // Clips a world space polygon to the view frustum of mvp (Sutherland-Hodgman)
+  static std::vector<Eigen::Vector3f> ClipToFrustum(
+      const std::vector<Eigen::Vector3f>& polygon,
+      const Eigen::Matrix4d& mvp) {
+    std::vector<Eigen::Vector3f> clipped = polygon;
+
+    for (int i = 0; i < 6 && !clipped.empty(); i++) {
+      const double sign = i % 2 == 0 ? 1.0 : -1.0;
+      const Eigen::Vector4d plane = mvp.row(3) + sign * mvp.row(i / 2);
+
+      std::vector<Eigen::Vector3f> input;
+      input.swap(clipped);
 
-    for (size_t i = 0; i < surface.Boundary_w().size(); i++) {
-      Eigen::Vector4f p = mvp * Unproject(surface.Boundary_w()[i]);
+      for (size_t j = 0; j < input.size(); j++) {
+        const Eigen::Vector3f& a = input[j];
+        const Eigen::Vector3f& b = input[(j + 1) % input.size()];
+        const double da = plane.dot(Unproject(a).cast<double>());
+        const double db = plane.dot(Unproject(b).cast<double>());
 
-      p = p / p(3);
+        if (da >= 0.0)
+          clipped.push_back(a);
 
-      if (p(0) > -1 && p(0) < 1 && p(1) > -1 && p(1) < 1 && p(2) > -1 && p(2) < 1) {
-        return true;
+        if ((da >= 0.0) != (db >= 0.0))
+          clipped.push_back(a + (b - a) * float(da / (da - db)));
       }
     }
 
-    return false;
+    return clipped;
   }
 
-  void GenerateMaskTexture(
-      MirrorSurface& surface,
-      pangolin::GlTexture& tex,
-      int width = 256,
-      int height = 256) {
-    pangolin::ManagedImage<float> image;
-    surface.GenerateMask(image, width, height);
-    tex.Reinitialise(width, height, GL_LUMINANCE8, true, 0, GL_LUMINANCE, GL_FLOAT, image.ptr);
+  bool InView(const MirrorSurface& surface, const pangolin::OpenGlRenderState& cam) {
+    return ClipToFrustum(surface.Boundary_w(), cam.GetProjectionModelViewMatrix()).size() >= 3;
+  }
+
+  // Planes through the reflected eye and the edges of the part of the
+  // mirror's bounding rectangle in view. Anything outside them can't be seen
+  // in the mirror.
+  Eigen::MatrixX4f ReflectionCullPlanes(
+      const MirrorSurface& surface,
+      const pangolin::OpenGlRenderState& cam) {
+    const std::vector<Eigen::Vector3f>& rect = surface.BoundingRect_w();
+    const std::vector<Eigen::Vector3f> polygon = ClipToFrustum(
+        {rect[0], rect[1], rect[3], rect[2]}, cam.GetProjectionModelViewMatrix());
+
+    if (polygon.size() < 3)
+      return Eigen::MatrixX4f();
+
+    const Eigen::Vector3f eye =
+        ((Eigen::Matrix4d)cam.GetModelViewMatrix().Inverse()).topRightCorner(3, 1).cast<float>();
+    const Eigen::Vector3f virtualEye = (GetReflectionMatrix(surface) * Unproject(eye)).head<3>();
+
+    Eigen::Vector3f centroid = Eigen::Vector3f::Zero();
+    for (const Eigen::Vector3f& p : polygon) {
+      centroid += p / polygon.size();
+    }
+
+    Eigen::MatrixX4f planes(polygon.size(), 4);
+    size_t numPlanes = 0;
+
+    for (size_t i = 0; i < polygon.size(); i++) {
+      Eigen::Vector3f n =
+          (polygon[i] - virtualEye).cross(polygon[(i + 1) % polygon.size()] - virtualEye);
+
+      // skip edges left degenerate by clipping
+      if (n.norm() < 1e-8f)
+        continue;
+
+      n.normalize();
+      if (n.dot(centroid - virtualEye) < 0.0f)
+        n = -n;
+
+      planes.row(numPlanes++) << n.transpose(), -n.dot(virtualEye);
+    }
+
+    return planes.topRows(numPlanes);
   }
 
   const float surfaceOffset;
+  const Eigen::Vector2f screenSize;
+  float resolutionScale = 1.0f;
+  GpuProfiler* profiler = nullptr;
+
+  std::vector<Reflection> reflections;
 
   pangolin::GlSlProgram shader;
+  pangolin::GlSlProgram stencilShader;
 
   pangolin::GlFramebuffer frameBuffer;
   pangolin::GlTexture depthTex;
   pangolin::GlTexture colorTex;
+  pangolin::GlTexture reflectionDepthTex;
 
   std::vector<pangolin::GlTexture> maskTextures;
 };
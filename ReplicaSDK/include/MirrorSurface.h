@@ -3,6 +3,7 @@
 #include <pangolin/gl/gl.h>
 #include <pangolin/image/managed_image.h>
 #include <pangolin/utils/picojson.h>
+#include <string>
 #include <vector>
 
 // Homogenise input
@@ -38,11 +39,13 @@ class MirrorSurface {
 
   Eigen::Matrix<float, 2, 4> T_manifold_plane() const;
 
-  void GenerateMask(pangolin::ManagedImage<float>& image, int w, int h);
+  // Boundary in the pixel coordinates of a w x h mask over the bounding rect
+  std::vector<Eigen::Vector2f> MaskBoundary(int w, int h) const;
 
- private:
-  bool InBoundary(const Eigen::Vector4f& p_w);
+  // Antialiased mask of the boundary over the bounding rect, 255 inside
+  void GenerateMask(pangolin::ManagedImage<uint8_t>& image, int w, int h) const;
 
+ private:
   Eigen::Vector3f centroid_w;
   Eigen::Vector4f plane_w;
 
@@ -56,3 +59,15 @@ class MirrorSurface {
 
   float reflectivity;
 };
+
+// $XDG_CACHE_HOME/replica or ~/.cache/replica, empty if neither is set
+std::string DefaultMaskCacheDir();
+
+// Masks of all surfaces loaded from surfaceFile, rasterised in parallel. They
+// are cached in cacheDir keyed by a hash of the file, unless either is empty.
+std::vector<pangolin::ManagedImage<uint8_t>> LoadOrGenerateMasks(
+    const std::vector<MirrorSurface>& surfaces,
+    const std::string& surfaceFile,
+    int w,
+    int h,
+    const std::string& cacheDir = DefaultMaskCacheDir());
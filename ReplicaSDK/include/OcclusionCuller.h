@@ -0,0 +1,63 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Software rasterised occlusion culling of bounding boxes against quad occluders
+#pragma once
+#include <Eigen/Geometry>
+#include <cstdint>
+#include <vector>
+
+class OcclusionCuller {
+ public:
+  // width must be a multiple of 4
+  OcclusionCuller(const size_t width = 256, const size_t height = 128);
+
+  // World space occluder quads, four vertices each
+  void SetOccluders(std::vector<Eigen::Vector3f>&& quads);
+
+  size_t NumOccluderQuads() const {
+    return quads.size() / 4;
+  }
+
+  // Rasterises the occluders as seen through mvp on worker threads and builds
+  // the depth hierarchy. Triangles clockwise or counter clockwise in window
+  // coordinates are skipped when cullCW or cullCCW is set, matching what the
+  // GPU would draw.
+  void Rasterise(const Eigen::Matrix4f& mvp, const bool cullCW, const bool cullCCW);
+
+  // False if the box is outside the view or behind the rasterised occluders
+  bool IsVisible(const Eigen::AlignedBox3f& box) const;
+
+ private:
+  // Edge functions and inverse depth plane of a screen space triangle
+  struct Triangle {
+    float edges[3][3];
+    float invDepth[3];
+    int minX, maxX, minY, maxY;
+  };
+
+  bool SetupTriangle(
+      const Eigen::Vector3f& v0,
+      const Eigen::Vector3f& v1,
+      const Eigen::Vector3f& v2,
+      const bool cullCW,
+      const bool cullCCW,
+      Triangle& tri) const;
+
+  void RasteriseRows(const Triangle& tri, const int rowBegin, const int rowEnd);
+
+  void BuildHierarchy();
+
+  std::vector<Eigen::Vector3f> quads;
+
+  // screen x, y and 1/w of each transformed occluder vertex, 1/w <= 0 if
+  // the vertex is too close to or behind the camera
+  std::vector<Eigen::Vector3f> screen;
+  std::vector<Triangle> triangles;
+
+  Eigen::Matrix4f mvp;
+
+  // levels[0] holds the nearest occluder 1/w per pixel (0 where empty), each
+  // further level the farthest of its 2x2 children
+  std::vector<std::vector<float>> levels;
+  std::vector<size_t> widths;
+  std::vector<size_t> heights;
+};
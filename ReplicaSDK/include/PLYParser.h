@@ -1,8 +1,9 @@
 // Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
 #pragma once
 
+#include "LoadTrace.h"
 #include "MeshData.h"
 
 #include <string>
 
-void PLYParse(MeshData& meshData, const std::string& filename);
+void PLYParse(MeshData& meshData, const std::string& filename, LoadTrace* trace = nullptr);
@@ -3,35 +3,104 @@
 #include <pangolin/display/opengl_render_state.h>
 #include <pangolin/gl/gl.h>
 #include <pangolin/gl/glsl.h>
+#include <Eigen/Geometry>
+#include <map>
 #include <memory>
 #include <string>
 
+#include "Arena.h"
 #include "Assert.h"
+#include "GpuProfiler.h"
+#include "LoadTrace.h"
 #include "MeshData.h"
+#include "OcclusionCuller.h"
+#include "ProgramCache.h"
 
 #define XSTR(x) #x
 #define STR(x) XSTR(x)
 
+// Options controlling how a PTexMesh is loaded
+struct PTexMeshOptions {
+  // Upper bound on the CPU memory used by in-flight submeshes while loading.
+  // Submeshes are split, processed and uploaded in batches that fit under this
+  // budget and freed straight after upload. 0 processes everything in one batch.
+  size_t maxLoadBytes = 0;
+
+  // Number of faces per cluster for per-frame frustum and normal cone
+  // culling of clusters within each submesh. 0 disables clustering.
+  size_t clusterSize = 0;
+
+  // Store vertex positions as 16-bit integers quantised to each submesh's
+  // bounding box, and indices as 16-bit where a submesh has few enough vertices
+  bool compactVertices = false;
+
+  // Number of quads, taken from the submeshes with the largest surface area,
+  // rasterised on the CPU each frame to skip occluded submeshes in Render.
+  // 0 disables occlusion culling.
+  size_t occluderQuads = 0;
+
+  // Number of coarser levels of detail built for each submesh by merging 2x2
+  // patches of quads, with atlas tiles downsampled to match. 0 disables LOD.
+  size_t lodLevels = 0;
+
+  // Give every atlas tile a border of texels copied from the adjacent faces,
+  // so shading samples within the tile instead of following adjacency at its
+  // edges. Atlases grow by (tileSize + 2)^2 / tileSize^2 and DXT1 atlases are
+  // recompressed.
+  bool padAtlases = false;
+
+  // Arena the CPU buffers of each load batch are allocated from, reset once
+  // the batch is uploaded. Not owned, and used by one load at a time. Null
+  // allocates from the heap.
+  Arena* loadArena = nullptr;
+
+  // Chrome trace-event JSON file the load stages are written to, see
+  // LoadTrace. Empty disables tracing.
+  std::string traceFile;
+
+  // Directory linked shader programs are cached in, see BuildProgram. Empty
+  // compiles them every time.
+  std::string programCacheDir = DefaultProgramCacheDir();
+};
+
 class PTexMesh {
  public:
-  PTexMesh(const std::string& meshFile, const std::string& atlasFolder);
+  PTexMesh(
+      const std::string& meshFile,
+      const std::string& atlasFolder,
+      const PTexMeshOptions& options = PTexMeshOptions());
 
   virtual ~PTexMesh();
 
+  // Rows of cullPlanes are extra world space planes, geometry entirely on
+  // their negative side is skipped
   void RenderSubMesh(
       size_t subMesh,
       const pangolin::OpenGlRenderState& cam,
-      const Eigen::Vector4f& clipPlane);
+      const Eigen::Vector4f& clipPlane,
+      const Eigen::MatrixX4f& cullPlanes = Eigen::MatrixX4f());
 
   void RenderSubMeshDepth(
       size_t subMesh,
       const pangolin::OpenGlRenderState& cam,
       const float depthScale,
-      const Eigen::Vector4f& clipPlane);
+      const Eigen::Vector4f& clipPlane,
+      const Eigen::MatrixX4f& cullPlanes = Eigen::MatrixX4f());
 
   void Render(
       const pangolin::OpenGlRenderState& cam,
-      const Eigen::Vector4f& clipPlane = Eigen::Vector4f(0.0f, 0.0f, 0.0f, 0.0f));
+      const Eigen::Vector4f& clipPlane = Eigen::Vector4f(0.0f, 0.0f, 0.0f, 0.0f),
+      const Eigen::MatrixX4f& cullPlanes = Eigen::MatrixX4f());
+
+  // Renders cams[i], clipped by row i of clipPlanes if given, to layer i of
+  // the bound layered framebuffer, e.g. a ViewArray, in a single pass over the
+  // submeshes with one instanced draw each for all views that see it. Meant
+  // for many small views, it uses neither clusters, occlusion culling nor the
+  // depth prepass, and picks the finest level of detail any view needs.
+  // GL_CLIP_DISTANCE0 is enabled for the draws when clipPlanes are given.
+  void RenderViews(
+      const std::vector<pangolin::OpenGlRenderState>& cams,
+      const Eigen::MatrixX4f& clipPlanes = Eigen::MatrixX4f());
 
   void RenderWireframe(
       const pangolin::OpenGlRenderState& cam,
@@ -40,7 +109,8 @@ class PTexMesh {
   void RenderDepth(
     const pangolin::OpenGlRenderState& cam,
     const float depthScale=1.0f,
-    const Eigen::Vector4f& clipPlane = Eigen::Vector4f(0.0f, 0.0f, 0.0f, 0.0f));
+    const Eigen::Vector4f& clipPlane = Eigen::Vector4f(0.0f, 0.0f, 0.0f, 0.0f),
+    const Eigen::MatrixX4f& cullPlanes = Eigen::MatrixX4f());
 
   float Exposure() const;
   void SetExposure(const float& val);
@@ -51,34 +121,347 @@ class PTexMesh {
   float Saturation() const;
   void SetSaturation(const float& val);
 
+  // Exposure, gamma and saturation of a colour output
+  struct ToneSettings {
+    float exposure;
+    float gamma;
+    float saturation;
+  };
+
+  // Tone settings of further colour outputs Render writes to colour
+  // attachments 3 onwards with ExtraOutputs set, from the same atlas fetch as
+  // the main colour, so exposure brackets take a single pass. Colour
+  // attachment 2 receives the linear colour before any tone mapping, for HDR
+  // output.
+  const std::vector<ToneSettings>& Brackets() const;
+  void SetBrackets(const std::vector<ToneSettings>& val);
+
+  static constexpr size_t MAX_BRACKETS = 5;
+
+  // Render also writes camera depth times this scale to colour attachment 1
+  // with ExtraOutputs set, in the same units as RenderDepth
+  float DepthOutputScale() const;
+  void SetDepthOutputScale(const float& val);
+
+  // Write the depth, HDR and bracket outputs, for framebuffers with colour
+  // attachments after the first, off by default. Turning it on builds the
+  // programs Render draws with.
+  bool ExtraOutputs() const;
+  void SetExtraOutputs(const bool& val);
+
+  // Draw quads as triangle pairs generated in the vertex shader from the
+  // index buffer instead of expanding GL_LINES_ADJACENCY in a geometry shader
+  bool VertexPulling() const;
+  void SetVertexPulling(const bool& val);
+
+  // Lay down depth front to back with a depth only pass first, so the shading
+  // pass only runs for visible fragments
+  bool DepthPrepass() const;
+  void SetDepthPrepass(const bool& val);
+
+  // Times each submesh draw when set, not owned
+  GpuProfiler* Profiler() const;
+  void SetProfiler(GpuProfiler* val);
+
+  // Count the fragments shaded by Render into LastRenderStats, this waits on
+  // the GPU at the end of every Render call
+  bool CountFragments() const;
+  void SetCountFragments(const bool& val);
+
+  // Skip occluded submeshes in Render, when PTexMeshOptions::occluderQuads
+  // selected occluders at load
+  bool OcclusionCulling() const;
+  void SetOcclusionCulling(const bool& val);
+
+  // Level of detail drawn by Render, -1 picks the coarsest level of each
+  // submesh whose quads project to at most LodPixels() pixels
+  int LodLevel() const;
+  void SetLodLevel(const int& val);
+
+  float LodPixels() const;
+  void SetLodPixels(const float& val);
+
+  // Number of levels of detail including full resolution
+  size_t NumLodLevels() const;
+
   size_t GetNumSubMeshes() {
     return meshes.size();
   }
 
+  // Statistics of the last Render/RenderDepth call
+  struct RenderStats {
+    size_t clusters = 0;
+    size_t visibleClusters = 0;
+    uint64_t shadedFragments = 0; // only counted when enabled
+    size_t subMeshes = 0;
+    size_t culledSubMeshes = 0; // outside the view, clip plane or cull planes
+    size_t occludedSubMeshes = 0;
+    std::vector<size_t> lodQuads; // quads drawn at each level of detail
+  };
+
+  const RenderStats& LastRenderStats() const {
+    return renderStats;
+  }
+
+  // Group of faces with a bounding sphere and a cone bounding their normals,
+  // taken by the winding of their indices, (v2 - v0) x (v3 - v1)
+  struct Cluster {
+    Eigen::Vector3f center;
+    float radius;
+    Eigen::Vector3f coneAxis;
+    float coneAngle; // >= pi/2 if the cluster can never be culled by facing
+    uint32_t firstFace; // in the clustered face order
+    uint32_t numFaces;
+  };
+
+  // Reorders the faces of a submesh into clusters of at most clusterSize
+  // faces, faceOrder maps clustered face index to original face index
+  static void BuildClusters(
+      const MeshData& mesh,
+      const size_t clusterSize,
+      std::vector<uint32_t>& faceOrder,
+      std::vector<Cluster>& clusters);
+
+  // Coarser version of a quad mesh with 2x2 patches of quads around valence 4
+  // vertices merged into single quads. children holds four entries per coarse
+  // face, the merged faces in corner order with the index of their corner at
+  // the patch centre in the top bits, or a single face followed by FACE_MASK.
+  static MeshData BuildLod(const MeshData& mesh, std::vector<uint32_t>& children);
+
+  // Faces of a mesh grouped into submeshes, each a contiguous range of faces.
+  // Face order within a range is the order of the atlas tiles of that submesh.
+  struct MeshPartition {
+    std::vector<uint32_t> faces; // original face indices
+    std::vector<uint32_t> chunkStart; // numChunks + 1 offsets into faces
+
+    size_t NumChunks() const {
+      return chunkStart.size() - 1;
+    }
+
+    size_t ChunkSize(size_t chunk) const {
+      return chunkStart[chunk + 1] - chunkStart[chunk];
+    }
+  };
+
+  // Fixed grid partition matching the atlases shipped with the dataset
+  static MeshPartition PartitionMesh(const MeshData& mesh, const float splitSize);
+
+  // Octree partition with between minFaces and maxFaces faces per submesh
+  // where the geometry allows it, requires atlases repacked to match
+  static MeshPartition
+  PartitionMeshAdaptive(const MeshData& mesh, const size_t minFaces, const size_t maxFaces);
+
+  static MeshData
+  ExtractSubMesh(const MeshData& mesh, const MeshPartition& partition, const size_t chunk);
+
+  // Fixed grid partition extracted into one mesh per submesh
+  static std::vector<MeshData> SplitMesh(const MeshData& mesh, const float splitSize);
+
+  // Face across each edge of a quad mesh in the low 30 bits, and the number of
+  // 90 degree rotations between the faces in the top two
+  static void CalculateAdjacency(const MeshData& mesh, ArenaVector<uint32_t>& adjFaces);
+
  private:
   struct Mesh {
     pangolin::GlTexture atlas;
     pangolin::GlBuffer vbo;
     pangolin::GlBuffer ibo;
     pangolin::GlBuffer abo;
+
+    Eigen::AlignedBox3f bounds;
+
+    // dequantisation of compact positions, position = offset + scale * vbo
+    Eigen::Vector3f positionScale = Eigen::Vector3f::Ones();
+    Eigen::Vector3f positionOffset = Eigen::Vector3f::Zero();
+
+    // clustered rendering, faces in the ibo are in cluster order
+    std::vector<Cluster> clusters;
+    pangolin::GlBuffer clusterFaceBuffer; // first face of each cluster, per instance
+    pangolin::GlBuffer faceRemapBuffer; // clustered face to atlas face
+
+    // mean quad edge length, for level of detail selection
+    float quadSize = 0.0f;
+
+    // coarser levels of detail, each built from the one before
+    std::vector<std::unique_ptr<Mesh>> lods;
+    std::vector<uint32_t> lodChildren; // see BuildLod, freed once the atlas is built
   };
 
-  static std::vector<MeshData> SplitMesh(const MeshData& mesh, const float splitSize);
-  static void CalculateAdjacency(const MeshData& mesh, std::vector<uint32_t>& adjFaces);
+  // layout of GL_DRAW_INDIRECT_BUFFER entries for glMultiDrawElementsIndirect
+  struct DrawCommand {
+    uint32_t count;
+    uint32_t instanceCount;
+    uint32_t firstIndex;
+    uint32_t baseVertex;
+    uint32_t baseInstance;
+  };
+
+  // Features mesh programs are specialised for, each compiled in by the
+  // define of the same name, see Program
+  enum ProgramFeature : uint32_t {
+    VERTEX_PULLING = 1 << 0, // mesh-ptex-pull.vert instead of mesh-ptex.geom
+    CLUSTERS = 1 << 1,
+    LAYERED = 1 << 2,
+    CLIP_PLANE = 1 << 3, // writes gl_ClipDistance
+    TONE_MAP = 1 << 4, // exposure, gamma and saturation, else colour as stored
+    MRT = 1 << 5, // depth, HDR and bracket outputs
+    PADDED_ATLAS = 1 << 6,
+    DEPTH = 1 << 7, // mesh-depth.frag, the prepass with VERTEX_PULLING
+  };
+
+  // Program for a set of features, built on first use
+  pangolin::GlSlProgram& Program(const uint32_t features);
+
+  // Cheapest shading features for the current settings
+  uint32_t ShadingFeatures(const bool clip) const;
+
+  // GL state a pass depends on, queried once at its start
+  struct PassState {
+    uint32_t features = 0; // see ShadingFeatures
+    int viewportHeight = 0; // for SelectLod
+    bool frontFaceCCW = true;
+    // window space windings GL culls
+    bool cullCW = false;
+    bool cullCCW = false;
+    // Side of Cluster::coneAxis facing away from the eye in culled faces, 1 or
+    // -1, 0 when faces aren't culled by facing
+    int coneSign = 0;
+  };
+
+  PassState QueryPassState(const pangolin::OpenGlRenderState& cam, const bool clip) const;
+
+  static int ViewportHeight();
+
+  void RenderSubMesh(
+      size_t subMesh,
+      const pangolin::OpenGlRenderState& cam,
+      const Eigen::Vector4f& clipPlane,
+      const Eigen::MatrixX4f& cullPlanes,
+      const PassState& pass);
+
+  void RenderSubMeshDepth(
+      size_t subMesh,
+      const pangolin::OpenGlRenderState& cam,
+      const float depthScale,
+      const Eigen::Vector4f& clipPlane,
+      const Eigen::MatrixX4f& cullPlanes,
+      const PassState& pass);
+
+  // Depth only draw for the prepass, using the same triangles as the shading pass
+  void RenderSubMeshPrepass(
+      size_t subMesh,
+      const pangolin::OpenGlRenderState& cam,
+      const Eigen::Vector4f& clipPlane,
+      const Eigen::MatrixX4f& cullPlanes,
+      const PassState& pass);
+
+  // Submeshes with bounding boxes inside the view, the clip plane and cullPlanes
+  std::vector<size_t> VisibleSubMeshes(
+      const pangolin::OpenGlRenderState& cam,
+      const Eigen::Vector4f& clipPlane,
+      const Eigen::MatrixX4f& cullPlanes) const;
+
+  // Sorts submeshes by distance of their bounding boxes from the camera
+  void SortFrontToBack(const pangolin::OpenGlRenderState& cam, std::vector<size_t>& subMeshes)
+      const;
+
+  // Level of detail of a submesh to draw for cam, 0 is full resolution
+  size_t SelectLod(
+      const Mesh& mesh,
+      const pangolin::OpenGlRenderState& cam,
+      const int viewportHeight) const;
+
+  // Removes submeshes hidden behind the occluders from subMeshes
+  void CullOccluded(
+      const pangolin::OpenGlRenderState& cam,
+      const PassState& pass,
+      std::vector<size_t>& subMeshes);
+
+  // Fills drawCommands for the clusters visible to cam, merging runs of
+  // consecutive clusters into a single command. Clusters are only dropped for
+  // facing by the face culling in pass.
+  void CullClusters(
+      const Mesh& mesh,
+      const pangolin::OpenGlRenderState& cam,
+      const Eigen::Vector4f& clipPlane,
+      const Eigen::MatrixX4f& cullPlanes,
+      const PassState& pass);
+
+  // Issues drawCommands, optionally remapping gl_PrimitiveID to atlas faces
+  void DrawClusters(const Mesh& mesh, const GLenum mode, const bool remapFaces);
+
+  // Issues drawCommands as six vertex per quad triangle lists
+  void DrawClusterArrays();
+
+  void UploadDrawCommands(const void* commands, const size_t numBytes);
+
+  // Sets the tone mapping, brackets and depth output uniforms of mesh-ptex.frag
+  void SetToneUniforms(pangolin::GlSlProgram& program, const uint32_t features);
+
+  // Tiles per row of a submesh's atlas
+  int WidthInTiles(const Mesh& mesh) const;
+
+  // Uploads to a stream buffer of the given type, growing it as needed
+  static void UploadStream(
+      pangolin::GlBuffer& buffer,
+      const GLenum type,
+      const void* data,
+      const size_t numBytes);
+
+  // Uploads geometry and adjacency, returning the position quantisation error
+  float UploadSubMesh(Mesh& mesh, const MeshData& data, const ArenaVector<uint32_t>& adjFaces);
+
+  // Renders the atlases of each level of detail from the level before
+  void BuildLodAtlases(const std::string& shadir);
+
+  // Replaces every atlas with its padded copy, see PTexMeshOptions::padAtlases
+  void PadAtlases(const std::string& shadir);
 
   void LoadMeshData(const std::string& meshFile);
   void LoadAtlasData(const std::string& atlasFolder);
 
+  PTexMeshOptions options;
+
   float splitSize = 0.0f;
   uint32_t tileSize = 0;
 
-  pangolin::GlSlProgram shader;
-  pangolin::GlSlProgram depthShader;
+  bool adaptiveSplit = false;
+  size_t minFaces = 0;
+  size_t maxFaces = 0;
+
+  bool paddedAtlases = false;
+
+  std::string shadir;
+  std::map<uint32_t, std::unique_ptr<pangolin::GlSlProgram>> programs;
+
+  pangolin::GlBuffer drawCommandBuffer;
+  std::vector<DrawCommand> drawCommands;
+
+  // RenderViews transforms and the views drawn of each submesh, per instance
+  pangolin::GlBuffer viewBuffer;
+  pangolin::GlBuffer viewIndexBuffer;
+  RenderStats renderStats;
+
+  std::unique_ptr<OcclusionCuller> occlusionCuller;
+  GpuProfiler* profiler = nullptr;
+
+  // only set while loading
+  std::unique_ptr<LoadTrace> loadTrace;
 
   float exposure = 1.0f;
+  float depthOutputScale = 1.0f;
+  bool extraOutputs = false;
   float gamma = 1.0f;
   float saturation = 1.0f;
+  std::vector<ToneSettings> brackets;
   bool isHdr = false;
+  bool vertexPulling = false;
+  bool depthPrepass = false;
+  bool countFragments = false;
+  bool occlusionCulling = true;
+  GLuint fragmentQuery = 0;
+  int lodLevel = -1;
+  float lodPixels = 4.0f;
 
   static constexpr int ROTATION_SHIFT = 30;
   static constexpr int FACE_MASK = 0x3FFFFFFF;
@@ -0,0 +1,198 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// 360 degree panoramas, the six faces of a cube rendered in one layered pass
+// and resampled to an equirectangular image on the GPU
+#pragma once
+#include <pangolin/display/opengl_render_state.h>
+#include <pangolin/gl/gl.h>
+#include <pangolin/gl/glsl.h>
+#include <pangolin/image/managed_image.h>
+#include <Eigen/Geometry>
+#include <memory>
+#include "GpuProfiler.h"
+#include "PTexLib.h"
+#include "ProgramCache.h"
+#include "ViewArray.h"
+
+class PanoramaRenderer {
+ public:
+  // width x height equirectangular output, width usually twice height, from
+  // cube faces of faceSize pixels, by default a quarter of width. With
+  // renderDepth the distance along each ray, scaled by the mesh's
+  // DepthOutputScale, is resampled too.
+  PanoramaRenderer(
+      const int width,
+      const int height,
+      const std::string& shadir,
+      const int faceSize = 0,
+      const bool renderDepth = false)
+      : width(width),
+        height(height),
+        faceSize(faceSize > 0 ? faceSize : width / 4),
+        renderDepth(renderDepth),
+        faces(this->faceSize, this->faceSize, 6, renderDepth),
+        colourTex(width, height),
+        depthTex(width, height, GL_R32F, false, 0, GL_RED, GL_FLOAT, 0) {
+    ASSERT(pangolin::FileExists(shadir), "Shader directory not found!");
+    BuildProgram(
+        shader,
+        shadir,
+        {{pangolin::GlSlVertexShader, "panorama.vert", {}},
+         {pangolin::GlSlFragmentShader, "panorama.frag", {}}});
+
+    // every pixel is written once, so no depth buffer
+    frameBuffer.AttachColour(colourTex);
+    if (renderDepth) {
+      frameBuffer.AttachColour(depthTex);
+    }
+
+    // colour is filtered across face texels, depth isn't
+    glBindTexture(GL_TEXTURE_2D_ARRAY, faces.Texture());
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    // 90 degree field of view centred on each face
+    const float f = this->faceSize / 2.0f;
+    projection = pangolin::ProjectionMatrixRDF_BottomLeft(
+        this->faceSize, this->faceSize, f, f, f, f, 0.1f, 100.0f);
+    const Eigen::Matrix4d P = projection;
+
+    // forward and down of each face in the panorama camera frame: front,
+    // right, back, left, up and down
+    const Eigen::Vector3d forward[6] = {Eigen::Vector3d::UnitZ(),
+                                        Eigen::Vector3d::UnitX(),
+                                        -Eigen::Vector3d::UnitZ(),
+                                        -Eigen::Vector3d::UnitX(),
+                                        -Eigen::Vector3d::UnitY(),
+                                        Eigen::Vector3d::UnitY()};
+    const Eigen::Vector3d down[6] = {Eigen::Vector3d::UnitY(),
+                                     Eigen::Vector3d::UnitY(),
+                                     Eigen::Vector3d::UnitY(),
+                                     Eigen::Vector3d::UnitY(),
+                                     Eigen::Vector3d::UnitZ(),
+                                     -Eigen::Vector3d::UnitZ()};
+
+    for (int i = 0; i < 6; i++) {
+      Eigen::Matrix4d R = Eigen::Matrix4d::Identity();
+      R.block<1, 3>(0, 0) = down[i].cross(forward[i]).transpose();
+      R.block<1, 3>(1, 0) = down[i].transpose();
+      R.block<1, 3>(2, 0) = forward[i].transpose();
+
+      faceRotations[i] = R;
+      faceTransforms[i] = Eigen::Matrix4d(P * R);
+    }
+  }
+
+  int Width() const {
+    return width;
+  }
+
+  int Height() const {
+    return height;
+  }
+
+  int FaceSize() const {
+    return faceSize;
+  }
+
+  // Times the resampling when set, not owned
+  void SetProfiler(GpuProfiler* val) {
+    profiler = val;
+  }
+
+  // Renders the panorama around the pose of cam, the centre of the image
+  // looking along its viewing direction with its up towards the top. Mirrors
+  // aren't drawn.
+  void Render(PTexMesh& ptexMesh, const pangolin::OpenGlRenderState& cam) {
+    const Eigen::Matrix4d T_camera_world = cam.GetModelViewMatrix();
+
+    std::vector<pangolin::OpenGlRenderState> faceCams;
+    for (int i = 0; i < 6; i++) {
+      faceCams.emplace_back(
+          projection, Eigen::Matrix4d((Eigen::Matrix4d)faceRotations[i] * T_camera_world));
+    }
+
+    const bool extraOutputs = ptexMesh.ExtraOutputs();
+    ptexMesh.SetExtraOutputs(renderDepth);
+
+    faces.Bind();
+    glEnable(GL_CULL_FACE);
+    ptexMesh.RenderViews(faceCams);
+    glDisable(GL_CULL_FACE);
+    faces.Unbind();
+
+    ptexMesh.SetExtraOutputs(extraOutputs);
+
+    GpuProfiler::Scope scope(profiler, "panorama resample");
+
+    frameBuffer.Bind();
+    glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT);
+    glViewport(0, 0, width, height);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+
+    shader.Bind();
+    for (int i = 0; i < 6; i++) {
+      shader.SetUniform("faces[" + std::to_string(i) + "]", faceTransforms[i]);
+    }
+    shader.SetUniform("size", (float)width, (float)height);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, faces.Texture());
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, faces.DepthTexture());
+
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    shader.Unbind();
+
+    glPopAttrib();
+    frameBuffer.Unbind();
+  }
+
+  // Equirectangular colour of the last Render, top row first
+  void Download(pangolin::ManagedImage<Eigen::Matrix<uint8_t, 3, 1>>& image) {
+    ASSERT(image.w == (size_t)width && image.h == (size_t)height);
+    colourTex.Download(image.ptr, GL_RGB, GL_UNSIGNED_BYTE);
+  }
+
+  // Distance along each ray of the last Render, top row first
+  void DownloadDepth(pangolin::ManagedImage<float>& image) {
+    ASSERT(renderDepth, "Panorama depth not rendered");
+    ASSERT(image.w == (size_t)width && image.h == (size_t)height);
+    depthTex.Download(image.ptr, GL_RED, GL_FLOAT);
+  }
+
+  pangolin::GlTexture& Texture() {
+    return colourTex;
+  }
+
+  pangolin::GlTexture& DepthTexture() {
+    return depthTex;
+  }
+
+ private:
+  const int width;
+  const int height;
+  const int faceSize;
+  const bool renderDepth;
+
+  ViewArray faces;
+
+  pangolin::OpenGlMatrix projection;
+  pangolin::OpenGlMatrix faceRotations[6]; // panorama camera to face camera
+  pangolin::OpenGlMatrix faceTransforms[6]; // projection times rotation
+
+  pangolin::GlTexture colourTex;
+  pangolin::GlTexture depthTex;
+  pangolin::GlFramebuffer frameBuffer;
+
+  pangolin::GlSlProgram shader;
+  GpuProfiler* profiler = nullptr;
+};
@@ -0,0 +1,30 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Linked shader programs cached on disk with glGetProgramBinary, so processes
+// after the first skip compiling and linking
+#pragma once
+#include <pangolin/gl/glsl.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Stage of a program, a file in the shader directory and its defines
+struct ShaderStage {
+  pangolin::GlSlShaderType type;
+  std::string file;
+  std::map<std::string, std::string> defines;
+};
+
+// $XDG_CACHE_HOME/replica/programs or ~/.cache/replica/programs, empty if
+// neither is set
+std::string DefaultProgramCacheDir();
+
+// Compiles and links program from stages in shadir, or loads the binary of an
+// earlier link from cacheDir. Binaries are keyed by the GL vendor, renderer
+// and version and a hash of the sources and defines, and ones the driver
+// rejects are rebuilt. An empty cacheDir disables caching.
+void BuildProgram(
+    pangolin::GlSlProgram& program,
+    const std::string& shadir,
+    const std::vector<ShaderStage>& stages,
+    const std::string& cacheDir = DefaultProgramCacheDir());
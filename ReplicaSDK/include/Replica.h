@@ -0,0 +1,106 @@
+/* Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved */
+/* C interface to the renderer, built as libReplica, for binding from other
+ * languages. Batches of views are rendered in one layered pass and read back
+ * asynchronously straight into buffers owned by the caller. */
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REPLICA_API __attribute__((visibility("default")))
+
+/* Bumped when a function or struct changes incompatibly */
+#define REPLICA_API_VERSION 1
+
+typedef enum ReplicaStatus {
+  REPLICA_OK = 0,
+  REPLICA_NOT_READY = 1, /* replica_batch_wait timed out */
+  REPLICA_INVALID_ARGUMENT = -1,
+  REPLICA_ERROR = -2
+} ReplicaStatus;
+
+typedef struct ReplicaContext ReplicaContext;
+typedef struct ReplicaScene ReplicaScene;
+typedef struct ReplicaBatch ReplicaBatch;
+
+/* Camera of one view, x right, y down and z forward */
+typedef struct ReplicaView {
+  double T_camera_world[16]; /* column major, world to camera */
+  double fx, fy; /* focal lengths in pixels */
+  double cx, cy; /* principal point, 0 at the centre of the top left pixel */
+} ReplicaView;
+
+/* Where the images of one view go, top row first. Either pointer may be NULL
+ * to skip that image. Buffers must stay valid until the batch completes or
+ * is cancelled. */
+typedef struct ReplicaOutput {
+  uint8_t* colour; /* RGBA8 */
+  size_t colour_stride; /* bytes between rows, 0 for width * 4 */
+  float* depth; /* camera z in metres, 0 where no surface was hit */
+  size_t depth_stride; /* bytes between rows, 0 for width * 4 */
+} ReplicaOutput;
+
+REPLICA_API int replica_api_version(void);
+
+/* Message of the last error on the calling thread, empty if none */
+REPLICA_API const char* replica_last_error(void);
+
+/* Headless GL context on a device chosen by DRM node, e.g.
+ * /dev/dri/renderD128, or index, NULL and -1 for the default. Returns
+ * REPLICA_INVALID_ARGUMENT if the node or index matches no device, and
+ * REPLICA_ERROR if EGL or GL can't be set up. A context and everything
+ * created with it must only be used on the thread that created it. A thread
+ * may have several contexts, e.g. one per GPU, each call makes the context it
+ * works on current. */
+REPLICA_API ReplicaStatus
+replica_context_create(const char* drm_node, int32_t device_index, ReplicaContext** context);
+
+/* Cancels the context's outstanding batches and closes its scenes */
+REPLICA_API void replica_context_destroy(ReplicaContext* context);
+
+/* Loads mesh.ply and its atlas folder. Mirrors aren't rendered. Arguments
+ * are checked up front, but like the rest of the SDK a scene that fails to
+ * load ends the process. */
+REPLICA_API ReplicaStatus replica_scene_open(
+    ReplicaContext* context,
+    const char* mesh_file,
+    const char* atlas_folder,
+    ReplicaScene** scene);
+
+REPLICA_API void replica_scene_close(ReplicaScene* scene);
+
+REPLICA_API ReplicaStatus replica_scene_set_exposure(ReplicaScene* scene, float exposure);
+
+/* Queues num_views width x height views of scene, clipped to
+ * [z_near, z_far], and returns before they are drawn. The images are written
+ * to outputs[i] by replica_batch_wait. */
+REPLICA_API ReplicaStatus replica_render(
+    ReplicaScene* scene,
+    const ReplicaView* views,
+    const ReplicaOutput* outputs,
+    uint32_t num_views,
+    uint32_t width,
+    uint32_t height,
+    float z_near,
+    float z_far,
+    ReplicaBatch** batch);
+
+/* Waits up to timeout_ns for batch. On REPLICA_OK its images have been
+ * written and batch is freed, on REPLICA_NOT_READY it may be waited on
+ * again, and on REPLICA_ERROR it must still be cancelled. A timeout of 0
+ * polls. */
+REPLICA_API ReplicaStatus replica_batch_wait(ReplicaBatch* batch, uint64_t timeout_ns);
+
+/* Frees batch without writing its images */
+REPLICA_API void replica_batch_cancel(ReplicaBatch* batch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REPLICA_H */
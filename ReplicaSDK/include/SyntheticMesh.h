@@ -0,0 +1,38 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Deterministic room-like scenes, for benchmarking without the dataset
+#pragma once
+#include "MeshData.h"
+
+#include <pangolin/utils/picojson.h>
+
+#include <string>
+
+// Box shaped room with boxes for furniture, every surface tiled with square
+// quads sized so the mesh has roughly numQuads faces. The same numQuads and
+// seed give the same mesh on every platform.
+MeshData GenerateRoomMesh(const size_t numQuads, const uint32_t seed = 0);
+
+// Mirror surface JSON, as read by MirrorSurface, with a wobbly elliptical
+// outline of radii rx and ry along the orthonormal axes u and v of its plane
+picojson::value GenerateMirror(
+    const Eigen::Vector3f& centre,
+    const Eigen::Vector3f& u,
+    const Eigen::Vector3f& v,
+    const float rx,
+    const float ry,
+    const uint32_t seed = 0);
+
+// Scene in the layout of the dataset: mesh.ply, textures/ holding a flat
+// coloured RGB atlas per submesh with parameters.json, and glass.sur with
+// mirrors on two of the room walls
+void WriteSyntheticScene(
+    const std::string& folder,
+    const size_t numQuads,
+    const float splitSize,
+    const int tileSize);
+
+// Binary PLY in the layout of the dataset meshes, readable by PLYParse
+void WritePLY(const MeshData& mesh, const std::string& filename);
+
+// parameters.json as shipped with the dataset atlases
+void WriteParameters(const std::string& filename, const float splitSize, const int tileSize);
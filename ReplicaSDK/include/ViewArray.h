@@ -0,0 +1,73 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Layered framebuffer with one RGBA layer per view, for PTexMesh::RenderViews
+#pragma once
+#include <pangolin/gl/gl.h>
+
+#include <cstdint>
+
+class ViewArray {
+ public:
+  // With depthOutput the camera depth PTexMesh writes to colour attachment 1
+  // is kept in a second array
+  ViewArray(
+      const int width,
+      const int height,
+      const int numViews,
+      const bool depthOutput = false);
+  ~ViewArray();
+
+  ViewArray(const ViewArray&) = delete;
+  ViewArray& operator=(const ViewArray&) = delete;
+
+  int Width() const {
+    return width;
+  }
+
+  int Height() const {
+    return height;
+  }
+
+  int NumViews() const {
+    return numViews;
+  }
+
+  // Bytes of all views, each a bottom up RGBA image, one after another
+  size_t SizeBytes() const {
+    return (size_t)width * height * numViews * 4;
+  }
+
+  // GL_TEXTURE_2D_ARRAY holding view i in layer i
+  GLuint Texture() const {
+    return colour;
+  }
+
+  // GL_TEXTURE_2D_ARRAY of R32F camera depth, 0 without depthOutput
+  GLuint DepthTexture() const {
+    return depthOutput;
+  }
+
+  // Binds the framebuffer with the viewport set to the size of a view and
+  // clears all views
+  void Bind();
+  void Unbind();
+
+  // Copies every view into a pixel buffer in one go, returning before the GPU
+  // has finished so work for the next step can be issued meanwhile
+  void StartDownload();
+
+  // Waits for the copy started by StartDownload, starting one if there is
+  // none, and copies the SizeBytes() bytes of it to data
+  void Download(uint8_t* data);
+
+ private:
+  const int width;
+  const int height;
+  const int numViews;
+
+  GLuint colour = 0;
+  GLuint depth = 0;
+  GLuint depthOutput = 0;
+  GLuint framebuffer = 0;
+  GLuint pixelBuffer = 0;
+  bool downloadStarted = false;
+};
@@ -0,0 +1,191 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "Arena.h"
+#include "Assert.h"
+
+#include <sys/mman.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+constexpr size_t kAlignment = 64;
+constexpr size_t kHugePageBytes = 2 << 20;
+
+// Precedes every block from ArenaAllocate, padded to keep blocks aligned
+struct alignas(kAlignment) BlockHeader {
+  Arena* arena; // null for the heap
+};
+
+thread_local Arena* currentArena = nullptr;
+
+std::atomic<size_t> arenaAllocations(0);
+std::atomic<size_t> heapAllocations(0);
+
+size_t RoundUp(const size_t x, const size_t multiple) {
+  return (x + multiple - 1) / multiple * multiple;
+}
+
+} // namespace
+
+Arena::Arena(const HugePages hugePages, const size_t chunkBytes)
+    : hugePages(hugePages), chunkBytes(RoundUp(chunkBytes, kHugePageBytes)) {}
+
+Arena::~Arena() {
+  // a block outliving its arena would be released into freed memory
+  ASSERT(liveBlocks == 0, "Arena destroyed with " + std::to_string(liveBlocks) + " live blocks");
+
+  for (const Chunk& chunk : chunks) {
+    munmap(chunk.data, chunk.bytes);
+  }
+}
+
+Arena::Stats Arena::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+void* Arena::Allocate(const size_t bytes) {
+  const size_t size = RoundUp(std::max(bytes, (size_t)1), kAlignment);
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  // first fit, so after a reset the earliest chunks fill up first
+  Chunk* chunk = nullptr;
+  for (Chunk& c : chunks) {
+    if (c.bytes - c.used >= size) {
+      chunk = &c;
+      break;
+    }
+  }
+
+  if (!chunk) {
+    chunks.push_back(MapChunk(std::max(size, chunkBytes)));
+    chunk = &chunks.back();
+  }
+
+  void* block = chunk->data + chunk->used;
+  chunk->used += size;
+
+  liveBlocks++;
+  stats.allocations++;
+  stats.usedBytes += size;
+  stats.peakUsedBytes = std::max(stats.peakUsedBytes, stats.usedBytes);
+
+  return block;
+}
+
+void Arena::Release(void*) {
+  std::lock_guard<std::mutex> lock(mutex);
+  ASSERT(liveBlocks > 0);
+  liveBlocks--;
+}
+
+void Arena::Reset() {
+  std::lock_guard<std::mutex> lock(mutex);
+  ASSERT(liveBlocks == 0, "Arena reset with " + std::to_string(liveBlocks) + " live blocks");
+
+  for (Chunk& chunk : chunks) {
+    chunk.used = 0;
+  }
+  stats.usedBytes = 0;
+  stats.resets++;
+}
+
+Arena::Chunk Arena::MapChunk(const size_t bytes) {
+  const size_t size = RoundUp(bytes, kHugePageBytes);
+
+  if (hugePages == HugePages::Explicit) {
+    void* data = mmap(
+        nullptr,
+        size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+        -1,
+        0);
+    if (data != MAP_FAILED) {
+      stats.mappedBytes += size;
+      stats.hugeTlbBytes += size;
+      return {static_cast<uint8_t*>(data), size, 0, true};
+    }
+    // no reserved huge pages left, fall back to transparent ones
+  }
+
+  // over-allocate and trim so the chunk starts on a huge page boundary and
+  // every page of it can be a huge one
+  const size_t mappedSize = size + kHugePageBytes;
+  void* mapped =
+      mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapped == MAP_FAILED) {
+    throw std::bad_alloc();
+  }
+
+  uint8_t* begin = static_cast<uint8_t*>(mapped);
+  uint8_t* data = reinterpret_cast<uint8_t*>(RoundUp((uintptr_t)begin, kHugePageBytes));
+  if (data > begin) {
+    munmap(begin, data - begin);
+  }
+  const size_t tail = (begin + mappedSize) - (data + size);
+  if (tail > 0) {
+    munmap(data + size, tail);
+  }
+
+  if (hugePages != HugePages::None) {
+    madvise(data, size, MADV_HUGEPAGE);
+  }
+
+  stats.mappedBytes += size;
+  return {data, size, 0, false};
+}
+
+Arena::Scope::Scope(Arena* arena) : previous(currentArena) {
+  currentArena = arena;
+}
+
+Arena::Scope::~Scope() {
+  currentArena = previous;
+}
+
+Arena* Arena::Current() {
+  return currentArena;
+}
+
+AllocationCounts GetAllocationCounts() {
+  AllocationCounts counts;
+  counts.arena = arenaAllocations;
+  counts.heap = heapAllocations;
+  return counts;
+}
+
+void* ArenaAllocate(const size_t bytes) {
+  Arena* arena = Arena::Current();
+
+  void* block = nullptr;
+  if (arena) {
+    block = arena->Allocate(sizeof(BlockHeader) + bytes);
+    arenaAllocations++;
+  } else {
+    if (posix_memalign(&block, kAlignment, sizeof(BlockHeader) + bytes) != 0) {
+      throw std::bad_alloc();
+    }
+    heapAllocations++;
+  }
+
+  static_cast<BlockHeader*>(block)->arena = arena;
+  return static_cast<uint8_t*>(block) + sizeof(BlockHeader);
+}
+
+void ArenaFree(void* ptr) {
+  if (!ptr) {
+    return;
+  }
+
+  BlockHeader* header =
+      reinterpret_cast<BlockHeader*>(static_cast<uint8_t*>(ptr) - sizeof(BlockHeader));
+  if (header->arena) {
+    header->arena->Release(header);
+  } else {
+    std::free(header);
+  }
+}
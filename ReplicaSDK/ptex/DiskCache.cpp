@@ -0,0 +1,55 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "DiskCache.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <experimental/filesystem>
+#include <fstream>
+
+uint64_t Fnv1a(uint64_t hash, const std::string& data) {
+  for (const char c : data) {
+    hash = (hash ^ (uint8_t)c) * 1099511628211ull;
+  }
+  return hash;
+}
+
+std::string CacheDir(const std::string& name) {
+  const std::string suffix = name.empty() ? "/replica" : "/replica/" + name;
+
+  if (const char* dir = std::getenv("XDG_CACHE_HOME")) {
+    if (*dir)
+      return std::string(dir) + suffix;
+  }
+  if (const char* home = std::getenv("HOME")) {
+    if (*home)
+      return std::string(home) + "/.cache" + suffix;
+  }
+  return std::string();
+}
+
+bool WriteCacheFile(const std::string& file, const std::function<void(std::ostream&)>& write) {
+  std::error_code err;
+  std::experimental::filesystem::create_directories(
+      std::experimental::filesystem::path(file).parent_path(), err);
+
+  std::string tmpFile = file + ".XXXXXX";
+  const int fd = mkstemp(&tmpFile[0]);
+  if (fd < 0)
+    return false;
+
+  // mkstemp creates the file readable by its owner only
+  fchmod(fd, 0644);
+  close(fd);
+
+  std::ofstream out(tmpFile, std::ios::binary);
+  write(out);
+  out.close();
+
+  if (!out || std::rename(tmpFile.c_str(), file.c_str()) != 0) {
+    std::remove(tmpFile.c_str());
+    return false;
+  }
+  return true;
+}
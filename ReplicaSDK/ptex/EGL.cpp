@@ -1,87 +1,143 @@
 // Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
 #include "EGL.h"
-#include "Assert.h"
 
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <GL/glew.h>
 #include <dlfcn.h>
+#include <cstdlib>
 #include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+namespace {
+
+// Contexts created on each display, which is shared by every context on the
+// same device and only terminated with the last of them
+std::mutex displayMutex;
+std::map<void*, size_t> displayUsers;
+
+// Failures are thrown rather than asserted, so the C API can report them
+void Check(const bool ok, const std::string& message) {
+  if (!ok)
+    throw std::runtime_error(message);
+}
 
-EGLCtx::EGLCtx(const bool createCtx, const int cudaDevice, const bool createSurface)
-    : lib("libEGL.so"), createdCtx(createCtx) {
-  // Try find the DLL (we can't build on anything that doesn't have nvidia drivers without
-  // dynamically loading)
-  handle = dlopen(lib.c_str(), RTLD_LAZY);
+template <typename F>
+void LoadFunction(void* handle, const std::string& lib, const char* name, F& f) {
+  f = (F)dlsym(handle, name);
+  const char* error = dlerror();
+  Check(error == NULL, "Error loading " + std::string(name) + " from " + lib + ", " + error);
+}
 
-  if (nullptr == handle)
-    handle = dlopen(
-        "/usr/local/lib/libEGL.so",
-        RTLD_LAZY); // dgx machines have this location, which is not on the lib search path
+bool HasExtension(const char* extensions, const char* extension) {
+  if (!extensions)
+    return false;
 
-  ASSERT(handle, "Can't find " + lib + ", " + dlerror());
+  const size_t length = std::strlen(extension);
+  for (const char* p = std::strstr(extensions, extension); p; p = std::strstr(p + 1, extension)) {
+    if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0'))
+      return true;
+  }
+  return false;
+}
 
-  dlerror(); // Clear any existing error
+} // namespace
 
-  char* error = NULL;
+EGLCtx::EGLCtx(const EGLOptions& options) : lib("libEGL.so"), ownsDisplay(true) {
+  // the destructor doesn't run when the constructor throws
+  try {
+    Init(options);
+  } catch (...) {
+    Destroy();
+    throw;
+  }
+}
 
-  // Pull out functions
-  eglGetCurrentContext = (EGLContext(*)(void))dlsym(handle, "eglGetCurrentContext");
-  error = dlerror();
-  ASSERT(error == NULL, "Error loading eglGetCurrentContext from " + lib + ", " + error);
-
-  eglInitialize = (EGLBoolean(*)(EGLDisplay, EGLint*, EGLint*))dlsym(handle, "eglInitialize");
-  error = dlerror();
-  ASSERT(error == NULL, "Error loading eglInitialize from " + lib + ", " + error);
-
-  eglChooseConfig = (EGLBoolean(*)(EGLDisplay, const EGLint*, EGLConfig*, EGLint, EGLint*))dlsym(
-      handle, "eglChooseConfig");
-  error = dlerror();
-  ASSERT(error == NULL, "Error loading eglChooseConfig from " + lib + ", " + error);
-
-  eglGetProcAddress =
-      (__eglMustCastToProperFunctionPointerType(*)(const char*))dlsym(handle, "eglGetProcAddress");
-  error = dlerror();
-  ASSERT(error == NULL, "Error loading eglGetProcAddress from " + lib + ", " + error);
-
-  eglCreatePbufferSurface =
-      (EGLSurface(*)(EGLDisplay, EGLConfig, const EGLint*))dlsym(handle, "eglCreatePbufferSurface");
-  error = dlerror();
-  ASSERT(error == NULL, "Error loading eglCreatePbufferSurface from " + lib + ", " + error);
-
-  eglBindAPI = (EGLBoolean(*)(EGLenum))dlsym(handle, "eglBindAPI");
-  error = dlerror();
-  ASSERT(error == NULL, "Error loading eglBindAPI from " + lib + ", " + error);
-
-  eglCreateContext = (EGLContext(*)(EGLDisplay, EGLConfig, EGLContext, const EGLint*))dlsym(
-      handle, "eglCreateContext");
-  error = dlerror();
-  ASSERT(error == NULL, "Error loading eglCreateContext from " + lib + ", " + error);
-
-  eglMakeCurrent = (EGLBoolean(*)(EGLDisplay, EGLSurface, EGLSurface, EGLContext))dlsym(
-      handle, "eglMakeCurrent");
-  error = dlerror();
-  ASSERT(error == NULL, "Error loading eglMakeCurrent from " + lib + ", " + error);
-
-  eglTerminate = (EGLBoolean(*)(EGLDisplay))dlsym(handle, "eglTerminate");
-  error = dlerror();
-  ASSERT(error == NULL, "Error loading eglTerminate from " + lib + ", " + error);
-
-  if (createCtx) {
-    const EGLint configAttribs[] = {EGL_SURFACE_TYPE,
-                                    EGL_PBUFFER_BIT,
-                                    EGL_BLUE_SIZE,
-                                    8,
-                                    EGL_GREEN_SIZE,
-                                    8,
-                                    EGL_RED_SIZE,
-                                    8,
-                                    EGL_DEPTH_SIZE,
-                                    0,
-                                    EGL_RENDERABLE_TYPE,
-                                    EGL_OPENGL_BIT,
-                                    EGL_NONE};
+void EGLCtx::Init(const EGLOptions& options) {
+  LoadFunctions();
+
+  const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+  PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+  Check(eglGetPlatformDisplayEXT, "EGL_EXT_platform_base not supported by " + lib);
+
+  EGLPlatform platform = options.platform;
+
+  // only the default CUDA device falls back to the other platforms, a device
+  // asked for by node or index must exist
+  const bool deviceRequested = !options.drmNode.empty() || options.deviceIndex >= 0;
+
+  EGLDeviceEXT device = EGL_NO_DEVICE_EXT;
+  if (platform == EGLPlatform::Auto || platform == EGLPlatform::Device) {
+    device = SelectDevice(options);
+    if (device == EGL_NO_DEVICE_EXT && (platform != EGLPlatform::Auto || deviceRequested)) {
+      throw std::invalid_argument("Found no EGL device matching the options");
+    }
+  }
+
+  if (platform == EGLPlatform::Auto) {
+    if (device != EGL_NO_DEVICE_EXT) {
+      platform = EGLPlatform::Device;
+    } else if (std::getenv("DISPLAY")) {
+      platform = EGLPlatform::X11;
+    } else {
+      platform = EGLPlatform::Surfaceless;
+    }
+  }
+
+  switch (platform) {
+    case EGLPlatform::Device:
+      display = eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, device, 0);
+      break;
+    case EGLPlatform::Surfaceless:
+      Check(
+          HasExtension(clientExtensions, "EGL_MESA_platform_surfaceless"),
+          "EGL_MESA_platform_surfaceless not supported by " + lib);
+      display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+      break;
+    default: {
+      Display* x11 = XOpenDisplay(NULL);
+      Check(x11, "Can't open X display");
+      display = eglGetPlatformDisplayEXT(EGL_PLATFORM_X11_KHR, x11, 0);
+      break;
+    }
+  }
+  Check(display != EGL_NO_DISPLAY, "Can't create EGL display");
 
+  EGLint major, minor;
+  Check(eglInitialize(display, &major, &minor), "Can't init EGL");
+  {
+    std::lock_guard<std::mutex> lock(displayMutex);
+    displayUsers[display]++;
+  }
+  displayInitialised = true;
+
+  // rendering goes to framebuffer objects, so without a pbuffer the context
+  // is made current with no surface at all
+  const EGLint configAttribs[] = {EGL_SURFACE_TYPE,
+                                  options.createSurface ? EGL_PBUFFER_BIT : 0,
+                                  EGL_BLUE_SIZE,
+                                  8,
+                                  EGL_GREEN_SIZE,
+                                  8,
+                                  EGL_RED_SIZE,
+                                  8,
+                                  EGL_DEPTH_SIZE,
+                                  0,
+                                  EGL_RENDERABLE_TYPE,
+                                  EGL_OPENGL_BIT,
+                                  EGL_NONE};
+
+  EGLint numConfigs;
+  Check(
+      eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) && numConfigs > 0,
+      "Can't configure EGL");
+
+  if (options.createSurface) {
     const EGLint pbufferAttribs[] = {
         EGL_WIDTH,
         1920,
@@ -90,104 +146,191 @@ EGLCtx::EGLCtx(const bool createCtx, const int cudaDevice, const bool createSurf
         EGL_NONE,
     };
 
-    EGLDeviceEXT eglDevs[32];
-    EGLint numDevices;
-
-    PFNEGLQUERYDEVICESEXTPROC eglQueryDevicesEXT =
-        (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
-
-    eglQueryDevicesEXT(32, eglDevs, &numDevices);
+    surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+    Check(surface != EGL_NO_SURFACE, "Can't create EGL surface");
+  } else {
+    Check(
+        HasExtension(eglQueryString(display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context"),
+        "EGL_KHR_surfaceless_context not supported, create a surface instead");
+  }
 
-    ASSERT(numDevices, "Found no GPUs");
+  Check(eglBindAPI(EGL_OPENGL_API), "Can't bind EGL OpenGL API");
 
-    PFNEGLQUERYDEVICEATTRIBEXTPROC eglQueryDeviceAttribEXT =
-        reinterpret_cast<PFNEGLQUERYDEVICEATTRIBEXTPROC>(
-            eglGetProcAddress("eglQueryDeviceAttribEXT"));
+  context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+  Check(context != EGL_NO_CONTEXT, "Can't create EGL context");
 
-    int eglDevId = 0;
-    bool foundCudaDev = false;
-    // Find the CUDA device asked for
-    for (; eglDevId < numDevices; ++eglDevId) {
-      EGLAttrib cudaDevNumber;
+  MakeCurrent();
+}
 
-      if (eglQueryDeviceAttribEXT(eglDevs[eglDevId], EGL_CUDA_DEVICE_NV, &cudaDevNumber) ==
-          EGL_FALSE)
-        continue;
+EGLCtx::EGLCtx(const EGLCtx* share)
+    : display(share->display),
+      config(share->config),
+      lib(share->lib),
+      ownsDisplay(false) {
+  try {
+    LoadFunctions();
+
+    Check(eglBindAPI(EGL_OPENGL_API), "Can't bind EGL OpenGL API");
+
+    context = eglCreateContext(display, config, share->context, NULL);
+    Check(context != EGL_NO_CONTEXT, "Can't create shared EGL context");
+  } catch (...) {
+    Destroy();
+    throw;
+  }
+}
 
-      if (cudaDevNumber == cudaDevice) {
-        break;
-      }
-    }
+EGLCtx::~EGLCtx() {
+  Destroy();
+}
 
-    PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT =
-        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
-    if(foundCudaDev) {
-      display = eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, eglDevs[eglDevId], 0);
-    } else {
-      Display* x11 = XOpenDisplay(NULL);
-      display = eglGetPlatformDisplayEXT(EGL_PLATFORM_X11_KHR, x11, 0);
+void EGLCtx::Destroy() {
+  if (context != EGL_NO_CONTEXT) {
+    if (eglGetCurrentContext() == context) {
+      eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
     }
-    ASSERT(display != EGL_NO_DISPLAY, "Can't create EGL display");
-    
-    EGLint major, minor;
-    ASSERT(eglInitialize(display, &major, &minor), "Can't init EGL");
-
-    EGLint numConfigs;
-    EGLConfig eglCfg;
-    ASSERT(eglChooseConfig(display, configAttribs, &eglCfg, 1, &numConfigs), "Can't configure EGL");
-
-    if (createSurface) {
-      surface = eglCreatePbufferSurface(display, eglCfg, pbufferAttribs);
-      ASSERT(surface != EGL_NO_SURFACE, "Can't create EGL surface");
+    eglDestroyContext(display, context);
+  }
+  if (surface != EGL_NO_SURFACE) {
+    eglDestroySurface(display, surface);
+  }
+  if (ownsDisplay && displayInitialised) {
+    std::lock_guard<std::mutex> lock(displayMutex);
+    if (--displayUsers[display] == 0) {
+      displayUsers.erase(display);
+      eglTerminate(display);
     }
+  }
+  if (handle) {
+    dlclose(handle);
+  }
+}
 
-    ASSERT(eglBindAPI(EGL_OPENGL_API), "Can't bind EGL OpenGL API");
+std::unique_ptr<EGLCtx> EGLCtx::CreateSharedContext() const {
+  return std::unique_ptr<EGLCtx>(new EGLCtx(this));
+}
 
-    context = eglCreateContext(display, eglCfg, EGL_NO_CONTEXT, NULL);
-    ASSERT(context != EGL_NO_CONTEXT, "Can't create EGL context");
+void EGLCtx::MakeCurrent() {
+  Check(eglMakeCurrent(display, surface, surface, context), "Can't bind EGL context");
 
-    if (createSurface) {
-      ASSERT(eglMakeCurrent(display, surface, surface, context), "Can't bind EGL context");
-    } else {
-      ASSERT(
-          eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context),
-          "Can't bind EGL context");
-    }
+  if (initialised)
+    return;
+  initialised = true;
 
-    GLenum err = glewInit();
+  GLenum err = glewInit();
 
 #ifdef GLEW_ERROR_NO_GLX_DISPLAY
-    if (err == GLEW_ERROR_NO_GLX_DISPLAY) {
-        std::cout << "Can't initialize EGL GLEW GLX display, may crash!" << std::endl;
-    }
-    else 
+  if (err == GLEW_ERROR_NO_GLX_DISPLAY) {
+    std::cout << "Can't initialize EGL GLEW GLX display, may crash!" << std::endl;
+  } else
+#endif
+      if (err != GLEW_OK) {
+    throw std::runtime_error("Can't initialize EGL, glewInit failing completely.");
+  }
+
+  // Setup default OpenGL parameters, which every context has its own of
+  glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
+  glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
+  glHint(GL_POLYGON_SMOOTH_HINT, GL_NICEST);
+  glEnable(GL_BLEND);
+  glEnable(GL_LINE_SMOOTH);
+  glEnable(GL_DEPTH_TEST);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glLineWidth(1.5);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+}
+
+bool EGLCtx::IsCurrent() const {
+  return eglGetCurrentContext() == context;
+}
+
+void EGLCtx::Release() {
+  Check(
+      eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT),
+      "Can't remove EGL context");
+}
+
+void EGLCtx::LoadFunctions() {
+  // Try find the DLL (we can't build on anything that doesn't have nvidia drivers without
+  // dynamically loading)
+  handle = dlopen(lib.c_str(), RTLD_LAZY);
+
+  if (nullptr == handle)
+    handle = dlopen(
+        "/usr/local/lib/libEGL.so",
+        RTLD_LAZY); // dgx machines have this location, which is not on the lib search path
+
+  Check(handle, "Can't find " + lib + ", " + dlerror());
+
+  dlerror(); // Clear any existing error
+
+  // Pull out functions
+  LoadFunction(handle, lib, "eglGetCurrentContext", eglGetCurrentContext);
+  LoadFunction(handle, lib, "eglInitialize", eglInitialize);
+  LoadFunction(handle, lib, "eglChooseConfig", eglChooseConfig);
+  LoadFunction(handle, lib, "eglGetProcAddress", eglGetProcAddress);
+  LoadFunction(handle, lib, "eglQueryString", eglQueryString);
+  LoadFunction(handle, lib, "eglCreatePbufferSurface", eglCreatePbufferSurface);
+  LoadFunction(handle, lib, "eglBindAPI", eglBindAPI);
+  LoadFunction(handle, lib, "eglCreateContext", eglCreateContext);
+  LoadFunction(handle, lib, "eglMakeCurrent", eglMakeCurrent);
+  LoadFunction(handle, lib, "eglDestroyContext", eglDestroyContext);
+  LoadFunction(handle, lib, "eglDestroySurface", eglDestroySurface);
+  LoadFunction(handle, lib, "eglTerminate", eglTerminate);
+}
+
+void* EGLCtx::SelectDevice(const EGLOptions& options) {
+  PFNEGLQUERYDEVICESEXTPROC eglQueryDevicesEXT =
+      (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+  PFNEGLQUERYDEVICEATTRIBEXTPROC eglQueryDeviceAttribEXT =
+      (PFNEGLQUERYDEVICEATTRIBEXTPROC)eglGetProcAddress("eglQueryDeviceAttribEXT");
+  PFNEGLQUERYDEVICESTRINGEXTPROC eglQueryDeviceStringEXT =
+      (PFNEGLQUERYDEVICESTRINGEXTPROC)eglGetProcAddress("eglQueryDeviceStringEXT");
+
+  EGLDeviceEXT eglDevs[32];
+  EGLint numDevices = 0;
+
+  if (!eglQueryDevicesEXT || !eglQueryDevicesEXT(32, eglDevs, &numDevices))
+    return EGL_NO_DEVICE_EXT;
+
+  if (!options.drmNode.empty()) {
+    for (EGLint i = 0; i < numDevices; i++) {
+      const char* extensions = eglQueryDeviceStringEXT(eglDevs[i], EGL_EXTENSIONS);
+      if (!HasExtension(extensions, "EGL_EXT_device_drm"))
+        continue;
+
+      const char* node = eglQueryDeviceStringEXT(eglDevs[i], EGL_DRM_DEVICE_FILE_EXT);
+      if (node && options.drmNode == node)
+        return eglDevs[i];
+
+#ifdef EGL_DRM_RENDER_NODE_FILE_EXT
+      node = HasExtension(extensions, "EGL_EXT_device_drm_render_node")
+          ? eglQueryDeviceStringEXT(eglDevs[i], EGL_DRM_RENDER_NODE_FILE_EXT)
+          : nullptr;
+      if (node && options.drmNode == node)
+        return eglDevs[i];
 #endif
-    if (err != GLEW_OK) {
-        ASSERT(false, "Can't initialize EGL, glewInit failing completely.");
     }
+    return EGL_NO_DEVICE_EXT;
+  }
 
-    // Setup default OpenGL parameters
-    glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
-    glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
-    glHint(GL_POLYGON_SMOOTH_HINT, GL_NICEST);
-    glEnable(GL_BLEND);
-    glEnable(GL_LINE_SMOOTH);
-    glEnable(GL_DEPTH_TEST);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glLineWidth(1.5);
-    glPixelStorei(GL_PACK_ALIGNMENT, 1);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  if (options.deviceIndex >= 0) {
+    return options.deviceIndex < numDevices ? eglDevs[options.deviceIndex] : EGL_NO_DEVICE_EXT;
   }
-}
 
-EGLCtx::~EGLCtx() {
-  if (createdCtx) {
-    ASSERT(
-        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT),
-        "Can't remove EGL context");
-    eglTerminate(display);
+  // Find the CUDA device asked for
+  for (EGLint i = 0; i < numDevices; i++) {
+    EGLAttrib cudaDevNumber;
+
+    if (eglQueryDeviceAttribEXT(eglDevs[i], EGL_CUDA_DEVICE_NV, &cudaDevNumber) == EGL_FALSE)
+      continue;
+
+    if (cudaDevNumber == options.cudaDevice)
+      return eglDevs[i];
   }
-  dlclose(handle);
+
+  return EGL_NO_DEVICE_EXT;
 }
 
 // Everything used in PrintInformation(); comes from
@@ -215,7 +358,7 @@ void EGLCtx::PrintInformation() {
       reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(eglGetProcAddress("eglQueryDevicesEXT"));
   EGLDeviceEXT devices[32];
   EGLint num_devices;
-  if (!eglQueryDevicesEXT(32, devices, &num_devices)) {
+  if (!eglQueryDevicesEXT || !eglQueryDevicesEXT(32, devices, &num_devices)) {
     std::cout << "Failed to query devices." << std::endl;
     return;
   }
@@ -0,0 +1,221 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "GpuProfiler.h"
+#include "Assert.h"
+
+#include <pangolin/utils/picojson.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+GpuProfiler::GpuProfiler(const size_t window) : window(window) {
+  ASSERT(window > 0);
+}
+
+GpuProfiler::~GpuProfiler() {
+  for (QueryBuffer& b : buffers) {
+    if (!b.queries.empty()) {
+      glDeleteQueries(b.queries.size(), b.queries.data());
+    }
+  }
+}
+
+void GpuProfiler::BeginFrame() {
+  frame++;
+
+  // the buffer last used kNumBuffers frames ago, which the GPU has usually
+  // finished with
+  QueryBuffer& b = buffers[frame % kNumBuffers];
+  Collect(b, false);
+  b.frame = frame;
+}
+
+void GpuProfiler::Finish() {
+  // oldest frame first
+  for (size_t i = 1; i <= kNumBuffers; i++) {
+    Collect(buffers[(frame + i) % kNumBuffers], true);
+  }
+}
+
+GpuProfiler::Scope::Scope(GpuProfiler* profiler, const char* pass) : profiler(profiler) {
+  if (profiler) {
+    timing = profiler->Begin(profiler->PassIndex(pass));
+    start = std::chrono::steady_clock::now();
+  }
+}
+
+GpuProfiler::Scope::~Scope() {
+  if (profiler) {
+    profiler->End(
+        timing,
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+            .count());
+  }
+}
+
+size_t GpuProfiler::PassIndex(const char* pass) {
+  for (size_t i = 0; i < passes.size(); i++) {
+    if (std::strcmp(passes[i].c_str(), pass) == 0)
+      return i;
+  }
+  passes.emplace_back(pass);
+  return passes.size() - 1;
+}
+
+size_t GpuProfiler::Begin(const size_t pass) {
+  QueryBuffer& b = buffers[frame % kNumBuffers];
+  const size_t timing = b.passes.size();
+
+  if (b.queries.size() < 2 * (timing + 1)) {
+    b.queries.resize(2 * (timing + 1));
+    glGenQueries(2, &b.queries[2 * timing]);
+  }
+
+  glQueryCounter(b.queries[2 * timing], GL_TIMESTAMP);
+  b.passes.push_back(pass);
+  b.cpuMs.push_back(0.0);
+
+  return timing;
+}
+
+void GpuProfiler::End(const size_t timing, const double cpuMs) {
+  QueryBuffer& b = buffers[frame % kNumBuffers];
+  glQueryCounter(b.queries[2 * timing + 1], GL_TIMESTAMP);
+  b.cpuMs[timing] = cpuMs;
+}
+
+void GpuProfiler::Collect(QueryBuffer& b, const bool wait) {
+  if (b.passes.empty())
+    return;
+
+  if (!wait) {
+    for (size_t i = 0; i < 2 * b.passes.size(); i++) {
+      GLuint available = GL_FALSE;
+      glGetQueryObjectuiv(b.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+      if (!available) {
+        // the queries are simply reissued this frame
+        b.passes.clear();
+        b.cpuMs.clear();
+        skippedFrames++;
+        return;
+      }
+    }
+  }
+
+  FrameTimes times;
+  times.frame = b.frame;
+  times.gpuMs.resize(passes.size(), -1.0);
+  times.cpuMs.resize(passes.size(), -1.0);
+
+  for (size_t i = 0; i < b.passes.size(); i++) {
+    GLuint64 begin = 0;
+    GLuint64 end = 0;
+    glGetQueryObjectui64v(b.queries[2 * i], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(b.queries[2 * i + 1], GL_QUERY_RESULT, &end);
+
+    const size_t pass = b.passes[i];
+    times.gpuMs[pass] = std::max(times.gpuMs[pass], 0.0) + (end - begin) / 1e6;
+    times.cpuMs[pass] = std::max(times.cpuMs[pass], 0.0) + b.cpuMs[i];
+  }
+
+  b.passes.clear();
+  b.cpuMs.clear();
+
+  if (recordHistory) {
+    history.push_back(times);
+  }
+
+  recent.push_back(std::move(times));
+  if (recent.size() > window) {
+    recent.pop_front();
+  }
+}
+
+std::vector<GpuProfiler::PassStats> GpuProfiler::Summarise(
+    const std::vector<std::string>& passes,
+    const std::deque<FrameTimes>& frames) {
+  std::vector<PassStats> stats(passes.size());
+
+  for (size_t i = 0; i < passes.size(); i++) {
+    PassStats& s = stats[i];
+    s.name = passes[i];
+
+    for (const FrameTimes& times : frames) {
+      // passes first seen after this frame didn't run in it
+      if (i >= times.gpuMs.size() || times.gpuMs[i] < 0.0)
+        continue;
+
+      s.frames++;
+      s.gpuMeanMs += times.gpuMs[i];
+      s.cpuMeanMs += times.cpuMs[i];
+      s.gpuMaxMs = std::max(s.gpuMaxMs, times.gpuMs[i]);
+      s.cpuMaxMs = std::max(s.cpuMaxMs, times.cpuMs[i]);
+    }
+
+    if (s.frames > 0) {
+      s.gpuMeanMs /= s.frames;
+      s.cpuMeanMs /= s.frames;
+    }
+  }
+
+  return stats;
+}
+
+std::vector<GpuProfiler::PassStats> GpuProfiler::Stats() const {
+  return Summarise(passes, recent);
+}
+
+void GpuProfiler::WriteCsv(const std::string& filename) const {
+  std::ofstream file(filename);
+  ASSERT(file.good(), "Can't write " + filename);
+
+  file << "frame,pass,gpu_ms,cpu_ms" << std::endl;
+  for (const FrameTimes& times : history) {
+    for (size_t i = 0; i < times.gpuMs.size(); i++) {
+      if (times.gpuMs[i] >= 0.0) {
+        file << times.frame << "," << passes[i] << "," << times.gpuMs[i] << ","
+             << times.cpuMs[i] << std::endl;
+      }
+    }
+  }
+}
+
+void GpuProfiler::WriteJson(const std::string& filename) const {
+  picojson::array passStats;
+  for (const PassStats& s : Summarise(passes, history)) {
+    picojson::object pass;
+    pass["name"] = picojson::value(s.name);
+    pass["frames"] = picojson::value((int64_t)s.frames);
+    pass["gpu_mean_ms"] = picojson::value(s.gpuMeanMs);
+    pass["gpu_max_ms"] = picojson::value(s.gpuMaxMs);
+    pass["cpu_mean_ms"] = picojson::value(s.cpuMeanMs);
+    pass["cpu_max_ms"] = picojson::value(s.cpuMaxMs);
+    passStats.push_back(picojson::value(pass));
+  }
+
+  picojson::array frames;
+  for (const FrameTimes& times : history) {
+    picojson::object gpuMs;
+    picojson::object cpuMs;
+    for (size_t i = 0; i < times.gpuMs.size(); i++) {
+      if (times.gpuMs[i] >= 0.0) {
+        gpuMs[passes[i]] = picojson::value(times.gpuMs[i]);
+        cpuMs[passes[i]] = picojson::value(times.cpuMs[i]);
+      }
+    }
+
+    picojson::object f;
+    f["frame"] = picojson::value((int64_t)times.frame);
+    f["gpu_ms"] = picojson::value(gpuMs);
+    f["cpu_ms"] = picojson::value(cpuMs);
+    frames.push_back(picojson::value(f));
+  }
+
+  picojson::object json;
+  json["passes"] = picojson::value(passStats);
+  json["frames"] = picojson::value(frames);
+
+  std::ofstream file(filename);
+  ASSERT(file.good(), "Can't write " + filename);
+  file << picojson::value(json).serialize(true);
+}
@@ -0,0 +1,117 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "LoadTrace.h"
+#include "Assert.h"
+
+#include <pangolin/utils/picojson.h>
+
+#include <sys/resource.h>
+#include <time.h>
+#include <fstream>
+
+LoadTrace::LoadTrace() : origin(std::chrono::steady_clock::now()) {}
+
+LoadTrace::Stage::Stage(LoadTrace* trace, const char* name) : trace(trace), name(name) {
+  if (trace) {
+    start = std::chrono::steady_clock::now();
+    startCpuSeconds = ProcessCpuSeconds();
+    startPageFaults = MinorPageFaults();
+  }
+}
+
+LoadTrace::Stage::~Stage() {
+  End();
+}
+
+void LoadTrace::Stage::End() {
+  if (!trace)
+    return;
+
+  const auto end = std::chrono::steady_clock::now();
+
+  Event event;
+  event.name = name;
+  event.startUs = std::chrono::duration<double, std::micro>(start - trace->origin).count();
+  event.durationUs = std::chrono::duration<double, std::micro>(end - start).count();
+  event.cpuMs = (ProcessCpuSeconds() - startCpuSeconds) * 1000.0;
+  event.bytesRead = bytesRead;
+  event.bytesUploaded = bytesUploaded;
+  event.minorPageFaults = MinorPageFaults() - startPageFaults;
+  event.peakResidentBytes = PeakResidentBytes();
+  event.args = std::move(args);
+
+  trace->events.push_back(std::move(event));
+  trace = nullptr;
+}
+
+void LoadTrace::Write(const std::string& filename) const {
+  picojson::array traceEvents;
+
+  for (const Event& event : events) {
+    picojson::object args;
+    args["cpu_ms"] = picojson::value(event.cpuMs);
+    args["bytes_read"] = picojson::value((int64_t)event.bytesRead);
+    args["bytes_uploaded"] = picojson::value((int64_t)event.bytesUploaded);
+    args["minor_page_faults"] = picojson::value((int64_t)event.minorPageFaults);
+    args["peak_rss_bytes"] = picojson::value((int64_t)event.peakResidentBytes);
+    for (const std::pair<std::string, double>& arg : event.args) {
+      args[arg.first] = picojson::value(arg.second);
+    }
+
+    // complete event
+    picojson::object e;
+    e["name"] = picojson::value(event.name);
+    e["cat"] = picojson::value("load");
+    e["ph"] = picojson::value("X");
+    e["ts"] = picojson::value(event.startUs);
+    e["dur"] = picojson::value(event.durationUs);
+    e["pid"] = picojson::value((int64_t)0);
+    e["tid"] = picojson::value((int64_t)0);
+    e["args"] = picojson::value(args);
+    traceEvents.push_back(picojson::value(e));
+
+    // counter track of the RSS high-water mark
+    picojson::object rss;
+    rss["peak_rss_mb"] = picojson::value(event.peakResidentBytes / (1024.0 * 1024.0));
+
+    picojson::object c;
+    c["name"] = picojson::value("memory");
+    c["ph"] = picojson::value("C");
+    c["ts"] = picojson::value(event.startUs + event.durationUs);
+    c["pid"] = picojson::value((int64_t)0);
+    c["args"] = picojson::value(rss);
+    traceEvents.push_back(picojson::value(c));
+  }
+
+  picojson::object json;
+  json["traceEvents"] = picojson::value(traceEvents);
+  json["displayTimeUnit"] = picojson::value("ms");
+
+  std::ofstream file(filename);
+  ASSERT(file.good(), "Can't write " + filename);
+  file << picojson::value(json).serialize();
+}
+
+size_t LoadTrace::PeakResidentBytes() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return std::stoull(line.substr(6)) * 1024;
+    }
+  }
+  return 0;
+}
+
+double LoadTrace::ProcessCpuSeconds() {
+  timespec ts;
+  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0)
+    return 0.0;
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+size_t LoadTrace::MinorPageFaults() {
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  return usage.ru_minflt;
+}
@@ -0,0 +1,276 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "OcclusionCuller.h"
+#include "Assert.h"
+
+#include <pmmintrin.h>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Vertices closer than this to the camera plane are not projected
+constexpr float kMinW = 1e-3f;
+
+// Rows rasterised together by one worker thread
+constexpr int kBandRows = 4;
+
+// Relative inverse depth margin so geometry isn't culled by its own occluder
+constexpr float kDepthMargin = 1e-3f;
+
+} // namespace
+
+OcclusionCuller::OcclusionCuller(const size_t width, const size_t height) {
+  ASSERT(width > 0 && width % 4 == 0, "Occlusion buffer width must be a multiple of 4");
+  ASSERT(height > 0);
+
+  size_t w = width;
+  size_t h = height;
+  while (true) {
+    levels.emplace_back(w * h, 0.0f);
+    widths.push_back(w);
+    heights.push_back(h);
+
+    if (w == 1 && h == 1)
+      break;
+
+    w = std::max<size_t>(1, (w + 1) / 2);
+    h = std::max<size_t>(1, (h + 1) / 2);
+  }
+}
+
+void OcclusionCuller::SetOccluders(std::vector<Eigen::Vector3f>&& occluders) {
+  ASSERT(occluders.size() % 4 == 0, "Occluders must be quads");
+  quads = std::move(occluders);
+  screen.resize(quads.size());
+  triangles.reserve(quads.size() / 2);
+}
+
+bool OcclusionCuller::SetupTriangle(
+    const Eigen::Vector3f& v0,
+    const Eigen::Vector3f& v1,
+    const Eigen::Vector3f& v2,
+    const bool cullCW,
+    const bool cullCCW,
+    Triangle& tri) const {
+  if (v0(2) <= 0.0f || v1(2) <= 0.0f || v2(2) <= 0.0f)
+    return false;
+
+  // counter clockwise in window coordinates if positive
+  const float area = (v1(0) - v0(0)) * (v2(1) - v0(1)) - (v2(0) - v0(0)) * (v1(1) - v0(1));
+
+  if (area == 0.0f || (area > 0.0f ? cullCCW : cullCW))
+    return false;
+
+  const int width = widths[0];
+  const int height = heights[0];
+
+  tri.minX = std::max(0, (int)std::floor(std::min({v0(0), v1(0), v2(0)})));
+  tri.maxX = std::min(width - 1, (int)std::floor(std::max({v0(0), v1(0), v2(0)})));
+  tri.minY = std::max(0, (int)std::floor(std::min({v0(1), v1(1), v2(1)})));
+  tri.maxY = std::min(height - 1, (int)std::floor(std::max({v0(1), v1(1), v2(1)})));
+
+  if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+    return false;
+
+  // edge functions positive inside, flipping clockwise triangles
+  const Eigen::Vector3f* v[3] = {&v0, &v1, &v2};
+  const float sign = area > 0.0f ? 1.0f : -1.0f;
+
+  for (int i = 0; i < 3; i++) {
+    const Eigen::Vector3f& a = *v[i];
+    const Eigen::Vector3f& b = *v[(i + 1) % 3];
+    tri.edges[i][0] = sign * (a(1) - b(1));
+    tri.edges[i][1] = sign * (b(0) - a(0));
+    tri.edges[i][2] = -(tri.edges[i][0] * a(0) + tri.edges[i][1] * a(1));
+  }
+
+  // 1/w is affine in screen space
+  const float d1 = v1(2) - v0(2);
+  const float d2 = v2(2) - v0(2);
+  tri.invDepth[0] = (d1 * (v2(1) - v0(1)) - d2 * (v1(1) - v0(1))) / area;
+  tri.invDepth[1] = (d2 * (v1(0) - v0(0)) - d1 * (v2(0) - v0(0))) / area;
+  tri.invDepth[2] = v0(2) - tri.invDepth[0] * v0(0) - tri.invDepth[1] * v0(1);
+
+  return true;
+}
+
+void OcclusionCuller::RasteriseRows(const Triangle& tri, const int rowBegin, const int rowEnd) {
+  const int width = widths[0];
+  float* depth = levels[0].data();
+
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 pixelOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+
+  __m128 edgeX[3], edgeY[3], edgeC[3];
+  for (int i = 0; i < 3; i++) {
+    edgeX[i] = _mm_set1_ps(tri.edges[i][0]);
+    edgeY[i] = _mm_set1_ps(tri.edges[i][1]);
+    edgeC[i] = _mm_set1_ps(tri.edges[i][2]);
+  }
+  const __m128 depthX = _mm_set1_ps(tri.invDepth[0]);
+  const __m128 depthY = _mm_set1_ps(tri.invDepth[1]);
+  const __m128 depthC = _mm_set1_ps(tri.invDepth[2]);
+
+  const int startX = tri.minX & ~3;
+
+  for (int y = std::max(rowBegin, tri.minY); y <= std::min(rowEnd - 1, tri.maxY); y++) {
+    const __m128 py = _mm_set1_ps(y + 0.5f);
+
+    __m128 rowEdge[3];
+    for (int i = 0; i < 3; i++) {
+      rowEdge[i] = _mm_add_ps(_mm_mul_ps(edgeY[i], py), edgeC[i]);
+    }
+    const __m128 rowDepth = _mm_add_ps(_mm_mul_ps(depthY, py), depthC);
+
+    float* row = depth + y * width;
+
+    for (int x = startX; x <= tri.maxX; x += 4) {
+      const __m128 px = _mm_add_ps(_mm_set1_ps((float)x), pixelOffsets);
+
+      __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeX[0], px), rowEdge[0]), zero);
+      inside = _mm_and_ps(
+          inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeX[1], px), rowEdge[1]), zero));
+      inside = _mm_and_ps(
+          inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeX[2], px), rowEdge[2]), zero));
+
+      if (_mm_movemask_ps(inside) == 0)
+        continue;
+
+      const __m128 invDepth = _mm_add_ps(_mm_mul_ps(depthX, px), rowDepth);
+      const __m128 current = _mm_loadu_ps(row + x);
+      const __m128 nearest = _mm_max_ps(current, invDepth);
+      _mm_storeu_ps(
+          row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+    }
+  }
+}
+
+void OcclusionCuller::Rasterise(
+    const Eigen::Matrix4f& mvp,
+    const bool cullCW,
+    const bool cullCCW) {
+  this->mvp = mvp;
+
+  const float width = widths[0];
+  const float height = heights[0];
+
+#pragma omp parallel for
+  for (size_t i = 0; i < quads.size(); i++) {
+    const Eigen::Vector4f clip = mvp * quads[i].homogeneous();
+    if (clip(3) > kMinW) {
+      const float invW = 1.0f / clip(3);
+      screen[i] = Eigen::Vector3f(
+          (clip(0) * invW * 0.5f + 0.5f) * width, (clip(1) * invW * 0.5f + 0.5f) * height, invW);
+    } else {
+      screen[i] = Eigen::Vector3f(0.0f, 0.0f, 0.0f);
+    }
+  }
+
+  // quads are drawn as the same triangle pair as on the GPU, with the
+  // winding of the 1, 0, 2, 3 strip mesh-ptex.geom emits
+  triangles.clear();
+  for (size_t i = 0; i < quads.size(); i += 4) {
+    Triangle tri;
+    if (SetupTriangle(screen[i + 1], screen[i], screen[i + 2], cullCW, cullCCW, tri)) {
+      triangles.push_back(tri);
+    }
+    if (SetupTriangle(screen[i + 2], screen[i], screen[i + 3], cullCW, cullCCW, tri)) {
+      triangles.push_back(tri);
+    }
+  }
+
+  std::fill(levels[0].begin(), levels[0].end(), 0.0f);
+
+  // each thread owns a band of rows so no two threads write the same pixel
+  const int numBands = (heights[0] + kBandRows - 1) / kBandRows;
+
+#pragma omp parallel for schedule(dynamic)
+  for (int band = 0; band < numBands; band++) {
+    const int rowBegin = band * kBandRows;
+    const int rowEnd = rowBegin + kBandRows;
+
+    for (const Triangle& tri : triangles) {
+      if (tri.maxY >= rowBegin && tri.minY < rowEnd) {
+        RasteriseRows(tri, rowBegin, rowEnd);
+      }
+    }
+  }
+
+  BuildHierarchy();
+}
+
+void OcclusionCuller::BuildHierarchy() {
+  for (size_t l = 1; l < levels.size(); l++) {
+    const std::vector<float>& fine = levels[l - 1];
+    std::vector<float>& coarse = levels[l];
+    const size_t fineWidth = widths[l - 1];
+    const size_t fineHeight = heights[l - 1];
+
+    for (size_t y = 0; y < heights[l]; y++) {
+      const size_t y0 = y * 2;
+      const size_t y1 = std::min(y0 + 1, fineHeight - 1);
+
+      for (size_t x = 0; x < widths[l]; x++) {
+        const size_t x0 = x * 2;
+        const size_t x1 = std::min(x0 + 1, fineWidth - 1);
+
+        coarse[y * widths[l] + x] = std::min(
+            std::min(fine[y0 * fineWidth + x0], fine[y0 * fineWidth + x1]),
+            std::min(fine[y1 * fineWidth + x0], fine[y1 * fineWidth + x1]));
+      }
+    }
+  }
+}
+
+bool OcclusionCuller::IsVisible(const Eigen::AlignedBox3f& box) const {
+  if (box.isEmpty())
+    return false;
+
+  const float width = widths[0];
+  const float height = heights[0];
+
+  Eigen::AlignedBox2f rect;
+  float nearest = 0.0f;
+
+  for (int i = 0; i < 8; i++) {
+    const Eigen::Vector4f clip =
+        mvp * box.corner((Eigen::AlignedBox3f::CornerType)i).homogeneous();
+
+    // can't bound the projection of boxes crossing the camera plane
+    if (clip(3) <= kMinW)
+      return true;
+
+    const float invW = 1.0f / clip(3);
+    rect.extend(Eigen::Vector2f(
+        (clip(0) * invW * 0.5f + 0.5f) * width, (clip(1) * invW * 0.5f + 0.5f) * height));
+    nearest = std::max(nearest, invW);
+  }
+
+  if (rect.max()(0) < 0.0f || rect.max()(1) < 0.0f || rect.min()(0) >= width ||
+      rect.min()(1) >= height)
+    return false;
+
+  const int minX = std::max(0, (int)std::floor(rect.min()(0)));
+  const int maxX = std::min((int)widths[0] - 1, (int)std::floor(rect.max()(0)));
+  const int minY = std::max(0, (int)std::floor(rect.min()(1)));
+  const int maxY = std::min((int)heights[0] - 1, (int)std::floor(rect.max()(1)));
+
+  // coarsest level where the rectangle covers at most 3x3 texels
+  const int extent = std::max(maxX - minX, maxY - minY);
+  size_t l = 0;
+  while (l + 1 < levels.size() && (extent >> l) > 1) {
+    l++;
+  }
+
+  const std::vector<float>& level = levels[l];
+  nearest *= 1.0f + kDepthMargin;
+
+  for (int y = minY >> l; y <= maxY >> l; y++) {
+    for (int x = minX >> l; x <= maxX >> l; x++) {
+      if (nearest >= level[y * widths[l] + x])
+        return true;
+    }
+  }
+
+  return false;
+}
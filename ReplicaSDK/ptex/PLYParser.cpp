@@ -9,7 +9,9 @@
 #include <fstream>
 #include <set>
 
-void PLYParse(MeshData& meshData, const std::string& filename) {
+void PLYParse(MeshData& meshData, const std::string& filename, LoadTrace* trace) {
+  LoadTrace::Stage stage(trace, "PLYParse");
+
   std::vector<std::string> comments;
   std::vector<std::string> objInfo;
 
@@ -228,6 +230,7 @@ void PLYParse(MeshData& meshData, const std::string& filename) {
 
   int fd = open(filename.c_str(), O_RDONLY, 0);
   void* mmappedData = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  stage.AddBytesRead(fileSize);
 
   // Parse each vertex packet and unpack
   char* bytes = &(((char*)mmappedData)[postHeader]);
@@ -9,11 +9,192 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <array>
+#include <chrono>
+#include <deque>
 #include <experimental/filesystem>
 #include <fstream>
+#include <functional>
+#include <map>
+#include <numeric>
 #include <unordered_map>
 
-PTexMesh::PTexMesh(const std::string& meshFile, const std::string& atlasFolder) {
+namespace {
+
+// Wall clock stopwatch, Lap() returns seconds since the last lap
+struct Timer {
+  Timer() : last(std::chrono::steady_clock::now()) {}
+
+  double Lap() {
+    const auto now = std::chrono::steady_clock::now();
+    const double seconds = std::chrono::duration<double>(now - last).count();
+    last = now;
+    return seconds;
+  }
+
+  std::chrono::steady_clock::time_point last;
+};
+
+struct LoadStats {
+  size_t numBatches = 0;
+  double parseSeconds = 0.0;
+  double splitSeconds = 0.0;
+  double adjacencySeconds = 0.0;
+  double clusterSeconds = 0.0;
+  double lodSeconds = 0.0;
+  size_t vertexBytes = 0;
+  size_t indexBytes = 0;
+  size_t shortIndexMeshes = 0;
+  float maxPositionError = 0.0f;
+  double uploadSeconds = 0.0;
+  std::vector<size_t> lodQuads;
+};
+
+// A coarser level of detail of a submesh, see PTexMesh::BuildLod
+struct LodData {
+  MeshData mesh;
+  std::vector<uint32_t> children;
+  ArenaVector<uint32_t> adjFaces;
+};
+
+float MeanEdgeLength(const MeshData& mesh) {
+  double total = 0.0;
+  for (size_t i = 0; i < mesh.ibo.Area(); i++) {
+    const size_t next = i % 4 == 3 ? i - 3 : i + 1;
+    total += (mesh.vbo[mesh.ibo[next]] - mesh.vbo[mesh.ibo[i]]).head<3>().norm();
+  }
+  return mesh.ibo.Area() > 0 ? total / mesh.ibo.Area() : 0.0f;
+}
+
+uint64_t Part1By2(uint64_t x) {
+  x &= 0x1fffff; // mask off lower 21 bits
+  x = (x | (x << 32)) & 0x1f00000000ffff;
+  x = (x | (x << 16)) & 0x1f0000ff0000ff;
+  x = (x | (x << 8)) & 0x100f00f00f00f00f;
+  x = (x | (x << 4)) & 0x10c30c30c30c30c3;
+  x = (x | (x << 2)) & 0x1249249249249249;
+  return x;
+}
+
+uint64_t EncodeMorton3(const Eigen::Vector3i& v) {
+  return (Part1By2(v(2)) << 2) + (Part1By2(v(1)) << 1) + Part1By2(v(0));
+}
+
+// Quantises positions to signed 16-bit integers spanning their bounding box,
+// returns the largest distance between an original and dequantised position
+float QuantisePositions(
+    const MeshData::Buffer<Eigen::Vector4f>& vbo,
+    std::vector<Eigen::Matrix<int16_t, 4, 1>>& quantised,
+    Eigen::Vector3f& scale,
+    Eigen::Vector3f& offset) {
+  Eigen::AlignedBox3f boundingBox;
+  for (size_t i = 0; i < vbo.Area(); i++) {
+    boundingBox.extend(vbo[i].head<3>());
+  }
+
+  offset = boundingBox.center();
+  scale = (boundingBox.sizes() / (2.0f * 32767.0f)).cwiseMax(1e-9f);
+
+  float maxError = 0.0f;
+  quantised.resize(vbo.Area());
+
+  for (size_t i = 0; i < vbo.Area(); i++) {
+    const Eigen::Vector3f q = ((vbo[i].head<3>() - offset).cwiseQuotient(scale))
+                                  .array()
+                                  .round()
+                                  .max(-32767.0f)
+                                  .min(32767.0f);
+    quantised[i] << q.cast<int16_t>(), 1;
+
+    const Eigen::Vector3f p = offset + scale.cwiseProduct(q);
+    maxError = std::max(maxError, (p - vbo[i].head<3>()).norm());
+  }
+
+  return maxError;
+}
+
+// World space planes bounding the view of mvp, pointing inwards
+void FrustumPlanes(const Eigen::Matrix4d& mvp, Eigen::Vector4d planes[6]) {
+  for (int i = 0; i < 3; i++) {
+    planes[i * 2] = mvp.row(3) + mvp.row(i);
+    planes[i * 2 + 1] = mvp.row(3) - mvp.row(i);
+  }
+  for (int i = 0; i < 6; i++) {
+    planes[i] /= planes[i].head<3>().norm();
+  }
+}
+
+// True if the whole box is on the negative side of plane
+bool BoxOutside(const Eigen::AlignedBox3f& box, const Eigen::Vector4d& plane) {
+  const Eigen::Vector3d center = box.center().cast<double>();
+  const Eigen::Vector3d halfSize = 0.5 * box.sizes().cast<double>();
+  return plane.head<3>().dot(center) + plane(3) + plane.head<3>().cwiseAbs().dot(halfSize) < 0.0;
+}
+
+// Quads of the submeshes with the largest surface area, up to maxQuads in total
+std::vector<Eigen::Vector3f> SelectOccluders(
+    const MeshData& mesh,
+    const PTexMesh::MeshPartition& partition,
+    const size_t maxQuads,
+    size_t& numSubMeshes) {
+  std::vector<float> areas(partition.NumChunks(), 0.0f);
+
+#pragma omp parallel for
+  for (size_t i = 0; i < partition.NumChunks(); i++) {
+    for (size_t j = partition.chunkStart[i]; j < partition.chunkStart[i + 1]; j++) {
+      const uint32_t* quad = &mesh.ibo[partition.faces[j] * 4];
+      const Eigen::Vector3f diag0 = mesh.vbo[quad[2]].head<3>() - mesh.vbo[quad[0]].head<3>();
+      const Eigen::Vector3f diag1 = mesh.vbo[quad[3]].head<3>() - mesh.vbo[quad[1]].head<3>();
+      areas[i] += 0.5f * diag0.cross(diag1).norm();
+    }
+  }
+
+  std::vector<size_t> order(partition.NumChunks());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&areas](size_t a, size_t b) {
+    return areas[a] > areas[b];
+  });
+
+  std::vector<Eigen::Vector3f> quads;
+  numSubMeshes = 0;
+
+  for (size_t i : order) {
+    if (quads.size() / 4 + partition.ChunkSize(i) > maxQuads)
+      continue;
+
+    for (size_t j = partition.chunkStart[i]; j < partition.chunkStart[i + 1]; j++) {
+      for (size_t k = 0; k < 4; k++) {
+        quads.push_back(mesh.vbo[mesh.ibo[partition.faces[j] * 4 + k]].head<3>());
+      }
+    }
+    numSubMeshes++;
+  }
+
+  return quads;
+}
+
+// Rough CPU memory needed to split, compute adjacency for and upload a quad
+// sub-mesh: indices, vertices, adjacency and the transient edge map
+size_t EstimateLoadBytes(const size_t numFaces) {
+  const size_t indexBytes = 4 * sizeof(uint32_t);
+  const size_t vertexBytes = 2 * sizeof(Eigen::Vector4f);
+  const size_t adjacencyBytes = 4 * sizeof(uint32_t);
+  const size_t edgeMapBytes = 4 * 64;
+  return numFaces * (indexBytes + vertexBytes + adjacencyBytes + edgeMapBytes);
+}
+
+} // namespace
+
+PTexMesh::PTexMesh(
+    const std::string& meshFile,
+    const std::string& atlasFolder,
+    const PTexMeshOptions& options)
+    : options(options) {
+  if (!options.traceFile.empty()) {
+    loadTrace.reset(new LoadTrace());
+  }
+  LoadTrace::Stage loadStage(loadTrace.get(), "PTexMesh");
+
   // Check everything exists
   ASSERT(pangolin::FileExists(meshFile));
   ASSERT(pangolin::FileExists(atlasFolder));
@@ -33,6 +214,15 @@ PTexMesh::PTexMesh(const std::string& meshFile, const std::string& atlasFolder)
   splitSize = json["splitSize"].get<double>();
   tileSize = json["tileSize"].get<int64_t>();
 
+  // Atlases repacked by ReplicaAtlasRepack use the adaptive partition
+  if (json.contains("splitMode") && json["splitMode"].get<std::string>() == "adaptive") {
+    ASSERT(json.contains("minFaces"), "Missing minFaces in parameters.json");
+    ASSERT(json.contains("maxFaces"), "Missing maxFaces in parameters.json");
+    adaptiveSplit = true;
+    minFaces = json["minFaces"].get<int64_t>();
+    maxFaces = json["maxFaces"].get<int64_t>();
+  }
+
   LoadMeshData(meshFile);
 
   LoadAtlasData(atlasFolder);
@@ -43,21 +233,40 @@ PTexMesh::PTexMesh(const std::string& meshFile, const std::string& atlasFolder)
     saturation = 1.5f;
   }
 
-  // Load shader
-  const std::string shadir = STR(SHADER_DIR);
+  shadir = STR(SHADER_DIR);
   ASSERT(pangolin::FileExists(shadir), "Shader directory not found!");
 
-  shader.AddShaderFromFile(pangolin::GlSlVertexShader, shadir + "/mesh-ptex.vert", {}, {shadir});
-  shader.AddShaderFromFile(pangolin::GlSlGeometryShader, shadir + "/mesh-ptex.geom", {}, {shadir});
-  shader.AddShaderFromFile(pangolin::GlSlFragmentShader, shadir + "/mesh-ptex.frag", {}, {shadir});
-  shader.Link();
+  if (options.lodLevels > 0) {
+    BuildLodAtlases(shadir);
+  }
+
+  if (options.padAtlases) {
+    PadAtlases(shadir);
+  }
 
-  depthShader.AddShaderFromFile(pangolin::GlSlVertexShader, shadir + "/mesh-depth.vert", {}, {shadir});
-  depthShader.AddShaderFromFile(pangolin::GlSlFragmentShader, shadir + "/mesh-depth.frag", {}, {shadir});
-  depthShader.Link();
+  // programs Render and RenderDepth use at the default settings, the other
+  // variants are built when first drawn with
+  LoadTrace::Stage shaderStage(loadTrace.get(), "compile shaders");
+  const uint32_t defaults = (options.clusterSize > 0 ? CLUSTERS : 0) |
+      (paddedAtlases ? PADDED_ATLAS : 0) | (isHdr ? TONE_MAP : 0);
+  Program(defaults);
+  Program(defaults | VERTEX_PULLING);
+  Program(DEPTH);
+  shaderStage.End();
+
+  loadStage.End();
+  if (loadTrace) {
+    loadTrace->Write(options.traceFile);
+    std::cout << "Wrote load trace to " << options.traceFile << std::endl;
+    loadTrace.reset();
+  }
 }
 
-PTexMesh::~PTexMesh() {}
+PTexMesh::~PTexMesh() {
+  if (fragmentQuery) {
+    glDeleteQueries(1, &fragmentQuery);
+  }
+}
 
 float PTexMesh::Exposure() const {
   return exposure;
@@ -83,45 +292,235 @@ void PTexMesh::SetSaturation(const float& val) {
   saturation = val;
 }
 
+const std::vector<PTexMesh::ToneSettings>& PTexMesh::Brackets() const {
+  return brackets;
+}
+
+void PTexMesh::SetBrackets(const std::vector<ToneSettings>& val) {
+  ASSERT(val.size() <= MAX_BRACKETS, "At most " + std::to_string(MAX_BRACKETS) + " brackets");
+  brackets = val;
+}
+
+float PTexMesh::DepthOutputScale() const {
+  return depthOutputScale;
+}
+
+void PTexMesh::SetDepthOutputScale(const float& val) {
+  depthOutputScale = val;
+}
+
+bool PTexMesh::ExtraOutputs() const {
+  return extraOutputs;
+}
+
+void PTexMesh::SetExtraOutputs(const bool& val) {
+  extraOutputs = val;
+
+  if (extraOutputs) {
+    // built now rather than on the first frame drawn with them
+    const uint32_t features = ShadingFeatures(false) | (options.clusterSize > 0 ? CLUSTERS : 0);
+    Program(features);
+    Program(features | VERTEX_PULLING);
+  }
+}
+
+bool PTexMesh::VertexPulling() const {
+  return vertexPulling;
+}
+
+void PTexMesh::SetVertexPulling(const bool& val) {
+  vertexPulling = val;
+}
+
+GpuProfiler* PTexMesh::Profiler() const {
+  return profiler;
+}
+
+void PTexMesh::SetProfiler(GpuProfiler* val) {
+  profiler = val;
+}
+
+bool PTexMesh::DepthPrepass() const {
+  return depthPrepass;
+}
+
+void PTexMesh::SetDepthPrepass(const bool& val) {
+  depthPrepass = val;
+}
+
+bool PTexMesh::OcclusionCulling() const {
+  return occlusionCulling;
+}
+
+void PTexMesh::SetOcclusionCulling(const bool& val) {
+  occlusionCulling = val;
+}
+
+bool PTexMesh::CountFragments() const {
+  return countFragments;
+}
+
+void PTexMesh::SetCountFragments(const bool& val) {
+  countFragments = val;
+}
+
+int PTexMesh::LodLevel() const {
+  return lodLevel;
+}
+
+void PTexMesh::SetLodLevel(const int& val) {
+  lodLevel = val;
+}
+
+float PTexMesh::LodPixels() const {
+  return lodPixels;
+}
+
+void PTexMesh::SetLodPixels(const float& val) {
+  lodPixels = val;
+}
+
+size_t PTexMesh::NumLodLevels() const {
+  size_t numLevels = 1;
+  for (const auto& mesh : meshes) {
+    numLevels = std::max(numLevels, mesh->lods.size() + 1);
+  }
+  return numLevels;
+}
+
+size_t PTexMesh::SelectLod(
+    const Mesh& mesh,
+    const pangolin::OpenGlRenderState& cam,
+    const int viewportHeight) const {
+  if (mesh.lods.empty() || lodLevel == 0)
+    return 0;
+
+  if (lodLevel > 0)
+    return std::min((size_t)lodLevel, mesh.lods.size());
+
+  // pixels per unit length at unit distance
+  const Eigen::Matrix4d projection = cam.GetProjectionMatrix();
+  const float pixelScale = projection(1, 1) * viewportHeight * 0.5;
+
+  const Eigen::Vector3f eye =
+      ((Eigen::Matrix4d)cam.GetModelViewMatrix().Inverse()).topRightCorner(3, 1).cast<float>();
+  const float distance = projection(3, 3) == 1.0 ? 1.0f
+                                                   : std::sqrt(mesh.bounds.squaredExteriorDistance(eye));
+
+  size_t level = 0;
+  while (level < mesh.lods.size() &&
+         mesh.lods[level]->quadSize * pixelScale <= lodPixels * distance) {
+    level++;
+  }
+
+  return level;
+}
+
 void PTexMesh::RenderSubMesh(
     size_t subMesh,
     const pangolin::OpenGlRenderState& cam,
-    const Eigen::Vector4f& clipPlane) {
+    const Eigen::Vector4f& clipPlane,
+    const Eigen::MatrixX4f& cullPlanes) {
+  RenderSubMesh(subMesh, cam, clipPlane, cullPlanes, QueryPassState(cam, !clipPlane.isZero()));
+}
+
+void PTexMesh::RenderSubMesh(
+    size_t subMesh,
+    const pangolin::OpenGlRenderState& cam,
+    const Eigen::Vector4f& clipPlane,
+    const Eigen::MatrixX4f& cullPlanes,
+    const PassState& pass) {
   ASSERT(subMesh < meshes.size());
-  Mesh& mesh = *meshes[subMesh];
+  const size_t level = SelectLod(*meshes[subMesh], cam, pass.viewportHeight);
+  Mesh& mesh = level == 0 ? *meshes[subMesh] : *meshes[subMesh]->lods[level - 1];
+
+  const bool clustered = !mesh.clusters.empty();
+  if (clustered) {
+    CullClusters(mesh, cam, clipPlane, cullPlanes, pass);
+    if (drawCommands.empty())
+      return;
+  }
 
-  shader.Bind();
-  shader.SetUniform("MVP", cam.GetProjectionModelViewMatrix());
-  shader.SetUniform("tileSize", (int)tileSize);
-  shader.SetUniform("exposure", exposure);
-  shader.SetUniform("gamma", 1.0f / gamma);
-  shader.SetUniform("saturation", saturation);
-  shader.SetUniform("clipPlane", clipPlane(0), clipPlane(1), clipPlane(2), clipPlane(3));
+  if (renderStats.lodQuads.size() <= level) {
+    renderStats.lodQuads.resize(level + 1, 0);
+  }
+  if (clustered) {
+    for (const DrawCommand& command : drawCommands) {
+      renderStats.lodQuads[level] += command.count / 4;
+    }
+  } else {
+    renderStats.lodQuads[level] += mesh.ibo.num_elements / 4;
+  }
+
+  uint32_t features = pass.features;
+  if (vertexPulling) {
+    features |= VERTEX_PULLING;
+  }
+  if (clustered) {
+    features |= CLUSTERS;
+  }
+  pangolin::GlSlProgram& program = Program(features);
+
+  program.Bind();
+  program.SetUniform("MVP", cam.GetProjectionModelViewMatrix());
+  program.SetUniform(
+      "positionScale", mesh.positionScale(0), mesh.positionScale(1), mesh.positionScale(2));
+  program.SetUniform(
+      "positionOffset", mesh.positionOffset(0), mesh.positionOffset(1), mesh.positionOffset(2));
+  program.SetUniform("tileSize", (int)tileSize);
+  SetToneUniforms(program, features);
+  if (features & CLIP_PLANE) {
+    program.SetUniform("clipPlane", clipPlane(0), clipPlane(1), clipPlane(2), clipPlane(3));
+  }
 
-  shader.SetUniform("widthInTiles", int(mesh.atlas.width / tileSize));
+  program.SetUniform("widthInTiles", WidthInTiles(mesh));
 
   glActiveTexture(GL_TEXTURE0);
   mesh.atlas.Bind();
 
   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mesh.abo.bo);
 
-  mesh.vbo.Bind();
-  glVertexAttribPointer(0, mesh.vbo.count_per_element, mesh.vbo.datatype, GL_FALSE, 0, 0);
-  glEnableVertexAttribArray(0);
-  mesh.vbo.Unbind();
+  if (vertexPulling) {
+    // vertices are fetched from the index and vertex buffers by the shader
+    program.SetUniform("compactPositions", mesh.vbo.datatype == GL_SHORT);
+    program.SetUniform("shortIndices", mesh.ibo.datatype == GL_UNSIGNED_SHORT);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, mesh.vbo.bo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, mesh.ibo.bo);
+
+    if (clustered) {
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, mesh.faceRemapBuffer.bo);
+      DrawClusterArrays();
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+    } else {
+      glDrawArrays(GL_TRIANGLES, 0, mesh.ibo.num_elements / 4 * 6);
+    }
 
-  mesh.ibo.Bind();
-  // using GL_LINES_ADJACENCY here to send quads to geometry shader
-  glDrawElements(GL_LINES_ADJACENCY, mesh.ibo.num_elements, mesh.ibo.datatype, 0);
-  mesh.ibo.Unbind();
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, 0);
+  } else {
+    mesh.vbo.Bind();
+    glVertexAttribPointer(0, mesh.vbo.count_per_element, mesh.vbo.datatype, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(0);
+    mesh.vbo.Unbind();
+
+    mesh.ibo.Bind();
+    // using GL_LINES_ADJACENCY here to send quads to geometry shader
+    if (clustered) {
+      DrawClusters(mesh, GL_LINES_ADJACENCY, true);
+    } else {
+      glDrawElements(GL_LINES_ADJACENCY, mesh.ibo.num_elements, mesh.ibo.datatype, 0);
+    }
+    mesh.ibo.Unbind();
+
+    glDisableVertexAttribArray(0);
+  }
 
-  glDisableVertexAttribArray(0);
   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
 
   glActiveTexture(GL_TEXTURE0);
   mesh.atlas.Unbind();
 
-  shader.Unbind();
+  program.Unbind();
 }
 
 // render depth
@@ -129,20 +528,48 @@ void PTexMesh::RenderSubMeshDepth(
     size_t subMesh,
     const pangolin::OpenGlRenderState& cam,
     const float depthScale,
-    const Eigen::Vector4f& clipPlane) {
+    const Eigen::Vector4f& clipPlane,
+    const Eigen::MatrixX4f& cullPlanes) {
+  RenderSubMeshDepth(
+      subMesh, cam, depthScale, clipPlane, cullPlanes, QueryPassState(cam, !clipPlane.isZero()));
+}
+
+void PTexMesh::RenderSubMeshDepth(
+    size_t subMesh,
+    const pangolin::OpenGlRenderState& cam,
+    const float depthScale,
+    const Eigen::Vector4f& clipPlane,
+    const Eigen::MatrixX4f& cullPlanes,
+    const PassState& pass) {
   ASSERT(subMesh < meshes.size());
-  Mesh& mesh = *meshes[subMesh];
+  // the same level as the shading pass, so depth matches the shaded surface
+  const size_t level = SelectLod(*meshes[subMesh], cam, pass.viewportHeight);
+  Mesh& mesh = level == 0 ? *meshes[subMesh] : *meshes[subMesh]->lods[level - 1];
+
+  const bool clustered = !mesh.clusters.empty();
+  if (clustered) {
+    CullClusters(mesh, cam, clipPlane, cullPlanes, pass);
+    if (drawCommands.empty())
+      return;
+  }
 
   glPushAttrib(GL_POLYGON_BIT);
-  int currFrontFace;
-  glGetIntegerv(GL_FRONT_FACE, &currFrontFace);
   //Drawing the faces has the opposite winding order to the GL_LINES_ADJACENCY
-  glFrontFace(currFrontFace == GL_CW ? GL_CCW : GL_CW);
+  glFrontFace(pass.frontFaceCCW ? GL_CW : GL_CCW);
+
+  const bool clip = !clipPlane.isZero();
+  pangolin::GlSlProgram& depthShader = Program(DEPTH | (clip ? CLIP_PLANE : 0));
 
   depthShader.Bind();
   depthShader.SetUniform("MVP", cam.GetProjectionModelViewMatrix());  
   depthShader.SetUniform("MV", cam.GetModelViewMatrix());
-  depthShader.SetUniform("clipPlane", clipPlane(0), clipPlane(1), clipPlane(2), clipPlane(3));
+  depthShader.SetUniform(
+      "positionScale", mesh.positionScale(0), mesh.positionScale(1), mesh.positionScale(2));
+  depthShader.SetUniform(
+      "positionOffset", mesh.positionOffset(0), mesh.positionOffset(1), mesh.positionOffset(2));
+  if (clip) {
+    depthShader.SetUniform("clipPlane", clipPlane(0), clipPlane(1), clipPlane(2), clipPlane(3));
+  }
   depthShader.SetUniform("scale", depthScale);
 
   mesh.vbo.Bind();
@@ -151,7 +578,11 @@ void PTexMesh::RenderSubMeshDepth(
   mesh.vbo.Unbind();
 
   mesh.ibo.Bind();
-  glDrawElements(GL_QUADS, mesh.ibo.num_elements, mesh.ibo.datatype, 0);
+  if (clustered) {
+    DrawClusters(mesh, GL_QUADS, false);
+  } else {
+    glDrawElements(GL_QUADS, mesh.ibo.num_elements, mesh.ibo.datatype, 0);
+  }
   mesh.ibo.Unbind();
   glDisableVertexAttribArray(0);
 
@@ -161,15 +592,614 @@ void PTexMesh::RenderSubMeshDepth(
 }
 
 
-void PTexMesh::Render(const pangolin::OpenGlRenderState& cam, const Eigen::Vector4f& clipPlane) {
+void PTexMesh::Render(
+    const pangolin::OpenGlRenderState& cam,
+    const Eigen::Vector4f& clipPlane,
+    const Eigen::MatrixX4f& cullPlanes) {
+  GpuProfiler::Scope scope(profiler, "ptex");
+  const PassState pass = QueryPassState(cam, !clipPlane.isZero());
+  std::vector<size_t> order = VisibleSubMeshes(cam, clipPlane, cullPlanes);
+  const size_t numVisible = order.size();
+
+  if (depthPrepass) {
+    SortFrontToBack(cam, order);
+  }
+
+  // done before any draws so the GPU is still busy with the previous frame
+  if (occlusionCuller && occlusionCulling && clipPlane.isZero()) {
+    CullOccluded(cam, pass, order);
+  }
+
+  if (depthPrepass) {
+    glPushAttrib(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+    for (size_t i : order) {
+      RenderSubMeshPrepass(i, cam, clipPlane, cullPlanes, pass);
+    }
+
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+  }
+
+  renderStats = RenderStats();
+  renderStats.subMeshes = meshes.size();
+  renderStats.culledSubMeshes = meshes.size() - numVisible;
+  renderStats.occludedSubMeshes = numVisible - order.size();
+
+  if (countFragments) {
+    if (!fragmentQuery) {
+      glGenQueries(1, &fragmentQuery);
+    }
+    glBeginQuery(GL_SAMPLES_PASSED, fragmentQuery);
+  }
+
+  for (size_t i : order) {
+    RenderSubMesh(i, cam, clipPlane, cullPlanes, pass);
+  }
+
+  if (countFragments) {
+    glEndQuery(GL_SAMPLES_PASSED);
+    GLuint64 samples = 0;
+    glGetQueryObjectui64v(fragmentQuery, GL_QUERY_RESULT, &samples);
+    renderStats.shadedFragments = samples;
+  }
+
+  if (depthPrepass) {
+    glPopAttrib();
+  }
+}
+
+void PTexMesh::RenderViews(
+    const std::vector<pangolin::OpenGlRenderState>& cams,
+    const Eigen::MatrixX4f& clipPlanes) {
+  ASSERT(clipPlanes.rows() == 0 || clipPlanes.rows() == (int)cams.size());
+  GpuProfiler::Scope scope(profiler, "ptex views");
+
+  // std430 layout of View in mesh-ptex.vert
+  struct View {
+    float MVP[16];
+    float clipPlane[4];
+  };
+
+  std::vector<View> views(cams.size());
+  std::vector<std::vector<uint32_t>> subMeshViews(meshes.size());
+
+  for (size_t v = 0; v < cams.size(); v++) {
+    Eigen::Vector4f clipPlane = Eigen::Vector4f::Zero();
+    if (clipPlanes.rows()) {
+      clipPlane = clipPlanes.row(v).transpose();
+    }
+
+    Eigen::Map<Eigen::Matrix4f>(views[v].MVP) =
+        ((Eigen::Matrix4d)cams[v].GetProjectionModelViewMatrix()).cast<float>();
+    Eigen::Map<Eigen::Vector4f>(views[v].clipPlane) = clipPlane;
+
+    for (size_t i : VisibleSubMeshes(cams[v], clipPlane, Eigen::MatrixX4f())) {
+      subMeshViews[i].push_back(v);
+    }
+  }
+
+  // views of each submesh made contiguous, so its draw's baseInstance is
+  // the offset of its first view
+  std::vector<uint32_t> viewIndices;
+  std::vector<uint32_t> firstView(meshes.size() + 1, 0);
   for (size_t i = 0; i < meshes.size(); i++) {
-    RenderSubMesh(i, cam, clipPlane);
+    firstView[i] = viewIndices.size();
+    viewIndices.insert(viewIndices.end(), subMeshViews[i].begin(), subMeshViews[i].end());
+  }
+  firstView[meshes.size()] = viewIndices.size();
+
+  renderStats = RenderStats();
+  renderStats.subMeshes = meshes.size();
+
+  if (viewIndices.empty()) {
+    renderStats.culledSubMeshes = meshes.size();
+    return;
+  }
+
+  UploadStream(viewBuffer, GL_SHADER_STORAGE_BUFFER, views.data(), views.size() * sizeof(View));
+  UploadStream(
+      viewIndexBuffer,
+      GL_ARRAY_BUFFER,
+      viewIndices.data(),
+      viewIndices.size() * sizeof(uint32_t));
+
+  const uint32_t features = LAYERED | ShadingFeatures(clipPlanes.rows() > 0);
+  pangolin::GlSlProgram& layeredShader = Program(features);
+
+  layeredShader.Bind();
+  layeredShader.SetUniform("tileSize", (int)tileSize);
+  SetToneUniforms(layeredShader, features);
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, viewBuffer.bo);
+
+  viewIndexBuffer.Bind();
+  glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, 0, 0);
+  glVertexAttribDivisor(2, 1);
+  glEnableVertexAttribArray(2);
+  viewIndexBuffer.Unbind();
+
+  glActiveTexture(GL_TEXTURE0);
+
+  if (clipPlanes.rows()) {
+    glPushAttrib(GL_TRANSFORM_BIT);
+    glEnable(GL_CLIP_DISTANCE0);
   }
+
+  const int viewportHeight = ViewportHeight();
+
+  for (size_t i = 0; i < meshes.size(); i++) {
+    const std::vector<uint32_t>& meshViews = subMeshViews[i];
+    if (meshViews.empty()) {
+      renderStats.culledSubMeshes++;
+      continue;
+    }
+
+    size_t level = SelectLod(*meshes[i], cams[meshViews[0]], viewportHeight);
+    for (size_t j = 1; j < meshViews.size() && level > 0; j++) {
+      level = std::min(level, SelectLod(*meshes[i], cams[meshViews[j]], viewportHeight));
+    }
+    Mesh& mesh = level == 0 ? *meshes[i] : *meshes[i]->lods[level - 1];
+
+    if (renderStats.lodQuads.size() <= level) {
+      renderStats.lodQuads.resize(level + 1, 0);
+    }
+    renderStats.lodQuads[level] += mesh.ibo.num_elements / 4 * meshViews.size();
+
+    layeredShader.SetUniform(
+        "positionScale", mesh.positionScale(0), mesh.positionScale(1), mesh.positionScale(2));
+    layeredShader.SetUniform(
+        "positionOffset", mesh.positionOffset(0), mesh.positionOffset(1), mesh.positionOffset(2));
+    layeredShader.SetUniform("widthInTiles", WidthInTiles(mesh));
+
+    const bool clustered = !mesh.clusters.empty();
+    layeredShader.SetUniform("remapFaces", clustered);
+    if (clustered) {
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, mesh.faceRemapBuffer.bo);
+    }
+
+    mesh.atlas.Bind();
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mesh.abo.bo);
+
+    mesh.vbo.Bind();
+    glVertexAttribPointer(0, mesh.vbo.count_per_element, mesh.vbo.datatype, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(0);
+    mesh.vbo.Unbind();
+
+    mesh.ibo.Bind();
+    glDrawElementsInstancedBaseInstance(
+        GL_LINES_ADJACENCY,
+        mesh.ibo.num_elements,
+        mesh.ibo.datatype,
+        0,
+        meshViews.size(),
+        firstView[i]);
+    mesh.ibo.Unbind();
+  }
+
+  glDisableVertexAttribArray(0);
+  glVertexAttribDivisor(2, 0);
+  glDisableVertexAttribArray(2);
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, 0);
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  if (clipPlanes.rows()) {
+    glPopAttrib();
+  }
+
+  layeredShader.Unbind();
 }
 
-void PTexMesh::RenderDepth(const pangolin::OpenGlRenderState& cam, const float depthScale, const Eigen::Vector4f& clipPlane) {
+std::vector<size_t> PTexMesh::VisibleSubMeshes(
+    const pangolin::OpenGlRenderState& cam,
+    const Eigen::Vector4f& clipPlane,
+    const Eigen::MatrixX4f& cullPlanes) const {
+  Eigen::Vector4d planes[6];
+  FrustumPlanes(cam.GetProjectionModelViewMatrix(), planes);
+
+  const bool doClip = !clipPlane.isZero();
+
+  std::vector<size_t> visible;
+  visible.reserve(meshes.size());
+
   for (size_t i = 0; i < meshes.size(); i++) {
-    RenderSubMeshDepth(i, cam, depthScale, clipPlane);
+    const Eigen::AlignedBox3f& bounds = meshes[i]->bounds;
+
+    bool inside = !doClip || !BoxOutside(bounds, clipPlane.cast<double>());
+
+    for (int j = 0; j < 6 && inside; j++) {
+      inside = !BoxOutside(bounds, planes[j]);
+    }
+
+    for (int j = 0; j < cullPlanes.rows() && inside; j++) {
+      inside = !BoxOutside(bounds, cullPlanes.row(j).transpose().cast<double>());
+    }
+
+    if (inside) {
+      visible.push_back(i);
+    }
+  }
+
+  return visible;
+}
+
+void PTexMesh::SortFrontToBack(
+    const pangolin::OpenGlRenderState& cam,
+    std::vector<size_t>& subMeshes) const {
+  const Eigen::Vector3f eye =
+      ((Eigen::Matrix4d)cam.GetModelViewMatrix().Inverse()).topRightCorner(3, 1).cast<float>();
+
+  std::vector<float> distances(meshes.size());
+  for (size_t i : subMeshes) {
+    distances[i] = meshes[i]->bounds.squaredExteriorDistance(eye);
+  }
+
+  std::stable_sort(subMeshes.begin(), subMeshes.end(), [&distances](size_t a, size_t b) {
+    return distances[a] < distances[b];
+  });
+}
+
+void PTexMesh::CullOccluded(
+    const pangolin::OpenGlRenderState& cam,
+    const PassState& pass,
+    std::vector<size_t>& subMeshes) {
+  occlusionCuller->Rasterise(
+      ((Eigen::Matrix4d)cam.GetProjectionModelViewMatrix()).cast<float>(),
+      pass.cullCW,
+      pass.cullCCW);
+
+  std::vector<uint8_t> visible(subMeshes.size());
+
+#pragma omp parallel for
+  for (size_t i = 0; i < subMeshes.size(); i++) {
+    visible[i] = occlusionCuller->IsVisible(meshes[subMeshes[i]]->bounds);
+  }
+
+  size_t numVisible = 0;
+  for (size_t i = 0; i < subMeshes.size(); i++) {
+    if (visible[i]) {
+      subMeshes[numVisible++] = subMeshes[i];
+    }
+  }
+  subMeshes.resize(numVisible);
+}
+
+void PTexMesh::RenderSubMeshPrepass(
+    size_t subMesh,
+    const pangolin::OpenGlRenderState& cam,
+    const Eigen::Vector4f& clipPlane,
+    const Eigen::MatrixX4f& cullPlanes,
+    const PassState& pass) {
+  ASSERT(subMesh < meshes.size());
+  const size_t level = SelectLod(*meshes[subMesh], cam, pass.viewportHeight);
+  Mesh& mesh = level == 0 ? *meshes[subMesh] : *meshes[subMesh]->lods[level - 1];
+
+  const bool clustered = !mesh.clusters.empty();
+  if (clustered) {
+    CullClusters(mesh, cam, clipPlane, cullPlanes, pass);
+    if (drawCommands.empty())
+      return;
+  }
+
+  const bool clip = !clipPlane.isZero();
+  pangolin::GlSlProgram& prepassShader =
+      Program(VERTEX_PULLING | DEPTH | (clip ? CLIP_PLANE : 0));
+
+  prepassShader.Bind();
+  prepassShader.SetUniform("MVP", cam.GetProjectionModelViewMatrix());
+  prepassShader.SetUniform("MV", cam.GetModelViewMatrix());
+  prepassShader.SetUniform("scale", 1.0f);
+  prepassShader.SetUniform(
+      "positionScale", mesh.positionScale(0), mesh.positionScale(1), mesh.positionScale(2));
+  prepassShader.SetUniform(
+      "positionOffset", mesh.positionOffset(0), mesh.positionOffset(1), mesh.positionOffset(2));
+  if (clip) {
+    prepassShader.SetUniform("clipPlane", clipPlane(0), clipPlane(1), clipPlane(2), clipPlane(3));
+  }
+  prepassShader.SetUniform("compactPositions", mesh.vbo.datatype == GL_SHORT);
+  prepassShader.SetUniform("shortIndices", mesh.ibo.datatype == GL_UNSIGNED_SHORT);
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, mesh.vbo.bo);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, mesh.ibo.bo);
+
+  if (clustered) {
+    DrawClusterArrays();
+  } else {
+    glDrawArrays(GL_TRIANGLES, 0, mesh.ibo.num_elements / 4 * 6);
+  }
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, 0);
+
+  prepassShader.Unbind();
+}
+
+void PTexMesh::RenderDepth(
+    const pangolin::OpenGlRenderState& cam,
+    const float depthScale,
+    const Eigen::Vector4f& clipPlane,
+    const Eigen::MatrixX4f& cullPlanes) {
+  GpuProfiler::Scope scope(profiler, "depth");
+  const PassState pass = QueryPassState(cam, !clipPlane.isZero());
+  const std::vector<size_t> visible = VisibleSubMeshes(cam, clipPlane, cullPlanes);
+
+  renderStats = RenderStats();
+  renderStats.subMeshes = meshes.size();
+  renderStats.culledSubMeshes = meshes.size() - visible.size();
+
+  for (size_t i : visible) {
+    RenderSubMeshDepth(i, cam, depthScale, clipPlane, cullPlanes, pass);
+  }
+}
+
+void PTexMesh::CullClusters(
+    const Mesh& mesh,
+    const pangolin::OpenGlRenderState& cam,
+    const Eigen::Vector4f& clipPlane,
+    const Eigen::MatrixX4f& cullPlanes,
+    const PassState& pass) {
+  const Eigen::Vector3d eye =
+      ((Eigen::Matrix4d)cam.GetModelViewMatrix().Inverse()).topRightCorner(3, 1);
+
+  Eigen::Vector4d planes[6];
+  FrustumPlanes(cam.GetProjectionModelViewMatrix(), planes);
+
+  const bool doClip = !clipPlane.isZero();
+  const Eigen::Vector4d clip =
+      clipPlane.cast<double>() / clipPlane.head<3>().cast<double>().norm();
+
+  drawCommands.clear();
+
+  for (size_t i = 0; i < mesh.clusters.size(); i++) {
+    const Cluster& cluster = mesh.clusters[i];
+    const Eigen::Vector4d center(cluster.center(0), cluster.center(1), cluster.center(2), 1.0);
+
+    bool visible = true;
+
+    for (int j = 0; j < 6 && visible; j++) {
+      visible = planes[j].dot(center) >= -cluster.radius;
+    }
+
+    if (visible && doClip) {
+      visible = clip.dot(center) >= -cluster.radius;
+    }
+
+    for (int j = 0; j < cullPlanes.rows() && visible; j++) {
+      const Eigen::Vector4d plane = cullPlanes.row(j).transpose().cast<double>();
+      visible = plane.dot(center) >= -cluster.radius * plane.head<3>().norm();
+    }
+
+    if (visible && pass.coneSign != 0 && cluster.coneAngle < M_PI_2) {
+      // culled if every view direction into the bounding sphere is within 90
+      // degrees of every normal in the cone, flipped to the culled side
+      const Eigen::Vector3d view = (center.head<3>() - eye) * pass.coneSign;
+      const double dist = view.norm();
+      if (dist > cluster.radius) {
+        const double spread = cluster.coneAngle + std::asin(cluster.radius / dist);
+        visible = spread >= M_PI_2 ||
+            view.dot(cluster.coneAxis.cast<double>()) / dist <= std::sin(spread);
+      }
+    }
+
+    if (!visible)
+      continue;
+
+    const uint32_t firstIndex = cluster.firstFace * 4;
+    const uint32_t count = cluster.numFaces * 4;
+
+    if (!drawCommands.empty() &&
+        drawCommands.back().firstIndex + drawCommands.back().count == firstIndex) {
+      drawCommands.back().count += count;
+    } else {
+      drawCommands.push_back({count, 1, firstIndex, 0, (uint32_t)i});
+    }
+
+    renderStats.visibleClusters++;
+  }
+
+  renderStats.clusters += mesh.clusters.size();
+}
+
+void PTexMesh::UploadDrawCommands(const void* commands, const size_t numBytes) {
+  UploadStream(drawCommandBuffer, GL_DRAW_INDIRECT_BUFFER, commands, numBytes);
+}
+
+void PTexMesh::SetToneUniforms(pangolin::GlSlProgram& program, const uint32_t features) {
+  static const char* bracketNames[MAX_BRACKETS] = {
+      "brackets[0]", "brackets[1]", "brackets[2]", "brackets[3]", "brackets[4]"};
+
+  if (features & TONE_MAP) {
+    program.SetUniform("exposure", exposure);
+    program.SetUniform("gamma", 1.0f / gamma);
+    program.SetUniform("saturation", saturation);
+  }
+
+  if (!(features & MRT)) {
+    return;
+  }
+
+  program.SetUniform("depthScale", depthOutputScale);
+
+  program.SetUniform("numBrackets", (int)brackets.size());
+  for (size_t i = 0; i < brackets.size(); i++) {
+    program.SetUniform(
+        bracketNames[i], brackets[i].exposure, 1.0f / brackets[i].gamma, brackets[i].saturation);
+  }
+}
+
+int PTexMesh::WidthInTiles(const Mesh& mesh) const {
+  return mesh.atlas.width / (paddedAtlases ? tileSize + 2 : tileSize);
+}
+
+pangolin::GlSlProgram& PTexMesh::Program(const uint32_t features) {
+  std::unique_ptr<pangolin::GlSlProgram>& program = programs[features];
+  if (program) {
+    return *program;
+  }
+
+  const std::pair<ProgramFeature, const char*> names[] = {{VERTEX_PULLING, "VERTEX_PULLING"},
+                                                          {CLUSTERS, "CLUSTERS"},
+                                                          {LAYERED, "LAYERED"},
+                                                          {CLIP_PLANE, "CLIP_PLANE"},
+                                                          {TONE_MAP, "TONE_MAP"},
+                                                          {MRT, "MRT"},
+                                                          {PADDED_ATLAS, "PADDED_ATLAS"},
+                                                          {DEPTH, "DEPTH"}};
+
+  std::map<std::string, std::string> defines;
+  for (const auto& name : names) {
+    if (features & name.first) {
+      defines[name.second] = "1";
+    }
+  }
+
+  std::vector<ShaderStage> stages;
+  if (features & DEPTH) {
+    // the depth prepass reuses the depth fragment shader with the pulled triangles
+    const std::string vert = features & VERTEX_PULLING ? "mesh-ptex-pull.vert" : "mesh-depth.vert";
+    stages = {{pangolin::GlSlVertexShader, vert, defines},
+              {pangolin::GlSlFragmentShader, "mesh-depth.frag", defines}};
+  } else if (features & VERTEX_PULLING) {
+    stages = {{pangolin::GlSlVertexShader, "mesh-ptex-pull.vert", defines},
+              {pangolin::GlSlFragmentShader, "mesh-ptex.frag", defines}};
+  } else {
+    stages = {{pangolin::GlSlVertexShader, "mesh-ptex.vert", defines},
+              {pangolin::GlSlGeometryShader, "mesh-ptex.geom", defines},
+              {pangolin::GlSlFragmentShader, "mesh-ptex.frag", defines}};
+  }
+
+  program.reset(new pangolin::GlSlProgram());
+  BuildProgram(*program, shadir, stages, options.programCacheDir);
+  return *program;
+}
+
+uint32_t PTexMesh::ShadingFeatures(const bool clip) const {
+  uint32_t features = 0;
+  if (clip) {
+    features |= CLIP_PLANE;
+  }
+  if (exposure != 1.0f || gamma != 1.0f || saturation != 1.0f) {
+    features |= TONE_MAP;
+  }
+  if (paddedAtlases) {
+    features |= PADDED_ATLAS;
+  }
+  if (extraOutputs) {
+    features |= MRT;
+  }
+
+  return features;
+}
+
+int PTexMesh::ViewportHeight() {
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  return viewport[3];
+}
+
+PTexMesh::PassState PTexMesh::QueryPassState(
+    const pangolin::OpenGlRenderState& cam,
+    const bool clip) const {
+  PassState pass;
+  pass.features = ShadingFeatures(clip);
+  pass.viewportHeight = ViewportHeight();
+
+  GLint frontFace = GL_CCW;
+  GLint cullFaceMode = GL_BACK;
+  glGetIntegerv(GL_FRONT_FACE, &frontFace);
+  glGetIntegerv(GL_CULL_FACE_MODE, &cullFaceMode);
+  const bool cullFaces = glIsEnabled(GL_CULL_FACE);
+  pass.frontFaceCCW = frontFace == GL_CCW;
+
+  if (cullFaces) {
+    const bool cullFront = cullFaceMode != GL_BACK;
+    const bool cullBack = cullFaceMode != GL_FRONT;
+    pass.cullCW = pass.frontFaceCCW ? cullBack : cullFront;
+    pass.cullCCW = pass.frontFaceCCW ? cullFront : cullBack;
+  }
+
+  if (cullFaces && cullFaceMode != GL_FRONT_AND_BACK) {
+    // Quads are drawn with the opposite winding to their indices, and a
+    // transform with positive determinant, unlike a standard perspective
+    // projection, mirrors the winding on screen. Culled back faces then have
+    // index winding normals towards the eye if the front face is CCW.
+    const bool mirrored =
+        ((Eigen::Matrix4d)cam.GetProjectionModelViewMatrix()).determinant() > 0.0;
+    pass.coneSign = pass.frontFaceCCW != mirrored ? -1 : 1;
+    if (cullFaceMode == GL_FRONT) {
+      pass.coneSign = -pass.coneSign;
+    }
+  }
+
+  return pass;
+}
+
+void PTexMesh::UploadStream(
+    pangolin::GlBuffer& buffer,
+    const GLenum type,
+    const void* data,
+    const size_t numBytes) {
+  if (!buffer.IsValid() || buffer.SizeBytes() < numBytes) {
+    buffer.Reinitialise(
+        (pangolin::GlBufferType)type,
+        numBytes / sizeof(uint32_t),
+        GL_UNSIGNED_INT,
+        1,
+        GL_STREAM_DRAW);
+  }
+  buffer.Upload(data, numBytes);
+}
+
+void PTexMesh::DrawClusterArrays() {
+  // layout of GL_DRAW_INDIRECT_BUFFER entries for glMultiDrawArraysIndirect
+  struct DrawArraysCommand {
+    uint32_t count;
+    uint32_t instanceCount;
+    uint32_t first;
+    uint32_t baseInstance;
+  };
+
+  std::vector<DrawArraysCommand> commands(drawCommands.size());
+  for (size_t i = 0; i < drawCommands.size(); i++) {
+    commands[i] = {drawCommands[i].count / 4 * 6, 1, drawCommands[i].firstIndex / 4 * 6, 0};
+  }
+
+  UploadDrawCommands(commands.data(), commands.size() * sizeof(DrawArraysCommand));
+
+  drawCommandBuffer.Bind();
+  glMultiDrawArraysIndirect(GL_TRIANGLES, 0, commands.size(), 0);
+  drawCommandBuffer.Unbind();
+}
+
+void PTexMesh::DrawClusters(const Mesh& mesh, const GLenum mode, const bool remapFaces) {
+  UploadDrawCommands(drawCommands.data(), drawCommands.size() * sizeof(DrawCommand));
+
+  if (remapFaces) {
+    // per instance attribute giving the first face of the cluster each
+    // command starts at, its baseInstance being the cluster index
+    mesh.clusterFaceBuffer.Bind();
+    glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, 0, 0);
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(1);
+    mesh.clusterFaceBuffer.Unbind();
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, mesh.faceRemapBuffer.bo);
+  }
+
+  drawCommandBuffer.Bind();
+  glMultiDrawElementsIndirect(mode, mesh.ibo.datatype, 0, drawCommands.size(), 0);
+  drawCommandBuffer.Unbind();
+
+  if (remapFaces) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+    glVertexAttribDivisor(1, 0);
+    glDisableVertexAttribArray(1);
   }
 }
 
@@ -199,6 +1229,14 @@ void PTexMesh::RenderWireframe(
   glFrontFace(GL_CCW);
 
   for (size_t i = 0; i < meshes.size(); i++) {
+    // dequantise compact positions
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glTranslatef(
+        meshes[i]->positionOffset(0), meshes[i]->positionOffset(1), meshes[i]->positionOffset(2));
+    glScalef(
+        meshes[i]->positionScale(0), meshes[i]->positionScale(1), meshes[i]->positionScale(2));
+
     meshes[i]->vbo.Bind();
     glVertexPointer(meshes[i]->vbo.count_per_element, meshes[i]->vbo.datatype, 0, 0);
     glEnableClientState(GL_VERTEX_ARRAY);
@@ -211,6 +1249,8 @@ void PTexMesh::RenderWireframe(
 
     glDisableClientState(GL_VERTEX_ARRAY);
     meshes[i]->vbo.Unbind();
+
+    glPopMatrix();
   }
 
   glPopAttrib();
@@ -224,23 +1264,18 @@ void PTexMesh::RenderWireframe(
   glPopAttrib();
 }
 
-std::vector<MeshData> PTexMesh::SplitMesh(const MeshData& mesh, const float splitSize) {
-  std::vector<uint32_t> verts;
-  verts.resize(mesh.vbo.size());
+PTexMesh::MeshPartition PTexMesh::PartitionMesh(const MeshData& mesh, const float splitSize) {
+  const size_t numFaces = mesh.ibo.size() / 4;
 
-  auto Part1By2 = [](uint64_t x) {
-    x &= 0x1fffff; // mask off lower 21 bits
-    x = (x | (x << 32)) & 0x1f00000000ffff;
-    x = (x | (x << 16)) & 0x1f0000ff0000ff;
-    x = (x | (x << 8)) & 0x100f00f00f00f00f;
-    x = (x | (x << 4)) & 0x10c30c30c30c30c3;
-    x = (x | (x << 2)) & 0x1249249249249249;
-    return x;
-  };
+  // no faces, no chunks
+  if (numFaces == 0) {
+    MeshPartition partition;
+    partition.chunkStart.push_back(0);
+    return partition;
+  }
 
-  auto EncodeMorton3 = [&Part1By2](const Eigen::Vector3i& v) {
-    return (Part1By2(v(2)) << 2) + (Part1By2(v(1)) << 1) + Part1By2(v(0));
-  };
+  std::vector<uint32_t> verts;
+  verts.resize(mesh.vbo.size());
 
   Eigen::AlignedBox3f boundingBox;
 
@@ -249,6 +1284,8 @@ std::vector<MeshData> PTexMesh::SplitMesh(const MeshData& mesh, const float spli
   }
 
 // calculate vertex grid position and code
+// NB: codes are truncated to 32 bits, the shipped atlases depend on the
+// resulting face order so this must not change
 #pragma omp parallel for
   for (size_t i = 0; i < mesh.vbo.size(); i++) {
     const Eigen::Vector3f p = mesh.vbo[i].head<3>();
@@ -256,106 +1293,220 @@ std::vector<MeshData> PTexMesh::SplitMesh(const MeshData& mesh, const float spli
     verts[i] = EncodeMorton3(pi.cast<int>());
   }
 
-  // data structure for sorting faces
+  // data structure for sorting faces
+  struct SortFace {
+    uint32_t code;
+    uint32_t originalFace;
+  };
+
+  // fill per-face data structures (including codes)
+  std::vector<SortFace> faces;
+  faces.resize(numFaces);
+
+#pragma omp parallel for
+  for (size_t i = 0; i < numFaces; i++) {
+    faces[i].originalFace = i;
+    faces[i].code = std::numeric_limits<uint32_t>::max();
+    for (int j = 0; j < 4; j++) {
+      // face code is minimum of referenced vertices codes
+      faces[i].code = std::min(faces[i].code, verts[mesh.ibo[i * 4 + j]]);
+    }
+  }
+
+  // vertex codes are no longer needed
+  std::vector<uint32_t>().swap(verts);
+
+  // sort faces by code
+  std::sort(faces.begin(), faces.end(), [](const SortFace& f1, const SortFace& f2) -> bool {
+    return (f1.code < f2.code);
+  });
+
+  // find face chunk start indices
+  MeshPartition partition;
+  partition.faces.resize(numFaces);
+  partition.chunkStart.push_back(0);
+
+  uint32_t prevCode = faces[0].code;
+  for (size_t i = 0; i < faces.size(); i++) {
+    if (faces[i].code != prevCode) {
+      partition.chunkStart.push_back(i);
+      prevCode = faces[i].code;
+    }
+    partition.faces[i] = faces[i].originalFace;
+  }
+
+  partition.chunkStart.push_back(faces.size());
+
+  return partition;
+}
+
+PTexMesh::MeshPartition PTexMesh::PartitionMeshAdaptive(
+    const MeshData& mesh,
+    const size_t minFaces,
+    const size_t maxFaces) {
+  ASSERT(mesh.polygonStride == 4, "Only works on quad meshes");
+  ASSERT(minFaces <= maxFaces && maxFaces > 0);
+
+  Eigen::AlignedBox3f boundingBox;
+
+  for (size_t i = 0; i < mesh.vbo.Area(); i++) {
+    boundingBox.extend(mesh.vbo[i].head<3>());
+  }
+
+  // quantise face centroids to a 2^21 cube so octree cells stay cubic
+  constexpr int levels = 21;
+  const float extent = std::max(boundingBox.sizes().maxCoeff(), 1e-6f);
+  const float scale = ((1 << levels) - 1) / extent;
+
   struct SortFace {
-    uint32_t index[4];
-    uint32_t code;
-    size_t originalFace;
+    uint64_t code;
+    uint32_t originalFace;
   };
 
-  // fill per-face data structures (including codes)
-  size_t numFaces = mesh.ibo.size() / 4;
-  std::vector<SortFace> faces;
-  faces.resize(numFaces);
+  const size_t numFaces = mesh.ibo.size() / 4;
+  std::vector<SortFace> faces(numFaces);
 
 #pragma omp parallel for
   for (size_t i = 0; i < numFaces; i++) {
-    faces[i].originalFace = i;
-    faces[i].code = std::numeric_limits<uint32_t>::max();
+    Eigen::Vector3f centroid = Eigen::Vector3f::Zero();
     for (int j = 0; j < 4; j++) {
-      faces[i].index[j] = mesh.ibo[i * 4 + j];
-
-      // face code is minimum of referenced vertices codes
-      faces[i].code = std::min(faces[i].code, verts[faces[i].index[j]]);
+      centroid += mesh.vbo[mesh.ibo[i * 4 + j]].head<3>();
     }
+    centroid /= 4.0f;
+
+    const Eigen::Vector3f pi = (centroid - boundingBox.min()) * scale;
+    faces[i].code = EncodeMorton3(pi.cast<int>());
+    faces[i].originalFace = i;
   }
 
-  // sort faces by code
+  // ties broken by face index so the order is reproducible
   std::sort(faces.begin(), faces.end(), [](const SortFace& f1, const SortFace& f2) -> bool {
-    return (f1.code < f2.code);
+    return f1.code < f2.code || (f1.code == f2.code && f1.originalFace < f2.originalFace);
   });
 
-  // find face chunk start indices
-  std::vector<uint32_t> chunkStart;
-  chunkStart.push_back(0);
-  uint32_t prevCode = faces[0].code;
-  for (size_t i = 1; i < faces.size(); i++) {
-    if (faces[i].code != prevCode) {
-      chunkStart.push_back(i);
-      prevCode = faces[i].code;
+  // walk the implicit octree over the sorted codes, splitting cells until
+  // they hold at most maxFaces faces
+  std::vector<uint32_t> leafStart;
+
+  std::function<void(size_t, size_t, int)> subdivide = [&](size_t begin, size_t end, int level) {
+    if (end - begin <= maxFaces || level == levels) {
+      leafStart.push_back(begin);
+      return;
+    }
+
+    const int shift = 3 * (levels - 1 - level);
+    for (uint64_t child = 0; child < 8; child++) {
+      auto inChild = [&](const SortFace& f) { return ((f.code >> shift) & 7) <= child; };
+      const size_t childEnd =
+          std::partition_point(faces.begin() + begin, faces.begin() + end, inChild) -
+          faces.begin();
+      if (childEnd > begin) {
+        subdivide(begin, childEnd, level + 1);
+      }
+      begin = childEnd;
     }
+  };
+
+  if (numFaces > 0) {
+    subdivide(0, numFaces, 0);
   }
+  leafStart.push_back(numFaces);
+
+  // merge undersized cells with their Morton order neighbours
+  MeshPartition partition;
+  partition.chunkStart.push_back(0);
 
-  chunkStart.push_back(faces.size());
-  size_t numChunks = chunkStart.size() - 1;
+  for (size_t i = 1; i + 1 < leafStart.size(); i++) {
+    const size_t current = leafStart[i] - partition.chunkStart.back();
+    const size_t next = leafStart[i + 1] - leafStart[i];
+    const bool undersized = current < minFaces || next < minFaces;
 
-  size_t maxFaces = 0;
-  for (size_t i = 0; i < numChunks; i++) {
-    uint32_t chunkSize = chunkStart[i + 1] - chunkStart[i];
-    if (chunkSize > maxFaces)
-      maxFaces = chunkSize;
+    if (!undersized || current + next > maxFaces) {
+      partition.chunkStart.push_back(leafStart[i]);
+    }
   }
 
-  // create new mesh for each chunk of faces
-  std::vector<MeshData> subMeshes;
+  partition.chunkStart.push_back(numFaces);
 
-  for (size_t i = 0; i < numChunks; i++) {
-    subMeshes.emplace_back(4);
+  partition.faces.resize(numFaces);
+  for (size_t i = 0; i < numFaces; i++) {
+    partition.faces[i] = faces[i].originalFace;
   }
 
-#pragma omp parallel for
-  for (size_t i = 0; i < numChunks; i++) {
-    uint32_t chunkSize = chunkStart[i + 1] - chunkStart[i];
-
-    std::vector<uint32_t> refdVerts;
-    std::unordered_map<uint32_t, uint32_t> refdVertsMap;
-    subMeshes[i].ibo.Reinitialise(chunkSize * 4, 1);
-
-    for (size_t j = 0; j < chunkSize; j++) {
-      size_t faceIdx = chunkStart[i] + j;
-      for (int k = 0; k < 4; k++) {
-        uint32_t vertIndex = faces[faceIdx].index[k];
-        uint32_t newIndex = 0;
-
-        auto it = refdVertsMap.find(vertIndex);
-
-        if (it == refdVertsMap.end()) {
-          // vertex not found, add
-          newIndex = refdVerts.size();
-          refdVerts.push_back(vertIndex);
-          refdVertsMap[vertIndex] = newIndex;
-        } else {
-          // found, use existing index
-          newIndex = it->second;
-        }
-        subMeshes[i].ibo[j * 4 + k] = newIndex;
+  return partition;
+}
+
+MeshData PTexMesh::ExtractSubMesh(
+    const MeshData& mesh,
+    const MeshPartition& partition,
+    const size_t chunk) {
+  const uint32_t chunkSize = partition.ChunkSize(chunk);
+
+  MeshData subMesh(4);
+
+  std::vector<uint32_t> refdVerts;
+  std::unordered_map<uint32_t, uint32_t> refdVertsMap;
+  refdVertsMap.reserve(chunkSize * 2);
+  subMesh.ibo.Reinitialise(chunkSize * 4, 1);
+
+  for (size_t j = 0; j < chunkSize; j++) {
+    size_t faceIdx = partition.faces[partition.chunkStart[chunk] + j];
+    for (int k = 0; k < 4; k++) {
+      uint32_t vertIndex = mesh.ibo[faceIdx * 4 + k];
+      uint32_t newIndex = 0;
+
+      auto it = refdVertsMap.find(vertIndex);
+
+      if (it == refdVertsMap.end()) {
+        // vertex not found, add
+        newIndex = refdVerts.size();
+        refdVerts.push_back(vertIndex);
+        refdVertsMap[vertIndex] = newIndex;
+      } else {
+        // found, use existing index
+        newIndex = it->second;
       }
+      subMesh.ibo[j * 4 + k] = newIndex;
     }
+  }
 
-    // add referenced vertices to submesh
-    subMeshes[i].vbo.Reinitialise(refdVerts.size(), 1);
-    subMeshes[i].nbo.Reinitialise(refdVerts.size(), 1);
+  // add referenced vertices to submesh
+  subMesh.vbo.Reinitialise(refdVerts.size(), 1);
+  for (size_t j = 0; j < refdVerts.size(); j++) {
+    subMesh.vbo[j] = mesh.vbo[refdVerts[j]];
+  }
+
+  if (mesh.nbo.IsValid()) {
+    subMesh.nbo.Reinitialise(refdVerts.size(), 1);
     for (size_t j = 0; j < refdVerts.size(); j++) {
-      uint32_t index = refdVerts[j];
-      subMeshes[i].vbo[j] = mesh.vbo[index];
-      subMeshes[i].nbo[j] = mesh.nbo[index];
+      subMesh.nbo[j] = mesh.nbo[refdVerts[j]];
     }
   }
 
+  return subMesh;
+}
+
+std::vector<MeshData> PTexMesh::SplitMesh(const MeshData& mesh, const float splitSize) {
+  const MeshPartition partition = PartitionMesh(mesh, splitSize);
+  Arena* arena = Arena::Current();
+
+  // create new mesh for each chunk of faces
+  std::vector<MeshData> subMeshes;
+
+  for (size_t i = 0; i < partition.NumChunks(); i++) {
+    subMeshes.emplace_back(4);
+  }
+
+#pragma omp parallel for
+  for (size_t i = 0; i < partition.NumChunks(); i++) {
+    Arena::Scope workerScope(arena);
+    subMeshes[i] = ExtractSubMesh(mesh, partition, i);
+  }
+
   return subMeshes;
 }
 
-void PTexMesh::CalculateAdjacency(const MeshData& mesh, std::vector<uint32_t>& adjFaces) {
+void PTexMesh::CalculateAdjacency(const MeshData& mesh, ArenaVector<uint32_t>& adjFaces) {
   struct EdgeData {
     EdgeData(int f, int e) : face(f), edge(e) {}
     int face;
@@ -432,69 +1583,814 @@ void PTexMesh::CalculateAdjacency(const MeshData& mesh, std::vector<uint32_t>& a
   }
 }
 
+void PTexMesh::BuildClusters(
+    const MeshData& mesh,
+    const size_t clusterSize,
+    std::vector<uint32_t>& faceOrder,
+    std::vector<Cluster>& clusters) {
+  ASSERT(mesh.polygonStride == 4, "Only works on quad meshes");
+  ASSERT(clusterSize > 0);
+
+  const size_t numFaces = mesh.ibo.size() / 4;
+
+  Eigen::AlignedBox3f boundingBox;
+  for (size_t i = 0; i < mesh.vbo.Area(); i++) {
+    boundingBox.extend(mesh.vbo[i].head<3>());
+  }
+
+  constexpr int levels = 20;
+  const float extent = std::max(boundingBox.sizes().maxCoeff(), 1e-6f);
+  const float scale = ((1 << levels) - 1) / extent;
+
+  // sort faces by dominant normal direction, then spatially, so clusters
+  // have tight normal cones and bounding spheres
+  std::vector<Eigen::Vector3f> normals(numFaces);
+  std::vector<uint64_t> keys(numFaces);
+
+  for (size_t i = 0; i < numFaces; i++) {
+    const uint32_t* face = &mesh.ibo[i * 4];
+
+    // normal by the winding of the face's indices, which side of it is culled
+    // is only known at draw time, see QueryPassState
+    const Eigen::Vector3f n = (mesh.vbo[face[2]] - mesh.vbo[face[0]])
+                            .head<3>()
+                            .cross((mesh.vbo[face[3]] - mesh.vbo[face[1]]).head<3>());
+
+    Eigen::Vector3f centroid = Eigen::Vector3f::Zero();
+    for (int j = 0; j < 4; j++) {
+      centroid += mesh.vbo[face[j]].head<3>() / 4.0f;
+    }
+
+    const float length = n.norm();
+    normals[i] = length > 0.0f ? Eigen::Vector3f(n / length) : Eigen::Vector3f::Zero();
+
+    uint64_t bucket = 6;
+    if (length > 0.0f) {
+      int axis;
+      normals[i].cwiseAbs().maxCoeff(&axis);
+      bucket = axis * 2 + (normals[i](axis) < 0.0f);
+    }
+
+    const Eigen::Vector3f pi = (centroid - boundingBox.min()) * scale;
+    keys[i] = (bucket << (3 * levels)) | EncodeMorton3(pi.cast<int>());
+  }
+
+  faceOrder.resize(numFaces);
+  std::iota(faceOrder.begin(), faceOrder.end(), 0);
+  std::sort(faceOrder.begin(), faceOrder.end(), [&keys](uint32_t f1, uint32_t f2) {
+    return keys[f1] < keys[f2] || (keys[f1] == keys[f2] && f1 < f2);
+  });
+
+  clusters.clear();
+
+  size_t begin = 0;
+  while (begin < numFaces) {
+    // clusters don't straddle normal buckets
+    const uint64_t bucket = keys[faceOrder[begin]] >> (3 * levels);
+    size_t end = begin + 1;
+    while (end < numFaces && end - begin < clusterSize &&
+           keys[faceOrder[end]] >> (3 * levels) == bucket) {
+      end++;
+    }
+
+    Cluster cluster;
+    cluster.firstFace = begin;
+    cluster.numFaces = end - begin;
+
+    Eigen::AlignedBox3f bounds;
+    Eigen::Vector3f normalSum = Eigen::Vector3f::Zero();
+    for (size_t i = begin; i < end; i++) {
+      for (int j = 0; j < 4; j++) {
+        bounds.extend(mesh.vbo[mesh.ibo[faceOrder[i] * 4 + j]].head<3>());
+      }
+      normalSum += normals[faceOrder[i]];
+    }
+
+    cluster.center = bounds.center();
+    cluster.radius = 0.0f;
+    for (size_t i = begin; i < end; i++) {
+      for (int j = 0; j < 4; j++) {
+        const Eigen::Vector3f p = mesh.vbo[mesh.ibo[faceOrder[i] * 4 + j]].head<3>();
+        cluster.radius = std::max(cluster.radius, (p - cluster.center).norm());
+      }
+    }
+
+    cluster.coneAxis = Eigen::Vector3f::Zero();
+    cluster.coneAngle = M_PI;
+    if (normalSum.norm() > 0.0f) {
+      cluster.coneAxis = normalSum.normalized();
+      float minDot = 1.0f;
+      for (size_t i = begin; i < end; i++) {
+        // degenerate faces are never rasterised
+        if (!normals[faceOrder[i]].isZero())
+          minDot = std::min(minDot, normals[faceOrder[i]].dot(cluster.coneAxis));
+      }
+      cluster.coneAngle = std::acos(std::max(-1.0f, std::min(1.0f, minDot)));
+    }
+
+    clusters.push_back(cluster);
+    begin = end;
+  }
+}
+
+MeshData PTexMesh::BuildLod(const MeshData& mesh, std::vector<uint32_t>& children) {
+  ASSERT(mesh.polygonStride == 4, "Must be a quad mesh!");
+
+  const size_t numFaces = mesh.ibo.Area() / 4;
+  const size_t numVerts = mesh.vbo.Area();
+
+  // corners around each vertex, as face * 4 + corner
+  std::vector<uint32_t> cornerStart(numVerts + 1, 0);
+  std::vector<uint32_t> corners(numFaces * 4);
+
+  for (size_t i = 0; i < numFaces * 4; i++) {
+    cornerStart[mesh.ibo[i] + 1]++;
+  }
+  std::partial_sum(cornerStart.begin(), cornerStart.end(), cornerStart.begin());
+  {
+    std::vector<uint32_t> next(cornerStart.begin(), cornerStart.end() - 1);
+    for (size_t i = 0; i < numFaces * 4; i++) {
+      corners[next[mesh.ibo[i]]++] = i;
+    }
+  }
+
+  auto Vertex = [&mesh](uint32_t corner, uint32_t offset) {
+    return mesh.ibo[(corner & ~3u) + ((corner + offset) & 3)];
+  };
+
+  // patch of each face, -1 if kept as is
+  std::vector<int32_t> facePatch(numFaces, -1);
+  std::vector<std::array<uint32_t, 4>> patches;
+
+  // Finds the four faces around v in order, each given by its corner at v
+  auto FindPatch = [&](uint32_t v, std::array<uint32_t, 4>& fan) {
+    if (cornerStart[v + 1] - cornerStart[v] != 4)
+      return false;
+
+    uint32_t corner = corners[cornerStart[v]];
+
+    for (size_t i = 0; i < 4; i++) {
+      if (facePatch[corner / 4] >= 0)
+        return false;
+      fan[i] = corner;
+
+      // the next face round starts with the edge this one ends with
+      const uint32_t edgeEnd = Vertex(corner, 3);
+      bool found = false;
+      for (uint32_t j = cornerStart[v]; j < cornerStart[v + 1] && !found; j++) {
+        if (Vertex(corners[j], 1) == edgeEnd) {
+          corner = corners[j];
+          found = true;
+        }
+      }
+      if (!found)
+        return false;
+    }
+
+    return corner == fan[0];
+  };
+
+  // Merge patches breadth first from each seed, continuing across the edge
+  // midpoints of each patch to keep to the grid where the mesh is regular
+  std::vector<uint8_t> queued(numVerts, 0);
+  std::deque<uint32_t> queue;
+
+  for (uint32_t seed = 0; seed < numVerts; seed++) {
+    if (queued[seed])
+      continue;
+
+    queued[seed] = 1;
+    queue.push_back(seed);
+
+    while (!queue.empty()) {
+      const uint32_t v = queue.front();
+      queue.pop_front();
+
+      std::array<uint32_t, 4> fan;
+      if (!FindPatch(v, fan))
+        continue;
+
+      for (size_t i = 0; i < 4; i++) {
+        facePatch[fan[i] / 4] = patches.size();
+      }
+      patches.push_back(fan);
+
+      for (size_t i = 0; i < 4; i++) {
+        const uint32_t mid = Vertex(fan[i], 1);
+        if (cornerStart[mid + 1] - cornerStart[mid] != 4)
+          continue;
+
+        // the neighbour of mid that shares no face with v
+        const uint32_t outer0 = Vertex(fan[i], 2);
+        const uint32_t outer1 = Vertex(fan[(i + 3) % 4], 2);
+        for (uint32_t j = cornerStart[mid]; j < cornerStart[mid + 1]; j++) {
+          for (uint32_t offset : {1u, 3u}) {
+            const uint32_t w = Vertex(corners[j], offset);
+            if (w != v && w != outer0 && w != outer1 && !queued[w]) {
+              queued[w] = 1;
+              queue.push_back(w);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Emit faces in the order of the faces they replace, keeping atlas locality
+  std::vector<uint32_t> ibo;
+  ibo.reserve(numFaces * 4);
+  children.clear();
+  children.reserve(numFaces * 4);
+
+  std::vector<Eigen::Vector4f> positions(mesh.vbo.ptr, mesh.vbo.ptr + numVerts);
+  std::vector<uint8_t> snapped(numVerts, 0);
+
+  for (size_t i = 0; i < numFaces; i++) {
+    const int32_t patch = facePatch[i];
+
+    if (patch < 0) {
+      for (size_t j = 0; j < 4; j++) {
+        ibo.push_back(mesh.ibo[i * 4 + j]);
+      }
+      const uint32_t none = FACE_MASK;
+      children.insert(children.end(), {(uint32_t)i, none, none, none});
+    } else if (patches[patch][0] / 4 == i) {
+      const std::array<uint32_t, 4>& fan = patches[patch];
+
+      for (size_t j = 0; j < 4; j++) {
+        ibo.push_back(Vertex(fan[j], 2));
+        children.push_back((fan[j] / 4) | ((fan[j] & 3) << ROTATION_SHIFT));
+      }
+
+      // move edge midpoints onto the merged edges so faces left unmerged
+      // next to this patch don't leave cracks
+      for (size_t j = 0; j < 4; j++) {
+        const uint32_t mid = Vertex(fan[j], 1);
+        if (!snapped[mid]) {
+          snapped[mid] = 1;
+          positions[mid] = 0.5f * (mesh.vbo[Vertex(fan[(j + 3) % 4], 2)] + mesh.vbo[Vertex(fan[j], 2)]);
+        }
+      }
+    }
+  }
+
+  // Drop vertices only used inside merged patches
+  const uint32_t unused = std::numeric_limits<uint32_t>::max();
+  std::vector<uint32_t> vertexMap(numVerts, unused);
+  uint32_t numUsed = 0;
+  for (uint32_t& index : ibo) {
+    if (vertexMap[index] == unused) {
+      vertexMap[index] = numUsed++;
+    }
+    index = vertexMap[index];
+  }
+
+  MeshData lod(4);
+  lod.vbo.Reinitialise(numUsed, 1);
+  for (size_t i = 0; i < numVerts; i++) {
+    if (vertexMap[i] != unused) {
+      lod.vbo[vertexMap[i]] = positions[i];
+    }
+  }
+
+  lod.ibo.Reinitialise(ibo.size(), 1);
+  std::copy(ibo.begin(), ibo.end(), lod.ibo.ptr);
+
+  return lod;
+}
+
+float PTexMesh::UploadSubMesh(
+    Mesh& mesh,
+    const MeshData& data,
+    const ArenaVector<uint32_t>& adjFaces) {
+  float error = 0.0f;
+
+  if (options.compactVertices) {
+    std::vector<Eigen::Matrix<int16_t, 4, 1>> positions;
+    error = QuantisePositions(data.vbo, positions, mesh.positionScale, mesh.positionOffset);
+
+    mesh.vbo.Reinitialise(pangolin::GlArrayBuffer, positions.size(), GL_SHORT, 4, GL_STATIC_DRAW);
+    mesh.vbo.Upload(positions.data(), positions.size() * sizeof(positions[0]));
+  } else {
+    mesh.vbo.Reinitialise(
+        pangolin::GlArrayBuffer, data.vbo.Area(), GL_FLOAT, 4, GL_STATIC_DRAW);
+    mesh.vbo.Upload(data.vbo.ptr, data.vbo.Area() * sizeof(Eigen::Vector4f));
+  }
+
+  if (options.compactVertices && data.vbo.Area() <= 65536) {
+    std::vector<uint16_t> indices(data.ibo.ptr, data.ibo.ptr + data.ibo.Area());
+
+    mesh.ibo.Reinitialise(
+        pangolin::GlElementArrayBuffer, indices.size(), GL_UNSIGNED_SHORT, 1, GL_STATIC_DRAW);
+    mesh.ibo.Upload(indices.data(), indices.size() * sizeof(uint16_t));
+  } else {
+    mesh.ibo.Reinitialise(
+        pangolin::GlElementArrayBuffer, data.ibo.Area(), GL_UNSIGNED_INT, 1, GL_STATIC_DRAW);
+    mesh.ibo.Upload(data.ibo.ptr, data.ibo.Area() * sizeof(unsigned int));
+  }
+
+  for (size_t j = 0; j < data.vbo.Area(); j++) {
+    mesh.bounds.extend(data.vbo[j].head<3>());
+  }
+
+  if (options.lodLevels > 0) {
+    mesh.quadSize = MeanEdgeLength(data);
+  }
+
+  mesh.abo.Reinitialise(
+      pangolin::GlShaderStorageBuffer, adjFaces.size(), GL_INT, 1, GL_STATIC_DRAW);
+  mesh.abo.Upload(adjFaces.data(), sizeof(uint32_t) * adjFaces.size());
+
+  return error;
+}
+
 void PTexMesh::LoadMeshData(const std::string& meshFile) {
-  // Load the meshes
+  LoadTrace::Stage loadStage(loadTrace.get(), "load mesh");
+  LoadStats stats;
+  Timer timer;
+
+  const size_t startPageFaults = LoadTrace::MinorPageFaults();
+  const AllocationCounts startAllocations = GetAllocationCounts();
+
+  // Load the meshes, the whole mesh outlives every batch so isn't in the arena
   MeshData originalMesh;
-  PLYParse(originalMesh, meshFile);
+  PLYParse(originalMesh, meshFile, loadTrace.get());
+  stats.parseSeconds = timer.Lap();
+
+  LoadTrace::Stage partitionStage(loadTrace.get(), "partition");
 
   ASSERT(originalMesh.polygonStride == 4, "Must be a quad mesh!");
 
-  // Split into sub-meshes
-  std::vector<MeshData> splitMeshData;
+  // Group faces into sub-meshes
+  MeshPartition partition;
+  const size_t numFaces = originalMesh.ibo.size() / 4;
 
-  if (splitSize > 0.0f) {
+  if (adaptiveSplit) {
+    std::cout << "Splitting mesh adaptively... ";
+    std::cout.flush();
+    partition = PartitionMeshAdaptive(originalMesh, minFaces, maxFaces);
+    std::cout << "done" << std::endl;
+  } else if (splitSize > 0.0f) {
     std::cout << "Splitting mesh... ";
     std::cout.flush();
-    splitMeshData = SplitMesh(originalMesh, splitSize);
+    partition = PartitionMesh(originalMesh, splitSize);
     std::cout << "done" << std::endl;
   } else {
-    splitMeshData.emplace_back(std::move(originalMesh));
+    partition.faces.resize(numFaces);
+    std::iota(partition.faces.begin(), partition.faces.end(), 0);
+    partition.chunkStart = {0, (uint32_t)numFaces};
+  }
+  stats.splitSeconds = timer.Lap();
+  partitionStage.SetArg("sub_meshes", partition.NumChunks());
+  partitionStage.End();
+
+  const size_t numSubMeshes = partition.NumChunks();
+
+  if (options.occluderQuads > 0) {
+    LoadTrace::Stage stage(loadTrace.get(), "select occluders");
+    size_t occluderSubMeshes = 0;
+    occlusionCuller.reset(new OcclusionCuller());
+    occlusionCuller->SetOccluders(
+        SelectOccluders(originalMesh, partition, options.occluderQuads, occluderSubMeshes));
+    std::cout << "Using " << occlusionCuller->NumOccluderQuads() << " quads from "
+              << occluderSubMeshes << " sub-meshes as occluders" << std::endl;
+  }
+
+  // Process sub-meshes in batches that fit within the memory budget, freeing
+  // the CPU copies of each batch once it has been uploaded
+  size_t batchStart = 0;
+  while (batchStart < numSubMeshes) {
+    // the previous batch's buffers are all freed by now
+    if (options.loadArena) {
+      options.loadArena->Reset();
+    }
+    Arena::Scope arenaScope(options.loadArena);
+
+    size_t batchEnd = batchStart + 1;
+    size_t batchBytes = EstimateLoadBytes(partition.ChunkSize(batchStart));
+    while (batchEnd < numSubMeshes && options.maxLoadBytes > 0) {
+      const size_t chunkBytes = EstimateLoadBytes(partition.ChunkSize(batchEnd));
+      if (batchBytes + chunkBytes > options.maxLoadBytes)
+        break;
+      batchBytes += chunkBytes;
+      batchEnd++;
+    }
+    if (options.maxLoadBytes == 0) {
+      batchEnd = numSubMeshes;
+    }
+
+    const size_t batchSize = batchEnd - batchStart;
+    LoadTrace::Stage batchStage(loadTrace.get(), "batch");
+    batchStage.SetArg("first_sub_mesh", batchStart);
+    batchStage.SetArg("sub_meshes", batchSize);
+
+    LoadTrace::Stage extractStage(loadTrace.get(), "extract sub-meshes");
+    std::vector<MeshData> splitMeshData(batchSize);
+    std::vector<ArenaVector<uint32_t>> adjFaces(batchSize);
+
+    if (numSubMeshes == 1 && splitSize <= 0.0f && !adaptiveSplit) {
+      splitMeshData[0] = std::move(originalMesh);
+    } else {
+#pragma omp parallel for
+      for (size_t i = 0; i < batchSize; i++) {
+        Arena::Scope workerScope(options.loadArena);
+        splitMeshData[i] = ExtractSubMesh(originalMesh, partition, batchStart + i);
+      }
+    }
+    stats.splitSeconds += timer.Lap();
+    extractStage.End();
+
+    LoadTrace::Stage adjacencyStage(loadTrace.get(), "adjacency");
+#pragma omp parallel for
+    for (size_t i = 0; i < batchSize; i++) {
+      Arena::Scope workerScope(options.loadArena);
+      CalculateAdjacency(splitMeshData[i], adjFaces[i]);
+    }
+    stats.adjacencySeconds += timer.Lap();
+    adjacencyStage.End();
+
+    // Levels of detail follow the atlas face order, so are built before clustering
+    std::vector<std::vector<LodData>> lods(batchSize);
+
+    if (options.lodLevels > 0) {
+      LoadTrace::Stage stage(loadTrace.get(), "build lods");
+#pragma omp parallel for
+      for (size_t i = 0; i < batchSize; i++) {
+        Arena::Scope workerScope(options.loadArena);
+        lods[i].reserve(options.lodLevels);
+        const MeshData* previous = &splitMeshData[i];
+
+        for (size_t j = 0; j < options.lodLevels; j++) {
+          LodData level;
+          level.mesh = BuildLod(*previous, level.children);
+
+          // stop once there is little left to merge
+          if (level.mesh.ibo.Area() * 10 > previous->ibo.Area() * 9)
+            break;
+
+          CalculateAdjacency(level.mesh, level.adjFaces);
+          lods[i].push_back(std::move(level));
+          previous = &lods[i].back().mesh;
+        }
+      }
+    }
+    stats.lodSeconds += timer.Lap();
+
+    // Reorder faces into clusters, adjacency and atlas tiles keep using the
+    // original face order via the remap table
+    std::vector<std::vector<uint32_t>> faceOrder(batchSize);
+    std::vector<std::vector<Cluster>> clusters(batchSize);
+
+    if (options.clusterSize > 0) {
+      LoadTrace::Stage stage(loadTrace.get(), "build clusters");
+#pragma omp parallel for
+      for (size_t i = 0; i < batchSize; i++) {
+        BuildClusters(splitMeshData[i], options.clusterSize, faceOrder[i], clusters[i]);
+
+        std::vector<uint32_t> clusteredIbo(splitMeshData[i].ibo.Area());
+        for (size_t j = 0; j < faceOrder[i].size(); j++) {
+          memcpy(
+              &clusteredIbo[j * 4],
+              &splitMeshData[i].ibo[faceOrder[i][j] * 4],
+              4 * sizeof(uint32_t));
+        }
+        memcpy(
+            splitMeshData[i].ibo.ptr,
+            clusteredIbo.data(),
+            clusteredIbo.size() * sizeof(uint32_t));
+      }
+    }
+    stats.clusterSeconds += timer.Lap();
+
+    // Upload mesh data to GPU
+    LoadTrace::Stage uploadStage(loadTrace.get(), "upload");
+    for (size_t i = 0; i < batchSize; i++) {
+      std::cout << "\rLoading mesh " << batchStart + i + 1 << "/" << numSubMeshes << "... ";
+      std::cout.flush();
+
+      meshes.emplace_back(new Mesh);
+
+      const float error = UploadSubMesh(*meshes.back(), splitMeshData[i], adjFaces[i]);
+      stats.maxPositionError = std::max(stats.maxPositionError, error);
+
+      // keep culling conservative
+      for (Cluster& cluster : clusters[i]) {
+        cluster.radius += error;
+      }
+
+      stats.vertexBytes += meshes.back()->vbo.SizeBytes();
+      stats.indexBytes += meshes.back()->ibo.SizeBytes();
+      uploadStage.AddBytesUploaded(
+          meshes.back()->vbo.SizeBytes() + meshes.back()->ibo.SizeBytes() +
+          meshes.back()->abo.SizeBytes());
+      if (meshes.back()->ibo.datatype == GL_UNSIGNED_SHORT) {
+        stats.shortIndexMeshes++;
+      }
+
+      for (LodData& level : lods[i]) {
+        meshes.back()->lods.emplace_back(new Mesh);
+        Mesh& lod = *meshes.back()->lods.back();
+
+        UploadSubMesh(lod, level.mesh, level.adjFaces);
+        lod.lodChildren = std::move(level.children);
+        uploadStage.AddBytesUploaded(
+            lod.vbo.SizeBytes() + lod.ibo.SizeBytes() + lod.abo.SizeBytes());
+
+        stats.lodQuads.resize(std::max(stats.lodQuads.size(), meshes.back()->lods.size()));
+        stats.lodQuads[meshes.back()->lods.size() - 1] += level.mesh.ibo.Area() / 4;
+      }
+
+      if (!clusters[i].empty()) {
+        std::vector<uint32_t> clusterFaces(clusters[i].size());
+        for (size_t j = 0; j < clusters[i].size(); j++) {
+          clusterFaces[j] = clusters[i][j].firstFace;
+        }
+
+        meshes.back()->clusterFaceBuffer.Reinitialise(
+            pangolin::GlArrayBuffer, clusterFaces.size(), GL_UNSIGNED_INT, 1, GL_STATIC_DRAW);
+        meshes.back()->clusterFaceBuffer.Upload(
+            clusterFaces.data(), sizeof(uint32_t) * clusterFaces.size());
+        meshes.back()->faceRemapBuffer.Reinitialise(
+            pangolin::GlShaderStorageBuffer,
+            faceOrder[i].size(),
+            GL_UNSIGNED_INT,
+            1,
+            GL_STATIC_DRAW);
+        meshes.back()->faceRemapBuffer.Upload(
+            faceOrder[i].data(), sizeof(uint32_t) * faceOrder[i].size());
+        meshes.back()->clusters = std::move(clusters[i]);
+        uploadStage.AddBytesUploaded(
+            meshes.back()->clusterFaceBuffer.SizeBytes() +
+            meshes.back()->faceRemapBuffer.SizeBytes());
+      }
+    }
+    stats.uploadSeconds += timer.Lap();
+    uploadStage.End();
+
+    stats.numBatches++;
+    batchStart = batchEnd;
+  }
+  std::cout << "\rLoading mesh " << numSubMeshes << "/" << numSubMeshes << "... done"
+            << std::endl;
+
+  if (options.loadArena) {
+    options.loadArena->Reset();
+  }
+
+  std::cout << "Loaded " << numSubMeshes << " sub-meshes in " << stats.numBatches
+            << " batch(es): parse " << stats.parseSeconds << "s, split " << stats.splitSeconds
+            << "s, adjacency " << stats.adjacencySeconds << "s, clusters "
+            << stats.clusterSeconds << "s, lod " << stats.lodSeconds << "s, upload " << stats.uploadSeconds
+            << "s, peak RSS " << LoadTrace::PeakResidentBytes() / (1024 * 1024) << "MB" << std::endl;
+
+  std::cout << "GPU mesh data: vertices " << stats.vertexBytes / (1024 * 1024) << "MB, indices "
+            << stats.indexBytes / (1024 * 1024) << "MB";
+  if (options.compactVertices) {
+    // depth is a projection onto a unit view axis so is bounded by the
+    // position error
+    std::cout << ", " << stats.shortIndexMeshes << "/" << numSubMeshes
+              << " sub-meshes with 16-bit indices, max position (and depth) error "
+              << stats.maxPositionError * 1000.0f << "mm";
   }
+  std::cout << std::endl;
+
+  if (!stats.lodQuads.empty()) {
+    std::cout << "Levels of detail: " << numFaces << " quads";
+    for (size_t quads : stats.lodQuads) {
+      std::cout << ", " << quads << " quads";
+    }
+    std::cout << std::endl;
+  }
+
+  const AllocationCounts allocations = GetAllocationCounts();
+  std::cout << "CPU mesh buffers: " << allocations.arena - startAllocations.arena
+            << " arena and " << allocations.heap - startAllocations.heap
+            << " heap allocations, " << LoadTrace::MinorPageFaults() - startPageFaults
+            << " minor page faults";
+  if (options.loadArena) {
+    const Arena::Stats arenaStats = options.loadArena->GetStats();
+    std::cout << ", arena peak " << arenaStats.peakUsedBytes / (1024 * 1024) << "MB of "
+              << arenaStats.mappedBytes / (1024 * 1024) << "MB mapped ("
+              << arenaStats.hugeTlbBytes / (1024 * 1024) << "MB hugetlb)";
+  }
+  std::cout << std::endl;
+}
+
+void PTexMesh::BuildLodAtlases(const std::string& shadir) {
+  LoadTrace::Stage stage(loadTrace.get(), "lod atlases");
+  pangolin::GlSlProgram lodShader;
+  BuildProgram(
+      lodShader,
+      shadir,
+      {{pangolin::GlSlVertexShader, "lod-atlas.vert", {}},
+       {pangolin::GlSlFragmentShader, "lod-atlas.frag", {}}},
+      options.programCacheDir);
+
+  GLuint frameBuffer = 0;
+  glGenFramebuffers(1, &frameBuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
 
-  // Upload mesh data to GPU
-  for (size_t i = 0; i < splitMeshData.size(); i++) {
-    std::cout << "\rLoading mesh " << i + 1 << "/" << splitMeshData.size() << "... ";
+  glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT);
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_CULL_FACE);
+  glDisable(GL_BLEND);
+
+  pangolin::GlBuffer childBuffer;
+
+  for (size_t i = 0; i < meshes.size(); i++) {
+    std::cout << "\rBuilding level of detail atlases " << i + 1 << "/" << meshes.size() << "... ";
     std::cout.flush();
 
-    meshes.emplace_back(new Mesh);
+    const Mesh* source = meshes[i].get();
 
-    meshes.back()->vbo.Reinitialise(
-        pangolin::GlArrayBuffer, splitMeshData[i].vbo.Area(), GL_FLOAT, 4, GL_STATIC_DRAW);
-    meshes.back()->vbo.Upload(
-        splitMeshData[i].vbo.ptr, splitMeshData[i].vbo.Area() * sizeof(Eigen::Vector4f));
-    meshes.back()->ibo.Reinitialise(
-        pangolin::GlElementArrayBuffer,
-        splitMeshData[i].ibo.Area(),
-        GL_UNSIGNED_INT,
-        1,
-        GL_STATIC_DRAW);
-    meshes.back()->ibo.Upload(
-        splitMeshData[i].ibo.ptr, splitMeshData[i].ibo.Area() * sizeof(unsigned int));
+    for (auto& lod : meshes[i]->lods) {
+      const size_t numFaces = lod->lodChildren.size() / 4;
+      const size_t widthInTiles = std::ceil(std::sqrt((double)numFaces));
+      const size_t dim = widthInTiles * tileSize;
+
+      // rendered at full precision, DXT1 atlases are recompressed below
+      lod->atlas.Reinitialise(
+          dim,
+          dim,
+          isHdr ? GL_RGBA16F : GL_RGBA8,
+          false,
+          0,
+          GL_RGBA,
+          isHdr ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE);
+      glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, lod->atlas.tid, 0);
+      ASSERT(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+      glViewport(0, 0, dim, dim);
+
+      childBuffer.Reinitialise(
+          pangolin::GlShaderStorageBuffer,
+          lod->lodChildren.size(),
+          GL_UNSIGNED_INT,
+          1,
+          GL_STATIC_DRAW);
+      childBuffer.Upload(lod->lodChildren.data(), sizeof(uint32_t) * lod->lodChildren.size());
+
+      lodShader.Bind();
+      lodShader.SetUniform("tileSize", (int)tileSize);
+      lodShader.SetUniform("widthInTiles", int(source->atlas.width / tileSize));
+      lodShader.SetUniform("lodWidthInTiles", (int)widthInTiles);
+      lodShader.SetUniform("numFaces", (int)numFaces);
+
+      glActiveTexture(GL_TEXTURE0);
+      source->atlas.Bind();
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, source->abo.bo);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, childBuffer.bo);
+
+      glDrawArrays(GL_TRIANGLES, 0, 3);
+
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, 0);
+      source->atlas.Unbind();
+      lodShader.Unbind();
+
+      lod->lodChildren = std::vector<uint32_t>();
+      source = lod.get();
+    }
+
+    if (meshes[i]->atlas.internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) {
+      // let the driver compress, keeping coarse atlases as small as the originals
+      for (auto& lod : meshes[i]->lods) {
+        std::vector<uint8_t> texels(lod->atlas.width * lod->atlas.height * 4);
+        lod->atlas.Download(texels.data(), GL_RGBA, GL_UNSIGNED_BYTE);
+        lod->atlas.Reinitialise(
+            lod->atlas.width,
+            lod->atlas.height,
+            GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
+            false,
+            0,
+            GL_RGBA,
+            GL_UNSIGNED_BYTE,
+            texels.data());
+      }
+    }
   }
-  std::cout << "\rLoading mesh " << splitMeshData.size() << "/" << splitMeshData.size()
+
+  glPopAttrib();
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &frameBuffer);
+
+  std::cout << "\rBuilding level of detail atlases " << meshes.size() << "/" << meshes.size()
             << "... done" << std::endl;
+}
+
+void PTexMesh::PadAtlases(const std::string& shadir) {
+  LoadTrace::Stage stage(loadTrace.get(), "pad atlases");
+  pangolin::GlSlProgram padShader;
+  BuildProgram(
+      padShader,
+      shadir,
+      {{pangolin::GlSlVertexShader, "lod-atlas.vert", {}},
+       {pangolin::GlSlFragmentShader, "pad-atlas.frag", {}}},
+      options.programCacheDir);
+
+  GLuint frameBuffer = 0;
+  glGenFramebuffers(1, &frameBuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+
+  glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT);
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_CULL_FACE);
+  glDisable(GL_BLEND);
 
-  std::cout << "Calculating mesh adjacency... ";
-  std::cout.flush();
+  for (size_t i = 0; i < meshes.size(); i++) {
+    std::cout << "\rPadding atlases " << i + 1 << "/" << meshes.size() << "... ";
+    std::cout.flush();
 
-  std::vector<std::vector<uint32_t>> adjFaces(splitMeshData.size());
+    std::vector<Mesh*> levels = {meshes[i].get()};
+    for (auto& lod : meshes[i]->lods) {
+      levels.push_back(lod.get());
+    }
 
-#pragma omp parallel for
-  for (size_t i = 0; i < splitMeshData.size(); i++) {
-    CalculateAdjacency(splitMeshData[i], adjFaces[i]);
+    for (Mesh* mesh : levels) {
+      // tiles keep their place in the grid
+      const size_t widthInTiles = mesh->atlas.width / tileSize;
+      const size_t dim = widthInTiles * (tileSize + 2);
+      const bool compressed = mesh->atlas.internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+
+      pangolin::GlTexture padded(
+          dim,
+          dim,
+          compressed ? GL_RGBA8 : mesh->atlas.internal_format,
+          false,
+          0,
+          GL_RGBA,
+          isHdr ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE);
+      glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, padded.tid, 0);
+      ASSERT(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+      glViewport(0, 0, dim, dim);
+
+      padShader.Bind();
+      padShader.SetUniform("tileSize", (int)tileSize);
+      padShader.SetUniform("widthInTiles", (int)widthInTiles);
+      padShader.SetUniform("numFaces", int(mesh->ibo.num_elements / 4));
+
+      glActiveTexture(GL_TEXTURE0);
+      mesh->atlas.Bind();
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mesh->abo.bo);
+
+      glDrawArrays(GL_TRIANGLES, 0, 3);
+
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+      mesh->atlas.Unbind();
+      padShader.Unbind();
+
+      if (compressed) {
+        // let the driver compress, as for level of detail atlases
+        std::vector<uint8_t> texels(dim * dim * 4);
+        padded.Download(texels.data(), GL_RGBA, GL_UNSIGNED_BYTE);
+        mesh->atlas.Reinitialise(
+            dim,
+            dim,
+            GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
+            false,
+            0,
+            GL_RGBA,
+            GL_UNSIGNED_BYTE,
+            texels.data());
+      } else {
+        const GLint format = mesh->atlas.internal_format;
+        mesh->atlas.Reinitialise(
+            dim, dim, format, false, 0, GL_RGBA, isHdr ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE);
+        glCopyImageSubData(
+            padded.tid,
+            GL_TEXTURE_2D,
+            0,
+            0,
+            0,
+            0,
+            mesh->atlas.tid,
+            GL_TEXTURE_2D,
+            0,
+            0,
+            0,
+            0,
+            dim,
+            dim,
+            1);
+      }
+    }
   }
 
-  for (size_t i = 0; i < splitMeshData.size(); i++) {
-    meshes[i]->abo.Reinitialise(
-        pangolin::GlShaderStorageBuffer, adjFaces[i].size(), GL_INT, 1, GL_STATIC_DRAW);
-    meshes[i]->abo.Upload(adjFaces[i].data(), sizeof(uint32_t) * adjFaces[i].size());
-  }
-  std::cout << "done" << std::endl;
+  glPopAttrib();
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &frameBuffer);
+
+  paddedAtlases = true;
+
+  std::cout << "\rPadding atlases " << meshes.size() << "/" << meshes.size() << "... done"
+            << std::endl;
 }
 
 void PTexMesh::LoadAtlasData(const std::string& atlasFolder) {
+  LoadTrace::Stage loadStage(loadTrace.get(), "load atlases");
   isHdr = false;
+
   // Upload atlas data to GPU
+  LoadTrace::Stage allocateStage(loadTrace.get(), "allocate atlases");
   for (size_t i = 0; i < meshes.size(); i++) {
     const std::string dxtFile = atlasFolder + "/" + std::to_string(i) + "-color-ptex.dxt1";
     const std::string rgbFile = atlasFolder + "/" + std::to_string(i) + "-color-ptex.rgb";
@@ -528,6 +2424,8 @@ void PTexMesh::LoadAtlasData(const std::string& atlasFolder) {
     }
   }
 
+  allocateStage.End();
+
   for (size_t i = 0; i < meshes.size(); i++) {
     std::cout << "\rLoading atlas " << i + 1 << "/" << meshes.size() << "... ";
     std::cout.flush();
@@ -535,12 +2433,17 @@ void PTexMesh::LoadAtlasData(const std::string& atlasFolder) {
     const std::string rgbFile = atlasFolder + "/" + std::to_string(i) + "-color-ptex.rgb";
     const std::string hdrFile = atlasFolder + "/" + std::to_string(i) + "-color-ptex.hdr";
 
+    LoadTrace::Stage stage(loadTrace.get(), "atlas");
+    stage.SetArg("sub_mesh", i);
+
     if (pangolin::FileExists(dxtFile)) {
       const size_t numBytes = std::experimental::filesystem::file_size(dxtFile);
 
       // Open file
       int fd = open(std::string(dxtFile).c_str(), O_RDONLY, 0);
       void* mmappedData = mmap(NULL, numBytes, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+      stage.AddBytesRead(numBytes);
+      stage.AddBytesUploaded(numBytes);
 
       meshes[i]->atlas.Bind();
       glCompressedTexSubImage2D(
@@ -563,6 +2466,8 @@ void PTexMesh::LoadAtlasData(const std::string& atlasFolder) {
       // Open file
       int fd = open(std::string(rgbFile).c_str(), O_RDONLY, 0);
       void* mmappedData = mmap(NULL, numBytes, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+      stage.AddBytesRead(numBytes);
+      stage.AddBytesUploaded(numBytes);
 
       meshes[i]->atlas.Upload(mmappedData, GL_RGB, GL_UNSIGNED_BYTE);
 
@@ -574,6 +2479,8 @@ void PTexMesh::LoadAtlasData(const std::string& atlasFolder) {
       // Open file
       int fd = open(std::string(hdrFile).c_str(), O_RDONLY, 0);
       void* mmappedData = mmap(NULL, numBytes, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+      stage.AddBytesRead(numBytes);
+      stage.AddBytesUploaded(numBytes);
 
       meshes[i]->atlas.Upload(mmappedData, GL_RGB, GL_HALF_FLOAT);
 
@@ -0,0 +1,151 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "ProgramCache.h"
+#include "Assert.h"
+#include "DiskCache.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+namespace {
+
+// Changing the file layout invalidates cached programs
+constexpr uint64_t kCacheVersion = 1;
+
+std::string GlString(const GLenum name) {
+  const GLubyte* s = glGetString(name);
+  return s ? std::string((const char*)s) : std::string();
+}
+
+// Shader source with #include "file" lines replaced by the files, as
+// pangolin does when compiling
+std::string ExpandIncludes(const std::string& shadir, const std::string& file) {
+  std::ifstream in(shadir + "/" + file);
+  ASSERT(in.good(), "Can't read shader " + shadir + "/" + file);
+
+  std::stringstream out;
+  std::string line;
+  while (std::getline(in, line)) {
+    const size_t open = line.find('"');
+    const size_t close = line.rfind('"');
+    if (line.compare(0, 8, "#include") == 0 && open != close) {
+      out << ExpandIncludes(shadir, line.substr(open + 1, close - open - 1));
+    } else {
+      out << line << '\n';
+    }
+  }
+  return out.str();
+}
+
+// pangolin has no way to set the program object of a GlSlProgram
+struct ProgramAccess : public pangolin::GlSlProgram {
+  static void SetProgramId(pangolin::GlSlProgram& program, const GLuint id) {
+    program.*(&ProgramAccess::prog) = id;
+  }
+};
+
+bool LoadBinary(pangolin::GlSlProgram& program, const std::string& cacheFile) {
+  std::ifstream file(cacheFile, std::ios::binary);
+  if (!file)
+    return false;
+
+  uint32_t format = 0;
+  file.read((char*)&format, sizeof(format));
+  const std::string binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  if (binary.empty())
+    return false;
+
+  const GLuint id = glCreateProgram();
+  glProgramBinary(id, format, binary.data(), binary.size());
+
+  // fails if the driver changed in a way its version string doesn't show
+  GLint linked = GL_FALSE;
+  glGetProgramiv(id, GL_LINK_STATUS, &linked);
+  if (!linked) {
+    glDeleteProgram(id);
+    return false;
+  }
+
+  ProgramAccess::SetProgramId(program, id);
+  return true;
+}
+
+void StoreBinary(
+    const pangolin::GlSlProgram& program,
+    const std::string& cacheFile) {
+  GLint size = 0;
+  glGetProgramiv(program.ProgramId(), GL_PROGRAM_BINARY_LENGTH, &size);
+  if (size <= 0)
+    return;
+
+  std::string binary(size, '\0');
+  GLenum format = 0;
+  glGetProgramBinary(program.ProgramId(), size, &size, &format, &binary[0]);
+  binary.resize(size);
+
+  const bool cached = WriteCacheFile(cacheFile, [&](std::ostream& out) {
+    const uint32_t format32 = format;
+    out.write((const char*)&format32, sizeof(format32));
+    out.write(binary.data(), binary.size());
+  });
+
+  if (!cached) {
+    std::cout << "Can't cache shader program as " << cacheFile << std::endl;
+  }
+}
+
+} // namespace
+
+std::string DefaultProgramCacheDir() {
+  return CacheDir("programs");
+}
+
+void BuildProgram(
+    pangolin::GlSlProgram& program,
+    const std::string& shadir,
+    const std::vector<ShaderStage>& stages,
+    const std::string& cacheDir) {
+  ASSERT(program.ProgramId() == 0, "Program already built");
+
+  GLint numFormats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+
+  std::string cacheFile;
+  if (!cacheDir.empty() && numFormats > 0) {
+    uint64_t hash = kFnv1aBasis ^ kCacheVersion;
+    hash = Fnv1a(hash, GlString(GL_VENDOR) + "\n" + GlString(GL_RENDERER) + "\n");
+    hash = Fnv1a(hash, GlString(GL_VERSION) + "\n");
+
+    for (const ShaderStage& stage : stages) {
+      hash = Fnv1a(hash, std::to_string(stage.type) + "\n");
+      for (const auto& define : stage.defines) {
+        hash = Fnv1a(hash, define.first + "=" + define.second + "\n");
+      }
+      hash = Fnv1a(hash, ExpandIncludes(shadir, stage.file));
+    }
+
+    char key[64];
+    snprintf(key, sizeof(key), "program-%016" PRIx64 ".bin", hash);
+    cacheFile = cacheDir + "/" + key;
+
+    if (LoadBinary(program, cacheFile))
+      return;
+  }
+
+  for (const ShaderStage& stage : stages) {
+    program.AddShaderFromFile(stage.type, shadir + "/" + stage.file, stage.defines, {shadir});
+  }
+
+  if (!cacheFile.empty()) {
+    glProgramParameteri(program.ProgramId(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+
+  program.Link();
+
+  if (!cacheFile.empty()) {
+    StoreBinary(program, cacheFile);
+  }
+}
@@ -0,0 +1,109 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "ViewArray.h"
+#include "Assert.h"
+
+#include <cstring>
+
+ViewArray::ViewArray(
+    const int width,
+    const int height,
+    const int numViews,
+    const bool depthOutput)
+    : width(width), height(height), numViews(numViews) {
+  ASSERT(width > 0 && height > 0 && numViews > 0);
+
+  GLint maxLayers = 0;
+  glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+  ASSERT(numViews <= maxLayers, "At most " + std::to_string(maxLayers) + " views supported");
+
+  glGenTextures(1, &colour);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, colour);
+  glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, width, height, numViews);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  // every attachment of a layered framebuffer must be layered, so depth
+  // can't be a renderbuffer
+  glGenTextures(1, &depth);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, depth);
+  glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, width, height, numViews);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  if (depthOutput) {
+    glGenTextures(1, &this->depthOutput);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, this->depthOutput);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R32F, width, height, numViews);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  }
+
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, colour, 0);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth, 0);
+  if (depthOutput) {
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, this->depthOutput, 0);
+    const GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, drawBuffers);
+  } else {
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+  }
+  ASSERT(
+      glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE,
+      "Incomplete layered framebuffer");
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  glGenBuffers(1, &pixelBuffer);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+  glBufferData(GL_PIXEL_PACK_BUFFER, SizeBytes(), nullptr, GL_STREAM_READ);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+ViewArray::~ViewArray() {
+  glDeleteBuffers(1, &pixelBuffer);
+  glDeleteFramebuffers(1, &framebuffer);
+  if (depthOutput) {
+    glDeleteTextures(1, &depthOutput);
+  }
+  glDeleteTextures(1, &depth);
+  glDeleteTextures(1, &colour);
+}
+
+void ViewArray::Bind() {
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glPushAttrib(GL_VIEWPORT_BIT);
+  glViewport(0, 0, width, height);
+  glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+}
+
+void ViewArray::Unbind() {
+  glPopAttrib(); // GL_VIEWPORT_BIT
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ViewArray::StartDownload() {
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, colour);
+  glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  downloadStarted = true;
+}
+
+void ViewArray::Download(uint8_t* data) {
+  if (!downloadStarted) {
+    StartDownload();
+  }
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+  const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, SizeBytes(), GL_MAP_READ_BIT);
+  ASSERT(pixels, "Can't map view pixel buffer");
+  std::memcpy(data, pixels, SizeBytes());
+  glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  downloadStarted = false;
+}
@@ -173,6 +173,25 @@ vec4 texelFetchAtlasAdj(sampler2D tex, int faceID, ivec2 p)
     return texelFetch(tex, atlasPos + p, 0);
 }
 
+#ifdef PADDED_ATLAS
+// fetch with bilinear filtering from an atlas whose tiles have a border of
+// one texel copied from the adjacent faces, see pad-atlas.frag, so the
+// footprint never leaves the tile
+vec4 textureAtlas(sampler2D tex, int faceID, vec2 p)
+{
+    p -= 0.5;
+    ivec2 i = ivec2(floor(p));
+    vec2 f = p - vec2(i);
+    ivec2 atlasPos = FaceToAtlasPos(faceID, tileSize + 2) + i + 1;
+    return mix(mix(texelFetch(tex, atlasPos, 0),
+                   texelFetch(tex, atlasPos + ivec2(1, 0), 0),
+                   f.x),
+               mix(texelFetch(tex, atlasPos + ivec2(0, 1), 0),
+                   texelFetch(tex, atlasPos + ivec2(1, 1), 0),
+                   f.x),
+               f.y);
+}
+#else
 // fetch with bilinear filtering
 vec4 textureAtlas(sampler2D tex, int faceID, vec2 p)
 {
@@ -187,6 +206,7 @@ vec4 textureAtlas(sampler2D tex, int faceID, vec2 p)
                    f.x),
                f.y);
 }
+#endif
 
 void applySaturation(inout vec4 c, float saturation)
 {
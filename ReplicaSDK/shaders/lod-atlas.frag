@@ -0,0 +1,63 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#version 430 core
+// renders a level of detail atlas from the atlas of the level before,
+// see PTexMesh::BuildLod for the layout of lodChildren
+#include "atlas.glsl"
+
+layout(location = 0) out vec4 FragColor;
+layout(binding = 0) uniform sampler2D atlasTex;
+
+uniform int lodWidthInTiles;
+uniform int numFaces;
+
+layout(std430, binding = 5) buffer LodChildren
+{
+    uint lodChildren[];
+};
+
+const vec2 corners[4] = vec2[](vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0));
+
+void main()
+{
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    ivec2 tile = p / tileSize;
+    int face = tile.y * lodWidthInTiles + tile.x;
+
+    if (face >= numFaces)
+    {
+        discard;
+    }
+
+    vec2 uv = (vec2(p - tile * tileSize) + 0.5) / tileSize;
+
+    int child;
+    vec2 childUV;
+
+    if (lodChildren[face * 4 + 1] == uint(FACE_MASK))
+    {
+        // unmerged face, copy its tile
+        child = int(lodChildren[face * 4]);
+        childUV = uv;
+    }
+    else
+    {
+        // quadrant of the merged face covered by each child
+        int q = uv.y < 0.5 ? (uv.x < 0.5 ? 0 : 1) : (uv.x < 0.5 ? 3 : 2);
+        uint data = lodChildren[face * 4 + q];
+        child = int(data & uint(FACE_MASK));
+        int k = int(data >> ROTATION_SHIFT);
+
+        // corners of the child face in the merged face's UVs
+        vec2 c[4];
+        c[(k + 2) & 3] = corners[q];
+        c[k] = vec2(0.5);
+        c[(k + 1) & 3] = 0.5 * (corners[(q + 3) & 3] + corners[q]);
+        c[(k + 3) & 3] = 0.5 * (corners[q] + corners[(q + 1) & 3]);
+
+        vec2 d = uv - c[0];
+        childUV = vec2(dot(d, c[1] - c[0]), dot(d, c[3] - c[0])) * 4.0;
+    }
+
+    // bilinear filtering between source texels halves the resolution
+    FragColor = textureAtlas(atlasTex, child, childUV * tileSize);
+}
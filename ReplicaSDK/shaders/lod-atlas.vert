@@ -0,0 +1,9 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#version 430 core
+// full screen triangle
+
+void main()
+{
+    vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -1,17 +1,27 @@
 // Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
 #version 430 core
 
-layout(location = 0) in vec4 position;
+layout(location = 0) in vec4 vertex;
 
 uniform mat4 MV, MVP;
+
+#ifdef CLIP_PLANE
 uniform vec4 clipPlane;
+#endif
+
+// dequantisation of compact positions, identity for float positions
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
 
 out float depth;
 
 void main()
 {
+    vec4 position = vec4(positionOffset + positionScale * vertex.xyz, 1.0);
     vec4 cameraPos = MV * position;
     depth = cameraPos.z;
+#ifdef CLIP_PLANE
     gl_ClipDistance[0] = dot(position, clipPlane);
+#endif
     gl_Position = MVP * position;
 }
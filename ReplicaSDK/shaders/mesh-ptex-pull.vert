@@ -0,0 +1,102 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#version 430 core
+// generates two triangles and UVs per quad without a geometry shader,
+// vertices are fetched from the index buffer using gl_VertexID
+
+// float vec4 positions, or int16 xyzw when compactPositions is set
+layout(std430, binding = 3) readonly buffer MeshPositions
+{
+    uint meshPositions[];
+};
+
+// uint32 indices, or pairs of uint16 indices when shortIndices is set
+layout(std430, binding = 4) readonly buffer MeshIndices
+{
+    uint meshIndices[];
+};
+
+#ifdef CLUSTERS
+// maps faces in cluster order back to atlas / adjacency faces
+layout(std430, binding = 2) readonly buffer FaceRemap
+{
+    uint faceRemap[];
+};
+#endif
+
+uniform mat4 MVP;
+
+#ifdef CLIP_PLANE
+uniform vec4 clipPlane;
+#endif
+
+uniform bool compactPositions;
+uniform bool shortIndices;
+
+// dequantisation of compact positions, identity for float positions
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+
+out vec2 uv;
+flat out int faceID;
+
+#ifdef DEPTH
+// depth prepass, see mesh-depth.vert
+uniform mat4 MV;
+out float depth;
+#endif
+
+// must match the other mesh passes for depth equal testing
+invariant gl_Position;
+
+// same triangles and vertex order as the strip emitted by mesh-ptex.geom
+const int triangleCorners[6] = int[6](1, 0, 2, 2, 0, 3);
+const vec2 cornerUVs[4] = vec2[4](vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0));
+
+uint FetchIndex(int i)
+{
+    if (shortIndices)
+    {
+        return bitfieldExtract(meshIndices[i / 2], (i & 1) * 16, 16);
+    }
+    return meshIndices[i];
+}
+
+vec3 FetchPosition(uint v)
+{
+    if (compactPositions)
+    {
+        uint xy = meshPositions[v * 2];
+        uint z = meshPositions[v * 2 + 1];
+        return vec3(bitfieldExtract(int(xy), 0, 16),
+                    bitfieldExtract(int(xy), 16, 16),
+                    bitfieldExtract(int(z), 0, 16));
+    }
+    return uintBitsToFloat(uvec3(meshPositions[v * 4],
+                                 meshPositions[v * 4 + 1],
+                                 meshPositions[v * 4 + 2]));
+}
+
+void main()
+{
+    int face = gl_VertexID / 6;
+    int corner = triangleCorners[gl_VertexID % 6];
+
+    vec3 vertex = FetchPosition(FetchIndex(face * 4 + corner));
+    vec4 position = vec4(positionOffset + positionScale * vertex, 1.0);
+
+#ifdef CLUSTERS
+    faceID = int(faceRemap[face]);
+#else
+    faceID = face;
+#endif
+    uv = cornerUVs[corner];
+
+#ifdef DEPTH
+    depth = (MV * position).z;
+#endif
+
+#ifdef CLIP_PLANE
+    gl_ClipDistance[0] = dot(position, clipPlane);
+#endif
+    gl_Position = MVP * position;
+}
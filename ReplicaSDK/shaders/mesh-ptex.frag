@@ -1,21 +1,71 @@
 // Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
 #version 430 core
+// variants: TONE_MAP applies exposure, gamma and saturation, otherwise the
+// atlas colour is output as stored. MRT adds the outputs after FragColor.
 #include "atlas.glsl"
 
 layout(location = 0) out vec4 FragColor;
 layout(binding = 0) uniform sampler2D atlasTex;
 
+#ifdef TONE_MAP
 uniform float exposure;
 uniform float gamma;
 uniform float saturation;
+#endif
+
+#ifdef MRT
+layout(location = 1) out vec4 DepthColor;
+
+// linear colour before exposure, gamma and saturation, for HDR output
+layout(location = 2) out vec4 HdrColor;
+
+// further exposure, gamma and saturation variants of the colour
+#define MAX_BRACKETS 5
+layout(location = 3) out vec4 BracketColor[MAX_BRACKETS];
+
+uniform float depthScale;
+
+uniform int numBrackets;
+uniform vec3 brackets[MAX_BRACKETS]; // exposure, 1 / gamma and saturation
+#endif
 
 in vec2 uv;
 
-void main()
+#ifdef VERTEX_PULLING
+flat in int faceID;
+#else
+#define faceID gl_PrimitiveID
+#endif
+
+vec4 ToneMap(vec4 c, float exposure, float gamma, float saturation)
 {
-    vec4 c = textureAtlas(atlasTex, gl_PrimitiveID, uv * tileSize);
     c *= exposure;
     applySaturation(c, saturation);
     c.rgb = pow(c.rgb, vec3(gamma));
+    return vec4(c.rgb, 1.0f);
+}
+
+void main()
+{
+    vec4 c = textureAtlas(atlasTex, faceID, uv * tileSize);
+#ifdef TONE_MAP
+    FragColor = ToneMap(c, exposure, gamma, saturation);
+#else
     FragColor = vec4(c.rgb, 1.0f);
+#endif
+
+#ifdef MRT
+    HdrColor = vec4(c.rgb, 1.0f);
+
+    for (int i = 0; i < MAX_BRACKETS; i++)
+    {
+        if (i < numBrackets)
+        {
+            BracketColor[i] = ToneMap(c, brackets[i].x, brackets[i].y, brackets[i].z);
+        }
+    }
+
+    // 1/w is the camera depth, as output by mesh-depth
+    DepthColor = vec4(vec3(depthScale / gl_FragCoord.w), 1.0f);
+#endif
 }
@@ -1,13 +1,61 @@
 // Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
 #version 430 core
 
-layout(location = 0) in vec4 position;
+layout(location = 0) in vec4 vertex;
+
+#ifdef CLUSTERS
+// first face of the cluster being drawn, per instance
+layout(location = 1) in uint clusterFace;
+flat out uint vClusterFace;
+#endif
+
+#ifdef LAYERED
+// transforms of each view, rendered to the layer of the same index
+struct View
+{
+    mat4 MVP;
+    vec4 clipPlane;
+};
+
+layout(std430, binding = 5) readonly buffer Views
+{
+    View views[];
+};
+
+// view drawn by the instance
+layout(location = 2) in uint view;
+flat out uint vView;
+#endif
 
 uniform mat4 MVP;
+
+#ifdef CLIP_PLANE
 uniform vec4 clipPlane;
+#endif
+
+// dequantisation of compact positions, identity for float positions
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+
+// must match the depth prepass for depth equal testing
+invariant gl_Position;
 
 void main()
 {
+    vec4 position = vec4(positionOffset + positionScale * vertex.xyz, 1.0);
+#ifdef CLUSTERS
+    vClusterFace = clusterFace;
+#endif
+#ifdef LAYERED
+    vView = view;
+#ifdef CLIP_PLANE
+    gl_ClipDistance[0] = dot(position, views[view].clipPlane);
+#endif
+    gl_Position = views[view].MVP * position;
+#else
+#ifdef CLIP_PLANE
     gl_ClipDistance[0] = dot(position, clipPlane);
+#endif
     gl_Position = MVP * position;
+#endif
 }
@@ -0,0 +1,18 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#version 430 core
+
+layout(binding = 1) uniform sampler2D maskTex;
+
+in block
+{
+    vec2 texCoord;
+    vec3 normal;
+    vec3 eyeSpacePos;
+    noperspective vec2 screenCoord;
+} In;
+
+void main()
+{
+    if (texture(maskTex, In.texCoord).x < 0.5)
+        discard;
+}
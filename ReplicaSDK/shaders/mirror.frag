@@ -2,12 +2,20 @@
 #version 430 core
 
 layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 DepthColor;
 
 layout(binding = 0) uniform sampler2D reflectionTex;
 layout(binding = 1) uniform sampler2D maskTex;
+layout(binding = 2) uniform sampler2D reflectionDepthTex;
 
 uniform float reflectivity;
 uniform vec2 texSize;
+uniform vec2 screenSize;
+
+// pixel min and max corners of the mirror on screen and of its reflection in
+// the atlas
+uniform vec4 screenRect;
+uniform vec4 atlasRect;
 
 in block
 {
@@ -23,8 +31,19 @@ void main()
     vec3 v = normalize(In.eyeSpacePos);
     float fresnel = reflectivity + (1.0 - reflectivity) * pow(1.0 - abs(dot(n, v)), 5.0);
 
-    vec4 c = texture(reflectionTex, In.screenCoord);
+    vec2 p = (In.screenCoord * screenSize - screenRect.xy) / (screenRect.zw - screenRect.xy);
+    vec2 atlasCoord = mix(atlasRect.xy, atlasRect.zw, p);
+
+    // don't filter across into neighbouring reflections
+    atlasCoord = clamp(atlasCoord, atlasRect.xy + 0.5, atlasRect.zw - 0.5);
+
+    vec4 c = texture(reflectionTex, atlasCoord / texSize);
     float mask = texture(maskTex, In.texCoord).x;
 
     FragColor = vec4(c.rgb, fresnel * mask);
+
+    // reflected depth replaces depth inside the mask, blending would mix
+    // unrelated distances
+    float d = texelFetch(reflectionDepthTex, ivec2(atlasCoord), 0).x;
+    DepthColor = vec4(vec3(d), mask < 0.5 ? 0.0 : 1.0);
 }
@@ -0,0 +1,25 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#version 430 core
+// copies each atlas tile into one with a border of one texel on every side,
+// filled from the adjacent faces as textureAtlas fetches them, see
+// PTexMeshOptions::padAtlases. Tiles keep their position in the grid.
+#include "atlas.glsl"
+
+layout(location = 0) out vec4 FragColor;
+layout(binding = 0) uniform sampler2D atlasTex;
+
+uniform int numFaces;
+
+void main()
+{
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    ivec2 tile = p / (tileSize + 2);
+    int face = tile.y * widthInTiles + tile.x;
+
+    if (face >= numFaces)
+    {
+        discard;
+    }
+
+    FragColor = texelFetchAtlasAdj(atlasTex, face, p - tile * (tileSize + 2) - 1);
+}
@@ -0,0 +1,47 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#version 430 core
+// resamples six cube faces to an equirectangular panorama
+
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 DepthColor;
+
+layout(binding = 0) uniform sampler2DArray faceTex;
+layout(binding = 1) uniform sampler2DArray faceDepthTex;
+
+// projection times rotation of each face from the panorama camera
+uniform mat4 faces[6];
+uniform vec2 size;
+
+const float PI = 3.14159265358979;
+
+void main()
+{
+    // top row first, the centre column looking along the camera's z axis
+    vec2 p = gl_FragCoord.xy / size;
+    float lon = (2.0 * p.x - 1.0) * PI;
+    float lat = (0.5 - p.y) * PI;
+    vec4 ray = vec4(cos(lat) * sin(lon), -sin(lat), cos(lat) * cos(lon), 1.0);
+
+    // w is the depth along the face's view direction, largest for the face
+    // the ray passes through
+    int face = 0;
+    vec4 clip = faces[0] * ray;
+    for (int i = 1; i < 6; i++)
+    {
+        vec4 c = faces[i] * ray;
+        if (c.w > clip.w)
+        {
+            face = i;
+            clip = c;
+        }
+    }
+
+    vec2 uv = clip.xy / clip.w * 0.5 + 0.5;
+    FragColor = vec4(texture(faceTex, vec3(uv, face)).rgb, 1.0);
+
+    // camera depth of the face to distance along the unit length ray
+    ivec2 faceSize = textureSize(faceTex, 0).xy;
+    ivec2 texel = clamp(ivec2(uv * faceSize), ivec2(0), faceSize - 1);
+    float depth = texelFetch(faceDepthTex, ivec3(texel, face), 0).r;
+    DepthColor = vec4(vec3(depth / clip.w), 1.0);
+}
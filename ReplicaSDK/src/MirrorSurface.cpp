@@ -1,5 +1,114 @@
 // Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
 #include "MirrorSurface.h"
+#include "DiskCache.h"
+
+#include <Eigen/LU>
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace {
+
+// Vertical samples per mask row, coverage along each is exact
+constexpr int kSubScanlines = 8;
+
+// Changing the rasteriser invalidates cached masks
+constexpr uint64_t kMaskVersion = 1;
+
+// Scanline polygon fill with the even-odd rule, antialiased by the area of
+// each pixel covered on a number of sub-scanlines
+class MaskRasteriser {
+ public:
+  MaskRasteriser(const std::vector<Eigen::Vector2f>& polygon, const int w, const int h)
+      : width(w), rowEdges(h) {
+    for (size_t i = 0; i < polygon.size(); i++) {
+      const Eigen::Vector2f& a = polygon[i];
+      const Eigen::Vector2f& b = polygon[(i + 1) % polygon.size()];
+
+      // horizontal edges never cross a sub-scanline
+      if (a(1) == b(1))
+        continue;
+
+      Edge edge;
+      const bool down = a(1) < b(1);
+      edge.y0 = down ? a(1) : b(1);
+      edge.y1 = down ? b(1) : a(1);
+      edge.x0 = down ? a(0) : b(0);
+      edge.dxdy = (b(0) - a(0)) / (b(1) - a(1));
+
+      const int rowBegin = std::max(0, (int)std::floor(edge.y0));
+      const int rowEnd = std::min(h, (int)std::ceil(edge.y1));
+      for (int y = rowBegin; y < rowEnd; y++) {
+        rowEdges[y].push_back(edges.size());
+      }
+      edges.push_back(edge);
+    }
+  }
+
+  void Row(const int y, uint8_t* out) const {
+    // partial coverage of span ends, and fully covered runs as differences
+    std::vector<float> coverage(width + 1, 0.0f);
+    std::vector<float> runs(width + 1, 0.0f);
+    std::vector<float> crossings;
+
+    const float weight = 1.0f / kSubScanlines;
+
+    for (int s = 0; s < kSubScanlines; s++) {
+      const float sy = y + (s + 0.5f) / kSubScanlines;
+
+      crossings.clear();
+      for (const size_t e : rowEdges[y]) {
+        const Edge& edge = edges[e];
+        if (sy >= edge.y0 && sy < edge.y1) {
+          crossings.push_back(edge.x0 + (sy - edge.y0) * edge.dxdy);
+        }
+      }
+      std::sort(crossings.begin(), crossings.end());
+
+      for (size_t i = 0; i + 1 < crossings.size(); i += 2) {
+        const float a = std::max(crossings[i], 0.0f);
+        const float b = std::min(crossings[i + 1], (float)width);
+        if (a >= b)
+          continue;
+
+        const int ia = (int)a;
+        const int ib = (int)b;
+
+        if (ia == ib) {
+          coverage[ia] += (b - a) * weight;
+        } else {
+          coverage[ia] += (ia + 1 - a) * weight;
+          runs[ia + 1] += weight;
+          runs[ib] -= weight;
+          coverage[ib] += (b - ib) * weight;
+        }
+      }
+    }
+
+    float run = 0.0f;
+    for (int x = 0; x < width; x++) {
+      run += runs[x];
+      const float c = std::min(1.0f, std::max(0.0f, run + coverage[x]));
+      out[x] = (uint8_t)(c * 255.0f + 0.5f);
+    }
+  }
+
+ private:
+  struct Edge {
+    float y0, y1; // y0 < y1
+    float x0; // x at y0
+    float dxdy;
+  };
+
+  int width;
+  std::vector<Edge> edges;
+  std::vector<std::vector<size_t>> rowEdges;
+};
+
+} // namespace
 
 // create Eigen matrix from Json
 inline Eigen::MatrixXd EigenMatrixFromJson(const picojson::value& json) {
@@ -83,45 +192,133 @@ Eigen::Matrix<float, 2, 4> MirrorSurface::T_manifold_plane() const {
   return T_mani_plane;
 }
 
-bool MirrorSurface::InBoundary(const Eigen::Vector4f& p_w) {
-  Eigen::Vector2f pointInMani = (T_mani_plane * p_w).head<2>();
+std::vector<Eigen::Vector2f> MirrorSurface::MaskBoundary(int w, int h) const {
+  // mask pixel (x, y) samples the bilinear interpolation of the bounding rect
+  // corners at u = 1 - x / w, v = 1 - y / h, which is affine for a rectangle
+  std::vector<Eigen::Vector2f> rect_mani;
+  for (size_t i = 0; i < bounding_rect_w.size(); i++) {
+    rect_mani.push_back(T_mani_plane * Unproject(bounding_rect_w[i]));
+  }
 
-  int v, u;
+  auto pointAt = [&](float x, float y) -> Eigen::Vector2f {
+    const float u = 1.0f - x / w;
+    const float v = 1.0f - y / h;
+    const Eigen::Vector2f p0 = u * rect_mani[0] + (1.0f - u) * rect_mani[1];
+    const Eigen::Vector2f p1 = u * rect_mani[2] + (1.0f - u) * rect_mani[3];
+    const Eigen::Vector2f p_mani = v * p0 + (1.0f - v) * p1;
+    const Eigen::Vector3f p_w = T_plane_mani * Unproject(p_mani);
+    return T_mani_plane * Unproject(p_w);
+  };
 
-  bool inBoundary = false;
+  const Eigen::Vector2f origin = pointAt(0.0f, 0.0f);
+  Eigen::Matrix2f A;
+  A.col(0) = pointAt(w, 0.0f) - origin;
+  A.col(1) = pointAt(0.0f, h) - origin;
+  A.col(0) /= w;
+  A.col(1) /= h;
 
-  int nVert = boundary_mani.size();
-  for (v = 0, u = nVert - 1; v < nVert; u = v++) {
-    if (((boundary_mani[v](1) > pointInMani(1)) != (boundary_mani[u](1) > pointInMani(1))) &&
-        (pointInMani(0) < (boundary_mani[u](0) - boundary_mani[v](0)) *
-                 (pointInMani(1) - boundary_mani[v](1)) /
-                 (boundary_mani[u](1) - boundary_mani[v](1)) +
-             boundary_mani[v](0))) {
-      inBoundary = !inBoundary;
-    }
+  std::vector<Eigen::Vector2f> boundary;
+  if (std::abs(A.determinant()) < 1e-12f)
+    return boundary;
+
+  const Eigen::Matrix2f Ainv = A.inverse();
+  for (const Eigen::Vector2f& p : boundary_mani) {
+    boundary.push_back(Ainv * (p - origin));
   }
 
-  return inBoundary;
+  return boundary;
 }
 
-void MirrorSurface::GenerateMask(pangolin::ManagedImage<float>& image, int w, int h) {
-  std::vector<Eigen::Vector2f> bounding_rect_mani;
+void MirrorSurface::GenerateMask(pangolin::ManagedImage<uint8_t>& image, int w, int h) const {
+  image.Reinitialise(w, h);
+  const MaskRasteriser rasteriser(MaskBoundary(w, h), w, h);
 
-  for (size_t i = 0; i < bounding_rect_w.size(); i++) {
-    bounding_rect_mani.push_back(T_mani_plane * Unproject(bounding_rect_w[i]));
+#pragma omp parallel for schedule(dynamic)
+  for (int y = 0; y < h; y++) {
+    rasteriser.Row(y, image.RowPtr(y));
   }
+}
 
-  image.Reinitialise(w, h);
+std::string DefaultMaskCacheDir() {
+  return CacheDir();
+}
 
-  for (int y = 0; y < h; y++) {
-    for (int x = 0; x < w; x++) {
-      const float u = 1.0f - ((x + 0.5f) / (float)w);
-      const float v = 1.0f - ((y + 0.5f) / (float)h);
-      const Eigen::Vector2f p0 = u * bounding_rect_mani[0] + (1.0f - u) * bounding_rect_mani[1];
-      const Eigen::Vector2f p1 = u * bounding_rect_mani[2] + (1.0f - u) * bounding_rect_mani[3];
-      const Eigen::Vector2f p_mani = v * p0 + (1.0f - v) * p1;
-      const Eigen::Vector3f p_w = T_plane_mani * Unproject(p_mani);
-      image(x, y) = InBoundary(Eigen::Vector4f(p_w(0), p_w(1), p_w(2), 1.0f)) ? 1.0f : 0.0f;
+std::vector<pangolin::ManagedImage<uint8_t>> LoadOrGenerateMasks(
+    const std::vector<MirrorSurface>& surfaces,
+    const std::string& surfaceFile,
+    int w,
+    int h,
+    const std::string& cacheDir) {
+  std::vector<pangolin::ManagedImage<uint8_t>> masks(surfaces.size());
+  for (size_t i = 0; i < surfaces.size(); i++) {
+    masks[i].Reinitialise(w, h);
+  }
+
+  if (surfaces.empty())
+    return masks;
+
+  const size_t maskBytes = size_t(w) * h;
+
+  std::string cacheFile;
+  if (!cacheDir.empty() && !surfaceFile.empty()) {
+    std::ifstream file(surfaceFile, std::ios::binary);
+    const std::string contents(
+        (std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    char key[64];
+    snprintf(
+        key,
+        sizeof(key),
+        "masks-%016" PRIx64 "-%dx%d.bin",
+        Fnv1a(kFnv1aBasis ^ kMaskVersion, contents),
+        w,
+        h);
+    cacheFile = cacheDir + "/" + key;
+
+    std::ifstream cached(cacheFile, std::ios::binary);
+    if (cached) {
+      for (size_t i = 0; i < masks.size(); i++) {
+        cached.read((char*)masks[i].ptr, maskBytes);
+      }
+
+      // a short or long file is stale, regenerate
+      if (cached && cached.peek() == std::char_traits<char>::eof()) {
+        std::cout << "Loaded mirror masks from " << cacheFile << std::endl;
+        return masks;
+      }
     }
   }
+
+  std::cout << "Generating mirror masks... ";
+  std::cout.flush();
+
+  std::vector<MaskRasteriser> rasterisers;
+  for (const MirrorSurface& surface : surfaces) {
+    rasterisers.emplace_back(surface.MaskBoundary(w, h), w, h);
+  }
+
+  // rows of all masks are shared out together so one large mask doesn't
+  // leave threads idle
+  const int numRows = surfaces.size() * h;
+
+#pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < numRows; i++) {
+    rasterisers[i / h].Row(i % h, masks[i / h].RowPtr(i % h));
+  }
+
+  std::cout << "done" << std::endl;
+
+  if (!cacheFile.empty()) {
+    const bool cached = WriteCacheFile(cacheFile, [&](std::ostream& out) {
+      for (size_t i = 0; i < masks.size(); i++) {
+        out.write((const char*)masks[i].ptr, maskBytes);
+      }
+    });
+
+    if (!cached) {
+      std::cout << "Can't cache mirror masks in " << cacheDir << std::endl;
+    }
+  }
+
+  return masks;
 }
@@ -0,0 +1,454 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// C interface, see Replica.h. Each batch is one RenderViews pass into a
+// ViewArray, copied to pixel buffers of its own behind a fence so the caller
+// can queue further batches before reading it back.
+#include <EGL.h>
+#include <PTexLib.h>
+#include <Replica.h>
+#include <ViewArray.h>
+
+#include "GLCheck.h"
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <stdexcept>
+
+namespace {
+
+thread_local std::string lastError;
+
+ReplicaStatus Fail(const ReplicaStatus status, const std::string& message) {
+  lastError = message;
+  return status;
+}
+
+struct PixelBuffer {
+  GLuint id = 0;
+  size_t bytes = 0;
+};
+
+} // namespace
+
+struct ReplicaContext {
+  std::unique_ptr<EGLCtx> egl;
+
+  // kept while batches have the same size and number of views
+  std::unique_ptr<ViewArray> views;
+
+  // pixel buffers of completed batches, for reuse
+  std::vector<PixelBuffer> freeBuffers;
+
+  std::set<ReplicaScene*> scenes;
+  std::set<ReplicaBatch*> batches;
+};
+
+struct ReplicaScene {
+  ReplicaContext* context;
+  std::unique_ptr<PTexMesh> mesh;
+};
+
+struct ReplicaBatch {
+  ReplicaContext* context;
+  int width;
+  int height;
+  std::vector<ReplicaOutput> outputs;
+
+  // all views of the batch one after another, id 0 when no view wants them
+  PixelBuffer colour;
+  PixelBuffer depth;
+  GLsync fence = 0;
+};
+
+namespace {
+
+// Smallest free buffer of at least bytes, or a new one
+PixelBuffer AcquireBuffer(ReplicaContext* context, const size_t bytes) {
+  std::vector<PixelBuffer>& pool = context->freeBuffers;
+
+  auto best = pool.end();
+  for (auto it = pool.begin(); it != pool.end(); ++it) {
+    if (it->bytes >= bytes && (best == pool.end() || it->bytes < best->bytes)) {
+      best = it;
+    }
+  }
+
+  if (best != pool.end()) {
+    const PixelBuffer buffer = *best;
+    pool.erase(best);
+    return buffer;
+  }
+
+  PixelBuffer buffer;
+  buffer.bytes = bytes;
+  glGenBuffers(1, &buffer.id);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer.id);
+  glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  return buffer;
+}
+
+// Starts copying every layer of an array texture into a pixel buffer
+PixelBuffer StartDownload(
+    ReplicaContext* context,
+    const GLuint texture,
+    const GLenum format,
+    const GLenum type,
+    const size_t bytes) {
+  PixelBuffer buffer = AcquireBuffer(context, bytes);
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer.id);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+  glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, format, type, 0);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  return buffer;
+}
+
+// Copies the rows of each view from a pixel buffer to the colour or depth
+// images of the outputs wanting them, false if the buffer can't be mapped
+bool CopyViews(const ReplicaBatch& batch, const PixelBuffer& buffer, const bool depth) {
+  const size_t rowBytes = (size_t)batch.width * 4;
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer.id);
+  const uint8_t* pixels = (const uint8_t*)glMapBufferRange(
+      GL_PIXEL_PACK_BUFFER, 0, rowBytes * batch.height * batch.outputs.size(), GL_MAP_READ_BIT);
+  if (!pixels) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return false;
+  }
+
+  for (size_t i = 0; i < batch.outputs.size(); i++) {
+    const ReplicaOutput& output = batch.outputs[i];
+    uint8_t* dst = depth ? (uint8_t*)output.depth : output.colour;
+    if (!dst) {
+      continue;
+    }
+
+    const size_t stride = depth ? output.depth_stride : output.colour_stride;
+    const size_t dstStride = stride ? stride : rowBytes;
+    const uint8_t* src = pixels + i * rowBytes * batch.height;
+
+    if (dstStride == rowBytes) {
+      std::memcpy(dst, src, rowBytes * batch.height);
+    } else {
+      for (int y = 0; y < batch.height; y++) {
+        std::memcpy(dst + y * dstStride, src + y * rowBytes, rowBytes);
+      }
+    }
+  }
+
+  glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  return true;
+}
+
+// Makes the context current on the calling thread, as another one created
+// since may be
+void Bind(ReplicaContext* context) {
+  if (!context->egl->IsCurrent()) {
+    context->egl->MakeCurrent();
+  }
+}
+
+// Returns the batch's buffers to the pool and frees it
+void FreeBatch(ReplicaBatch* batch) {
+  ReplicaContext* context = batch->context;
+
+  glDeleteSync(batch->fence);
+  for (const PixelBuffer& buffer : {batch->colour, batch->depth}) {
+    if (buffer.id) {
+      context->freeBuffers.push_back(buffer);
+    }
+  }
+
+  context->batches.erase(batch);
+  delete batch;
+}
+
+} // namespace
+
+int replica_api_version(void) {
+  return REPLICA_API_VERSION;
+}
+
+const char* replica_last_error(void) {
+  return lastError.c_str();
+}
+
+ReplicaStatus
+replica_context_create(const char* drm_node, int32_t device_index, ReplicaContext** context) {
+  if (!context) {
+    return Fail(REPLICA_INVALID_ARGUMENT, "context is NULL");
+  }
+  *context = nullptr;
+
+  try {
+    EGLOptions options;
+    if (drm_node) {
+      options.drmNode = drm_node;
+    }
+    options.deviceIndex = device_index;
+
+    std::unique_ptr<ReplicaContext> result(new ReplicaContext());
+    result->egl.reset(new EGLCtx(options));
+
+    if (!checkGLVersion()) {
+      return Fail(REPLICA_ERROR, "Insufficient OpenGL version");
+    }
+
+    // as ReplicaRenderer, and no depth where the background is cleared
+    glFrontFace(GL_CCW);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    *context = result.release();
+    return REPLICA_OK;
+  } catch (const std::invalid_argument& e) {
+    return Fail(REPLICA_INVALID_ARGUMENT, e.what());
+  } catch (const std::exception& e) {
+    return Fail(REPLICA_ERROR, e.what());
+  } catch (...) {
+    return Fail(REPLICA_ERROR, "Unknown error");
+  }
+}
+
+void replica_context_destroy(ReplicaContext* context) {
+  if (!context) {
+    return;
+  }
+
+  try {
+    Bind(context);
+
+    while (!context->batches.empty()) {
+      FreeBatch(*context->batches.begin());
+    }
+    for (ReplicaScene* scene : context->scenes) {
+      delete scene;
+    }
+    for (const PixelBuffer& buffer : context->freeBuffers) {
+      glDeleteBuffers(1, &buffer.id);
+    }
+    context->views.reset();
+
+    delete context;
+  } catch (const std::exception& e) {
+    Fail(REPLICA_ERROR, e.what());
+  } catch (...) {
+    Fail(REPLICA_ERROR, "Unknown error");
+  }
+}
+
+ReplicaStatus replica_scene_open(
+    ReplicaContext* context,
+    const char* mesh_file,
+    const char* atlas_folder,
+    ReplicaScene** scene) {
+  if (!context || !mesh_file || !atlas_folder || !scene) {
+    return Fail(REPLICA_INVALID_ARGUMENT, "NULL argument");
+  }
+  *scene = nullptr;
+
+  try {
+    if (!pangolin::FileExists(mesh_file)) {
+      return Fail(REPLICA_INVALID_ARGUMENT, std::string("No mesh ") + mesh_file);
+    }
+    if (!pangolin::FileExists(std::string(atlas_folder) + "/parameters.json")) {
+      return Fail(REPLICA_INVALID_ARGUMENT, std::string("No atlases in ") + atlas_folder);
+    }
+
+    Bind(context);
+
+    std::unique_ptr<ReplicaScene> result(new ReplicaScene());
+    result->context = context;
+    result->mesh.reset(new PTexMesh(mesh_file, atlas_folder));
+    result->mesh->SetDepthOutputScale(1.0f);
+    result->mesh->SetExtraOutputs(true); // ViewArray depth output
+
+    *scene = result.release();
+    context->scenes.insert(*scene);
+    return REPLICA_OK;
+  } catch (const std::exception& e) {
+    return Fail(REPLICA_ERROR, e.what());
+  } catch (...) {
+    return Fail(REPLICA_ERROR, "Unknown error");
+  }
+}
+
+void replica_scene_close(ReplicaScene* scene) {
+  if (!scene) {
+    return;
+  }
+
+  try {
+    Bind(scene->context);
+    scene->context->scenes.erase(scene);
+    delete scene;
+  } catch (const std::exception& e) {
+    Fail(REPLICA_ERROR, e.what());
+  } catch (...) {
+    Fail(REPLICA_ERROR, "Unknown error");
+  }
+}
+
+ReplicaStatus replica_scene_set_exposure(ReplicaScene* scene, float exposure) {
+  if (!scene || !(exposure > 0.0f)) {
+    return Fail(REPLICA_INVALID_ARGUMENT, "NULL scene or exposure not positive");
+  }
+
+  try {
+    scene->mesh->SetExposure(exposure);
+    return REPLICA_OK;
+  } catch (const std::exception& e) {
+    return Fail(REPLICA_ERROR, e.what());
+  } catch (...) {
+    return Fail(REPLICA_ERROR, "Unknown error");
+  }
+}
+
+ReplicaStatus replica_render(
+    ReplicaScene* scene,
+    const ReplicaView* views,
+    const ReplicaOutput* outputs,
+    uint32_t num_views,
+    uint32_t width,
+    uint32_t height,
+    float z_near,
+    float z_far,
+    ReplicaBatch** batch) {
+  if (!scene || !views || !outputs || !batch) {
+    return Fail(REPLICA_INVALID_ARGUMENT, "NULL argument");
+  }
+  *batch = nullptr;
+
+  if (num_views == 0 || width == 0 || height == 0) {
+    return Fail(REPLICA_INVALID_ARGUMENT, "No views or empty views");
+  }
+  if (!(z_near > 0.0f && z_far > z_near)) {
+    return Fail(REPLICA_INVALID_ARGUMENT, "Need 0 < z_near < z_far");
+  }
+
+  try {
+    ReplicaContext* context = scene->context;
+    Bind(context);
+
+    GLint maxLayers = 0;
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    if (num_views > (uint32_t)maxLayers || width > (uint32_t)maxSize ||
+        height > (uint32_t)maxSize) {
+      return Fail(
+          REPLICA_INVALID_ARGUMENT,
+          "At most " + std::to_string(maxLayers) + " views of " + std::to_string(maxSize) + "x" +
+              std::to_string(maxSize) + " per batch");
+    }
+
+    std::unique_ptr<ViewArray>& array = context->views;
+    if (!array || array->Width() != (int)width || array->Height() != (int)height ||
+        array->NumViews() != (int)num_views) {
+      array.reset(new ViewArray(width, height, num_views, true));
+    }
+
+    std::vector<pangolin::OpenGlRenderState> cams;
+    cams.reserve(num_views);
+    for (uint32_t i = 0; i < num_views; i++) {
+      const ReplicaView& view = views[i];
+      cams.emplace_back(
+          pangolin::ProjectionMatrixRDF_BottomLeft(
+              width, height, view.fx, view.fy, view.cx, view.cy, z_near, z_far),
+          Eigen::Matrix4d(Eigen::Map<const Eigen::Matrix4d>(view.T_camera_world)));
+    }
+
+    array->Bind();
+    glEnable(GL_CULL_FACE);
+    scene->mesh->RenderViews(cams);
+    glDisable(GL_CULL_FACE);
+    array->Unbind();
+
+    std::unique_ptr<ReplicaBatch> result(new ReplicaBatch());
+    result->context = context;
+    result->width = width;
+    result->height = height;
+    result->outputs.assign(outputs, outputs + num_views);
+
+    const bool wantColour = std::any_of(
+        outputs, outputs + num_views, [](const ReplicaOutput& o) { return o.colour != nullptr; });
+    const bool wantDepth = std::any_of(
+        outputs, outputs + num_views, [](const ReplicaOutput& o) { return o.depth != nullptr; });
+
+    // RGBA8 and R32F are both 4 bytes a pixel
+    if (wantColour) {
+      result->colour = StartDownload(
+          context, array->Texture(), GL_RGBA, GL_UNSIGNED_BYTE, array->SizeBytes());
+    }
+    if (wantDepth) {
+      result->depth =
+          StartDownload(context, array->DepthTexture(), GL_RED, GL_FLOAT, array->SizeBytes());
+    }
+
+    // flushed so the GPU starts on the batch while the caller carries on
+    result->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    *batch = result.release();
+    context->batches.insert(*batch);
+    return REPLICA_OK;
+  } catch (const std::exception& e) {
+    return Fail(REPLICA_ERROR, e.what());
+  } catch (...) {
+    return Fail(REPLICA_ERROR, "Unknown error");
+  }
+}
+
+ReplicaStatus replica_batch_wait(ReplicaBatch* batch, uint64_t timeout_ns) {
+  if (!batch) {
+    return Fail(REPLICA_INVALID_ARGUMENT, "NULL batch");
+  }
+
+  try {
+    Bind(batch->context);
+
+    switch (glClientWaitSync(batch->fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout_ns)) {
+      case GL_ALREADY_SIGNALED:
+      case GL_CONDITION_SATISFIED:
+        break;
+      case GL_TIMEOUT_EXPIRED:
+        return REPLICA_NOT_READY;
+      default:
+        return Fail(REPLICA_ERROR, "glClientWaitSync failed");
+    }
+
+    if (batch->colour.id && !CopyViews(*batch, batch->colour, false)) {
+      return Fail(REPLICA_ERROR, "Can't map colour pixel buffer");
+    }
+    if (batch->depth.id && !CopyViews(*batch, batch->depth, true)) {
+      return Fail(REPLICA_ERROR, "Can't map depth pixel buffer");
+    }
+
+    FreeBatch(batch);
+    return REPLICA_OK;
+  } catch (const std::exception& e) {
+    return Fail(REPLICA_ERROR, e.what());
+  } catch (...) {
+    return Fail(REPLICA_ERROR, "Unknown error");
+  }
+}
+
+void replica_batch_cancel(ReplicaBatch* batch) {
+  if (!batch) {
+    return;
+  }
+
+  try {
+    Bind(batch->context);
+    FreeBatch(batch);
+  } catch (const std::exception& e) {
+    Fail(REPLICA_ERROR, e.what());
+  } catch (...) {
+    Fail(REPLICA_ERROR, "Unknown error");
+  }
+}
@@ -0,0 +1,372 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+#include "SyntheticMesh.h"
+#include "Assert.h"
+#include "PTexLib.h"
+
+#include <Eigen/Geometry>
+
+#include <cmath>
+#include <cstring>
+#include <experimental/filesystem>
+#include <fstream>
+#include <numeric>
+#include <random>
+
+namespace {
+
+// Parallelogram origin + [0, 1] u + [0, 1] v, facing along u x v
+struct Rect {
+  Eigen::Vector3f origin;
+  Eigen::Vector3f u;
+  Eigen::Vector3f v;
+  Eigen::Matrix<unsigned char, 4, 1> colour;
+};
+
+// Faces of the box between lo and hi, facing out or into the box
+void AddBox(
+    std::vector<Rect>& rects,
+    const Eigen::Vector3f& lo,
+    const Eigen::Vector3f& hi,
+    const Eigen::Matrix<unsigned char, 4, 1>& colour,
+    const bool inward,
+    const bool bottom) {
+  const Eigen::Vector3f ex(hi(0) - lo(0), 0, 0);
+  const Eigen::Vector3f ey(0, hi(1) - lo(1), 0);
+  const Eigen::Vector3f ez(0, 0, hi(2) - lo(2));
+
+  // outward facing
+  std::vector<Rect> faces = {{lo + ez, ex, ey, colour},
+                             {lo, ex, ez, colour},
+                             {lo + ey, ez, ex, colour},
+                             {lo, ez, ey, colour},
+                             {lo + ex, ey, ez, colour}};
+  if (bottom) {
+    faces.push_back({lo, ey, ex, colour});
+  }
+
+  for (Rect& face : faces) {
+    if (inward) {
+      std::swap(face.u, face.v);
+    }
+    rects.push_back(face);
+  }
+}
+
+// mt19937 output is fully specified, unlike the standard distributions
+float Uniform(std::mt19937& rng, const float lo, const float hi) {
+  return lo + (hi - lo) * float(rng() / 4294967296.0);
+}
+
+const Eigen::Vector3f kRoomSize(8.0f, 6.0f, 2.8f);
+
+picojson::value JsonVector(const Eigen::VectorXf& v) {
+  picojson::array a;
+  for (int i = 0; i < v.size(); i++) {
+    a.push_back(picojson::value((double)v(i)));
+  }
+  return picojson::value(a);
+}
+
+// One RGB atlas per submesh in the loader's face order, each tile the colour
+// of the first vertex of its face with a darker border
+void WriteAtlases(
+    const MeshData& mesh,
+    const std::string& folder,
+    const float splitSize,
+    const int tileSize) {
+  PTexMesh::MeshPartition partition;
+  if (splitSize > 0.0f) {
+    partition = PTexMesh::PartitionMesh(mesh, splitSize);
+  } else {
+    partition.faces.resize(mesh.ibo.size() / 4);
+    std::iota(partition.faces.begin(), partition.faces.end(), 0);
+    partition.chunkStart = {0, (uint32_t)partition.faces.size()};
+  }
+
+  for (size_t chunk = 0; chunk < partition.NumChunks(); chunk++) {
+    const size_t numFaces = partition.ChunkSize(chunk);
+    const size_t widthInTiles = std::ceil(std::sqrt((double)numFaces));
+    const size_t dim = widthInTiles * tileSize;
+
+    std::vector<Eigen::Matrix<unsigned char, 3, 1>> atlas(
+        dim * dim, Eigen::Matrix<unsigned char, 3, 1>::Zero());
+
+    for (size_t i = 0; i < numFaces; i++) {
+      const uint32_t face = partition.faces[partition.chunkStart[chunk] + i];
+      const Eigen::Matrix<unsigned char, 3, 1> colour = mesh.cbo[mesh.ibo[face * 4]].head<3>();
+      const Eigen::Matrix<unsigned char, 3, 1> border = colour / 2;
+
+      const size_t x0 = (i % widthInTiles) * tileSize;
+      const size_t y0 = (i / widthInTiles) * tileSize;
+      for (int y = 0; y < tileSize; y++) {
+        for (int x = 0; x < tileSize; x++) {
+          const bool edge = x == 0 || y == 0 || x == tileSize - 1 || y == tileSize - 1;
+          atlas[(y0 + y) * dim + x0 + x] = edge ? border : colour;
+        }
+      }
+    }
+
+    const std::string filename = folder + "/" + std::to_string(chunk) + "-color-ptex.rgb";
+    std::ofstream file(filename, std::ios::binary);
+    ASSERT(file.good(), "Can't write " + filename);
+    file.write((const char*)atlas.data(), atlas.size() * 3);
+  }
+}
+
+} // namespace
+
+MeshData GenerateRoomMesh(const size_t numQuads, const uint32_t seed) {
+  ASSERT(numQuads > 0);
+
+  std::mt19937 rng(seed);
+
+  std::vector<Rect> rects;
+  AddBox(rects, Eigen::Vector3f::Zero(), kRoomSize, {200, 200, 190, 255}, true, true);
+
+  // furniture standing on the floor
+  const int numBoxes = 12;
+  for (int i = 0; i < numBoxes; i++) {
+    const Eigen::Vector3f size(
+        Uniform(rng, 0.3f, 2.0f), Uniform(rng, 0.3f, 1.5f), Uniform(rng, 0.4f, 2.0f));
+    const Eigen::Vector3f lo(
+        Uniform(rng, 0.0f, kRoomSize(0) - size(0)),
+        Uniform(rng, 0.0f, kRoomSize(1) - size(1)),
+        0.0f);
+    const Eigen::Matrix<unsigned char, 4, 1> colour(
+        rng() % 256, rng() % 256, rng() % 256, 255);
+    AddBox(rects, lo, lo + size, colour, false, false);
+  }
+
+  float area = 0.0f;
+  for (const Rect& rect : rects) {
+    area += rect.u.cross(rect.v).norm();
+  }
+
+  const float quadSize = std::sqrt(area / numQuads);
+
+  // quads along u and v of each rect
+  std::vector<Eigen::Vector2i> divisions;
+  size_t numVertices = 0;
+  size_t numFaces = 0;
+  for (const Rect& rect : rects) {
+    const Eigen::Vector2i d(
+        std::max(1, (int)std::round(rect.u.norm() / quadSize)),
+        std::max(1, (int)std::round(rect.v.norm() / quadSize)));
+    divisions.push_back(d);
+    numVertices += (d(0) + 1) * (d(1) + 1);
+    numFaces += d(0) * d(1);
+  }
+
+  MeshData mesh(4);
+  mesh.vbo.Reinitialise(numVertices, 1);
+  mesh.nbo.Reinitialise(numVertices, 1);
+  mesh.cbo.Reinitialise(numVertices, 1);
+  mesh.ibo.Reinitialise(numFaces * 4, 1);
+
+  size_t vertex = 0;
+  size_t index = 0;
+  for (size_t r = 0; r < rects.size(); r++) {
+    const Rect& rect = rects[r];
+    const Eigen::Vector2i& d = divisions[r];
+    const Eigen::Vector3f normal = rect.u.cross(rect.v).normalized();
+    const uint32_t first = vertex;
+
+    for (int j = 0; j <= d(1); j++) {
+      for (int i = 0; i <= d(0); i++) {
+        const Eigen::Vector3f p =
+            rect.origin + rect.u * (float(i) / d(0)) + rect.v * (float(j) / d(1));
+        mesh.vbo[vertex] = Eigen::Vector4f(p(0), p(1), p(2), 1.0f);
+        mesh.nbo[vertex] = Eigen::Vector4f(normal(0), normal(1), normal(2), 1.0f);
+        mesh.cbo[vertex] = rect.colour;
+        vertex++;
+      }
+    }
+
+    // counter-clockwise seen from the front, as in the dataset
+    const uint32_t stride = d(0) + 1;
+    for (int j = 0; j < d(1); j++) {
+      for (int i = 0; i < d(0); i++) {
+        const uint32_t v0 = first + j * stride + i;
+        mesh.ibo[index++] = v0;
+        mesh.ibo[index++] = v0 + 1;
+        mesh.ibo[index++] = v0 + stride + 1;
+        mesh.ibo[index++] = v0 + stride;
+      }
+    }
+  }
+
+  return mesh;
+}
+
+void WritePLY(const MeshData& mesh, const std::string& filename) {
+  ASSERT(mesh.polygonStride == 3 || mesh.polygonStride == 4);
+
+  std::ofstream file(filename, std::ios::binary);
+  ASSERT(file.good(), "Can't write " + filename);
+
+  const size_t numVertices = mesh.vbo.size();
+  const size_t numFaces = mesh.ibo.size() / mesh.polygonStride;
+  const bool normals = mesh.nbo.IsValid();
+  const bool colours = mesh.cbo.IsValid();
+
+  file << "ply" << std::endl;
+  file << "format binary_little_endian 1.0" << std::endl;
+  file << "element vertex " << numVertices << std::endl;
+  file << "property float x" << std::endl;
+  file << "property float y" << std::endl;
+  file << "property float z" << std::endl;
+  if (normals) {
+    file << "property float nx" << std::endl;
+    file << "property float ny" << std::endl;
+    file << "property float nz" << std::endl;
+  }
+  if (colours) {
+    file << "property uchar red" << std::endl;
+    file << "property uchar green" << std::endl;
+    file << "property uchar blue" << std::endl;
+  }
+  file << "element face " << numFaces << std::endl;
+  file << "property list uchar int vertex_indices" << std::endl;
+  file << "end_header" << std::endl;
+
+  // written in blocks to bound the memory used for huge meshes
+  const size_t blockSize = 65536;
+  std::vector<char> block;
+
+  const size_t vertexBytes = 3 * sizeof(float) * (normals ? 2 : 1) + (colours ? 3 : 0);
+  for (size_t first = 0; first < numVertices; first += blockSize) {
+    const size_t count = std::min(blockSize, numVertices - first);
+    block.resize(count * vertexBytes);
+
+    char* out = block.data();
+    for (size_t i = first; i < first + count; i++) {
+      memcpy(out, mesh.vbo[i].data(), 3 * sizeof(float));
+      out += 3 * sizeof(float);
+      if (normals) {
+        memcpy(out, mesh.nbo[i].data(), 3 * sizeof(float));
+        out += 3 * sizeof(float);
+      }
+      if (colours) {
+        memcpy(out, mesh.cbo[i].data(), 3);
+        out += 3;
+      }
+    }
+    file.write(block.data(), block.size());
+  }
+
+  const size_t faceBytes = 1 + mesh.polygonStride * sizeof(uint32_t);
+  for (size_t first = 0; first < numFaces; first += blockSize) {
+    const size_t count = std::min(blockSize, numFaces - first);
+    block.resize(count * faceBytes);
+
+    char* out = block.data();
+    for (size_t f = first; f < first + count; f++) {
+      *out++ = (char)mesh.polygonStride;
+      memcpy(out, &mesh.ibo[f * mesh.polygonStride], mesh.polygonStride * sizeof(uint32_t));
+      out += mesh.polygonStride * sizeof(uint32_t);
+    }
+    file.write(block.data(), block.size());
+  }
+
+  ASSERT(file.good(), "Can't write " + filename);
+}
+
+void WriteParameters(const std::string& filename, const float splitSize, const int tileSize) {
+  picojson::object json;
+  json["splitSize"] = picojson::value((double)splitSize);
+  json["tileSize"] = picojson::value((int64_t)tileSize);
+
+  std::ofstream file(filename);
+  ASSERT(file.good(), "Can't write " + filename);
+  file << picojson::value(json).serialize(true);
+}
+
+picojson::value GenerateMirror(
+    const Eigen::Vector3f& centre,
+    const Eigen::Vector3f& u,
+    const Eigen::Vector3f& v,
+    const float rx,
+    const float ry,
+    const uint32_t seed) {
+  std::mt19937 rng(seed);
+  const Eigen::Vector3f normal = u.cross(v);
+  const int numPoints = 256;
+
+  picojson::array boundary_mani;
+  picojson::array boundary_w;
+  for (int i = 0; i < numPoints; i++) {
+    const float a = 2.0f * M_PI * i / numPoints;
+    const float r = 1.0f + 0.05f * std::sin(7.0f * a) + Uniform(rng, -0.01f, 0.01f);
+    const Eigen::Vector2f p(rx * r * std::cos(a), ry * r * std::sin(a));
+    boundary_mani.push_back(JsonVector(p));
+    boundary_w.push_back(JsonVector(centre + p(0) * u + p(1) * v));
+  }
+
+  picojson::array bounding_rect_w;
+  for (const Eigen::Vector2f& corner : {Eigen::Vector2f(-1, -1),
+                                        Eigen::Vector2f(1, -1),
+                                        Eigen::Vector2f(-1, 1),
+                                        Eigen::Vector2f(1, 1)}) {
+    bounding_rect_w.push_back(
+        JsonVector(centre + 1.1f * (rx * corner(0) * u + ry * corner(1) * v)));
+  }
+
+  // world to plane coordinates and back
+  picojson::array T_mani_plane;
+  T_mani_plane.push_back(JsonVector(Eigen::Vector4f(u(0), u(1), u(2), -u.dot(centre))));
+  T_mani_plane.push_back(JsonVector(Eigen::Vector4f(v(0), v(1), v(2), -v.dot(centre))));
+
+  picojson::array T_plane_mani;
+  for (int r = 0; r < 3; r++) {
+    T_plane_mani.push_back(JsonVector(Eigen::Vector3f(u(r), v(r), centre(r))));
+  }
+
+  picojson::object json;
+  json["centroid_w"] = JsonVector(centre);
+  json["plane_w"] = JsonVector(
+      Eigen::Vector4f(normal(0), normal(1), normal(2), -normal.dot(centre)));
+  json["T_mani_plane"] = picojson::value(T_mani_plane);
+  json["T_plane_mani"] = picojson::value(T_plane_mani);
+  json["boundary_mani"] = picojson::value(boundary_mani);
+  json["boundary_w"] = picojson::value(boundary_w);
+  json["bounding_rect_w"] = picojson::value(bounding_rect_w);
+  json["reflectivity"] = picojson::value(0.8);
+
+  return picojson::value(json);
+}
+
+void WriteSyntheticScene(
+    const std::string& folder,
+    const size_t numQuads,
+    const float splitSize,
+    const int tileSize) {
+  const std::string textures = folder + "/textures";
+  std::experimental::filesystem::create_directories(textures);
+
+  const MeshData mesh = GenerateRoomMesh(numQuads);
+  WritePLY(mesh, folder + "/mesh.ply");
+  WriteAtlases(mesh, textures, splitSize, tileSize);
+  WriteParameters(textures + "/parameters.json", splitSize, tileSize);
+
+  // just in front of the walls at x = 0 and y = 0, facing into the room
+  picojson::array mirrors;
+  mirrors.push_back(GenerateMirror(
+      Eigen::Vector3f(0.01f, 0.5f * kRoomSize(1), 1.4f),
+      Eigen::Vector3f::UnitY(),
+      Eigen::Vector3f::UnitZ(),
+      1.0f,
+      0.8f,
+      1));
+  mirrors.push_back(GenerateMirror(
+      Eigen::Vector3f(0.5f * kRoomSize(0), 0.01f, 1.4f),
+      Eigen::Vector3f::UnitZ(),
+      Eigen::Vector3f::UnitX(),
+      0.6f,
+      1.2f,
+      2));
+
+  const std::string surfaceFile = folder + "/glass.sur";
+  std::ofstream file(surfaceFile);
+  ASSERT(file.good(), "Can't write " + surfaceFile);
+  file << picojson::value(mirrors).serialize(true);
+}
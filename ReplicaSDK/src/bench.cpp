@@ -0,0 +1,730 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Headless benchmark comparing the quad paths and timing the full rendering
+// pipeline, on a scene or a synthetic one, against a stored baseline
+#include <EGL.h>
+#include <PTexLib.h>
+#include <SyntheticMesh.h>
+#include <ViewArray.h>
+#include <pangolin/image/image_convert.h>
+
+#include <chrono>
+#include <cstring>
+#include <experimental/filesystem>
+#include <functional>
+#include <numeric>
+
+#include "GLCheck.h"
+#include "MirrorRenderer.h"
+
+namespace {
+
+// Synthetic scenes, small tiles keep the atlases small
+constexpr float kSplitSize = 1.0f;
+constexpr int kTileSize = 8;
+
+// Batch of small views per step, as rendered for RL agents
+constexpr int kNumViews = 64;
+constexpr int kViewSize = 128;
+
+// Passes faster than this in the baseline are within timer noise
+constexpr double kMinPassMs = 0.1;
+
+// Occluders selected at load, culling only on for the comparison against it off
+constexpr size_t kOccluderQuads = 4096;
+
+struct Options {
+  std::string meshFile;
+  std::string atlasFolder;
+  std::string surfaceFile;
+  size_t syntheticQuads = 0;
+  size_t numFrames = 100;
+  std::vector<Eigen::Vector2i> resolutions = {{320, 240}, {640, 480}, {1280, 960}};
+  std::string resultsFile = "bench.json";
+  std::string baselineFile;
+  double tolerance = 0.1; // allowed relative slowdown of a frame
+  double passTolerance = 0.25; // allowed relative slowdown of a pass
+};
+
+const char* kUsage =
+    "Usage: ./ReplicaBench mesh.ply /path/to/atlases [numFrames] [options]\n"
+    "       ./ReplicaBench --synthetic numQuads [numFrames] [options]\n"
+    "Options: --mirrors file.sur, --resolutions 320x240,640x480,...,\n"
+    "         --results bench.json, --baseline baseline.json,\n"
+    "         --tolerance 0.1, --pass-tolerance 0.25";
+
+Options ParseOptions(int argc, char* argv[]) {
+  Options options;
+  std::vector<std::string> positional;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string arg(argv[i]);
+    if (arg.compare(0, 2, "--") != 0) {
+      positional.push_back(arg);
+      continue;
+    }
+
+    ASSERT(i + 1 < argc, kUsage);
+    const std::string value(argv[++i]);
+
+    if (arg == "--synthetic") {
+      options.syntheticQuads = std::stoul(value);
+    } else if (arg == "--mirrors") {
+      options.surfaceFile = value;
+    } else if (arg == "--resolutions") {
+      options.resolutions.clear();
+      std::stringstream ss(value);
+      std::string resolution;
+      while (std::getline(ss, resolution, ',')) {
+        const size_t x = resolution.find('x');
+        ASSERT(x != std::string::npos, kUsage);
+        options.resolutions.emplace_back(
+            std::stoi(resolution.substr(0, x)), std::stoi(resolution.substr(x + 1)));
+      }
+    } else if (arg == "--results") {
+      options.resultsFile = value;
+    } else if (arg == "--baseline") {
+      options.baselineFile = value;
+    } else if (arg == "--tolerance") {
+      options.tolerance = std::stod(value);
+    } else if (arg == "--pass-tolerance") {
+      options.passTolerance = std::stod(value);
+    } else {
+      ASSERT(false, kUsage);
+    }
+  }
+
+  const size_t numScene = options.syntheticQuads > 0 ? 0 : 2;
+  ASSERT(positional.size() == numScene || positional.size() == numScene + 1, kUsage);
+
+  if (numScene) {
+    options.meshFile = positional[0];
+    options.atlasFolder = positional[1];
+  }
+  if (positional.size() > numScene) {
+    options.numFrames = std::stoul(positional[numScene]);
+  }
+  ASSERT(options.numFrames > 0);
+  ASSERT(!options.resolutions.empty(), kUsage);
+
+  return options;
+}
+
+pangolin::OpenGlMatrix Projection(const int width, const int height) {
+  return pangolin::ProjectionMatrixRDF_BottomLeft(
+      width,
+      height,
+      width / 2.0f,
+      width / 2.0f,
+      (width - 1.0f) / 2.0f,
+      (height - 1.0f) / 2.0f,
+      0.1f,
+      100.0f);
+}
+
+// Renders numFrames frames along the camera path, returning the mean
+// GPU-synchronised frame time in milliseconds and the last frame.
+// Shaded fragments are accumulated when fragment counting is enabled
+double RenderFrames(
+    PTexMesh& ptexMesh,
+    pangolin::OpenGlRenderState s_cam,
+    const Eigen::Matrix4d& T_new_old,
+    pangolin::GlFramebuffer& frameBuffer,
+    pangolin::GlTexture& render,
+    const size_t numFrames,
+    pangolin::ManagedImage<Eigen::Matrix<uint8_t, 3, 1>>& image,
+    uint64_t* shadedFragments = nullptr) {
+  Eigen::Matrix4d T_camera_world = s_cam.GetModelViewMatrix();
+
+  double totalMs = 0.0;
+
+  for (size_t i = 0; i < numFrames; i++) {
+    glFinish();
+    const auto start = std::chrono::steady_clock::now();
+
+    frameBuffer.Bind();
+    glPushAttrib(GL_VIEWPORT_BIT);
+    glViewport(0, 0, render.width, render.height);
+    glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+
+    glEnable(GL_CULL_FACE);
+
+    ptexMesh.Render(s_cam);
+
+    if (shadedFragments) {
+      *shadedFragments += ptexMesh.LastRenderStats().shadedFragments;
+    }
+
+    glDisable(GL_CULL_FACE);
+
+    glPopAttrib(); // GL_VIEWPORT_BIT
+    frameBuffer.Unbind();
+
+    glFinish();
+    totalMs += std::chrono::duration<double, std::milli>(
+                   std::chrono::steady_clock::now() - start)
+                   .count();
+
+    T_camera_world = T_camera_world * T_new_old.inverse();
+    s_cam.GetModelViewMatrix() = T_camera_world;
+  }
+
+  render.Download(image.ptr, GL_RGB, GL_UNSIGNED_BYTE);
+
+  return totalMs / numFrames;
+}
+
+struct PipelineTimes {
+  int width;
+  int height;
+  double frameMs; // end to end, including readback and encoding
+  std::vector<GpuProfiler::PassStats> passes;
+};
+
+// Renders, composites mirrors, downloads and JPEG encodes numFrames frames
+// along the camera path at one resolution, as ReplicaRenderer does
+PipelineTimes RenderPipeline(
+    PTexMesh& ptexMesh,
+    const std::vector<MirrorSurface>& mirrors,
+    const std::string& surfaceFile,
+    const int width,
+    const int height,
+    const pangolin::OpenGlMatrix& T_camera_world_start,
+    const Eigen::Matrix4d& T_new_old,
+    const GLenum frontFace,
+    const size_t numFrames) {
+  pangolin::GlTexture render(width, height);
+  pangolin::GlRenderBuffer renderBuffer(width, height);
+  pangolin::GlFramebuffer frameBuffer(render, renderBuffer);
+
+  pangolin::OpenGlRenderState s_cam(Projection(width, height), T_camera_world_start);
+
+  const std::string shadir = STR(SHADER_DIR);
+  MirrorRenderer mirrorRenderer(mirrors, width, height, shadir, surfaceFile);
+
+  pangolin::ManagedImage<Eigen::Matrix<uint8_t, 3, 1>> image(width, height);
+  const std::string encodeFile =
+      (std::experimental::filesystem::temp_directory_path() / "replica-bench.jpg").string();
+
+  GpuProfiler profiler(numFrames);
+
+  auto renderFrame = [&](GpuProfiler* frameProfiler) {
+    frameBuffer.Bind();
+    glPushAttrib(GL_VIEWPORT_BIT);
+    glViewport(0, 0, width, height);
+    glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+
+    glEnable(GL_CULL_FACE);
+    ptexMesh.Render(s_cam);
+    glDisable(GL_CULL_FACE);
+
+    glPopAttrib(); // GL_VIEWPORT_BIT
+    frameBuffer.Unbind();
+
+    mirrorRenderer.CaptureReflections(mirrors, ptexMesh, s_cam, frontFace);
+
+    frameBuffer.Bind();
+    glPushAttrib(GL_VIEWPORT_BIT);
+    glViewport(0, 0, width, height);
+    mirrorRenderer.Render(mirrors, s_cam);
+    glPopAttrib(); // GL_VIEWPORT_BIT
+    frameBuffer.Unbind();
+
+    {
+      GpuProfiler::Scope scope(frameProfiler, "download");
+      render.Download(image.ptr, GL_RGB, GL_UNSIGNED_BYTE);
+    }
+
+    {
+      GpuProfiler::Scope scope(frameProfiler, "encode");
+      pangolin::SaveImage(
+          image.UnsafeReinterpret<uint8_t>(),
+          pangolin::PixelFormatFromString("RGB24"),
+          encodeFile);
+    }
+  };
+
+  // untimed, so first use allocations aren't counted
+  renderFrame(nullptr);
+  glFinish();
+
+  ptexMesh.SetProfiler(&profiler);
+  mirrorRenderer.SetProfiler(&profiler);
+
+  Eigen::Matrix4d T_camera_world = s_cam.GetModelViewMatrix();
+  const auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < numFrames; i++) {
+    profiler.BeginFrame();
+    renderFrame(&profiler);
+
+    T_camera_world = T_camera_world * T_new_old.inverse();
+    s_cam.GetModelViewMatrix() = T_camera_world;
+  }
+  glFinish();
+
+  PipelineTimes times;
+  times.width = width;
+  times.height = height;
+  times.frameMs = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count() /
+      numFrames;
+
+  profiler.Finish();
+  times.passes = profiler.Stats();
+  ptexMesh.SetProfiler(nullptr);
+
+  std::experimental::filesystem::remove(encodeFile);
+
+  return times;
+}
+
+struct ViewBatchTimes {
+  double sequentialMs; // per batch, a Render and download per view
+  double layeredMs; // per batch, one RenderViews and download
+  size_t differentPixels;
+};
+
+// Renders and reads back kNumViews views along the camera path numBatches
+// times, one at a time, then all together into layers of a ViewArray
+ViewBatchTimes RenderViewBatches(
+    PTexMesh& ptexMesh,
+    const pangolin::OpenGlMatrix& T_camera_world_start,
+    const Eigen::Matrix4d& T_new_old,
+    const size_t numBatches) {
+  std::vector<pangolin::OpenGlRenderState> cams;
+  Eigen::Matrix4d T_camera_world = T_camera_world_start;
+  for (int i = 0; i < kNumViews; i++) {
+    cams.emplace_back(Projection(kViewSize, kViewSize), T_camera_world);
+    T_camera_world = T_camera_world * T_new_old.inverse();
+  }
+
+  pangolin::GlTexture render(kViewSize, kViewSize);
+  pangolin::GlRenderBuffer renderBuffer(kViewSize, kViewSize);
+  pangolin::GlFramebuffer frameBuffer(render, renderBuffer);
+
+  ViewArray views(kViewSize, kViewSize, kNumViews);
+
+  const size_t viewBytes = views.SizeBytes() / kNumViews;
+  std::vector<uint8_t> sequentialPixels(views.SizeBytes());
+  std::vector<uint8_t> layeredPixels(views.SizeBytes());
+
+  auto renderSequential = [&]() {
+    for (int v = 0; v < kNumViews; v++) {
+      frameBuffer.Bind();
+      glPushAttrib(GL_VIEWPORT_BIT);
+      glViewport(0, 0, kViewSize, kViewSize);
+      glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+
+      glEnable(GL_CULL_FACE);
+      ptexMesh.Render(cams[v]);
+      glDisable(GL_CULL_FACE);
+
+      glPopAttrib(); // GL_VIEWPORT_BIT
+      frameBuffer.Unbind();
+
+      render.Download(&sequentialPixels[v * viewBytes], GL_RGBA, GL_UNSIGNED_BYTE);
+    }
+  };
+
+  auto renderLayered = [&]() {
+    views.Bind();
+    glEnable(GL_CULL_FACE);
+    ptexMesh.RenderViews(cams);
+    glDisable(GL_CULL_FACE);
+    views.Unbind();
+
+    views.Download(layeredPixels.data());
+  };
+
+  auto time = [numBatches](const std::function<void()>& renderBatch) {
+    // untimed, so first use allocations aren't counted
+    renderBatch();
+    glFinish();
+
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < numBatches; i++) {
+      renderBatch();
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+               .count() /
+        numBatches;
+  };
+
+  ViewBatchTimes times;
+  times.sequentialMs = time(renderSequential);
+  times.layeredMs = time(renderLayered);
+
+  times.differentPixels = 0;
+  for (size_t i = 0; i < sequentialPixels.size(); i += 4) {
+    if (std::memcmp(&sequentialPixels[i], &layeredPixels[i], 4) != 0)
+      times.differentPixels++;
+  }
+
+  return times;
+}
+
+std::string ResolutionKey(const int width, const int height) {
+  return std::to_string(width) + "x" + std::to_string(height);
+}
+
+picojson::value ResultsJson(
+    const std::string& renderer,
+    const std::string& scene,
+    const size_t numFrames,
+    const std::vector<PipelineTimes>& pipelineTimes,
+    const ViewBatchTimes& viewTimes) {
+  picojson::object resolutions;
+  for (const PipelineTimes& times : pipelineTimes) {
+    picojson::object passes;
+    for (const GpuProfiler::PassStats& s : times.passes) {
+      picojson::object pass;
+      pass["gpu_ms"] = picojson::value(s.gpuMeanMs);
+      pass["cpu_ms"] = picojson::value(s.cpuMeanMs);
+      passes[s.name] = picojson::value(pass);
+    }
+
+    picojson::object resolution;
+    resolution["frame_ms"] = picojson::value(times.frameMs);
+    resolution["fps"] = picojson::value(1000.0 / times.frameMs);
+    resolution["passes"] = picojson::value(passes);
+    resolutions[ResolutionKey(times.width, times.height)] = picojson::value(resolution);
+  }
+
+  picojson::object json;
+  json["renderer"] = picojson::value(renderer);
+  json["scene"] = picojson::value(scene);
+  json["frames"] = picojson::value((int64_t)numFrames);
+  json["resolutions"] = picojson::value(resolutions);
+
+  picojson::object views;
+  views["count"] = picojson::value((int64_t)kNumViews);
+  views["size"] = picojson::value(ResolutionKey(kViewSize, kViewSize));
+  views["sequential_ms"] = picojson::value(viewTimes.sequentialMs);
+  views["layered_ms"] = picojson::value(viewTimes.layeredMs);
+  json["views"] = picojson::value(views);
+
+  return picojson::value(json);
+}
+
+// Reports a time, true if slower than its baseline by more than tolerance
+bool Regressed(
+    const std::string& name,
+    const double ms,
+    const double baselineMs,
+    const double tolerance) {
+  const bool regressed = ms > baselineMs * (1.0 + tolerance);
+  std::cout << "  " << name << ": " << ms << " ms, baseline " << baselineMs << " ms ("
+            << (ms / baselineMs - 1.0) * 100.0 << "%)" << (regressed ? " REGRESSED" : "")
+            << std::endl;
+  return regressed;
+}
+
+// Compares results with those of an earlier run, returning the number of
+// frame and pass times that regressed
+size_t CompareToBaseline(
+    const picojson::value& results,
+    const std::string& baselineFile,
+    const double tolerance,
+    const double passTolerance) {
+  std::ifstream file(baselineFile);
+  ASSERT(file.good(), "Can't read " + baselineFile);
+  picojson::value baseline;
+  picojson::parse(baseline, file);
+
+  std::cout << "Comparing against " << baselineFile << std::endl;
+  if (baseline["renderer"].get<std::string>() != results["renderer"].get<std::string>() ||
+      baseline["scene"].get<std::string>() != results["scene"].get<std::string>()) {
+    std::cout << "Warning: baseline is of " << baseline["scene"].get<std::string>() << " on "
+              << baseline["renderer"].get<std::string>() << std::endl;
+  }
+
+  size_t regressions = 0;
+
+  const picojson::value& baseResolutions = baseline["resolutions"];
+  for (const auto& r : results["resolutions"].get<picojson::object>()) {
+    if (!baseResolutions.contains(r.first)) {
+      std::cout << r.first << ": not in baseline" << std::endl;
+      continue;
+    }
+
+    const picojson::value& base = baseResolutions[r.first];
+    std::cout << r.first << ":" << std::endl;
+
+    regressions += Regressed(
+        "frame",
+        r.second["frame_ms"].get<double>(),
+        base["frame_ms"].get<double>(),
+        tolerance);
+
+    const picojson::value& basePasses = base["passes"];
+    for (const auto& p : r.second["passes"].get<picojson::object>()) {
+      if (!basePasses.contains(p.first))
+        continue;
+
+      for (const std::string key : {"gpu_ms", "cpu_ms"}) {
+        const double baseMs = basePasses[p.first][key].get<double>();
+        if (baseMs < kMinPassMs)
+          continue;
+
+        regressions += Regressed(
+            p.first + " " + key, p.second[key].get<double>(), baseMs, passTolerance);
+      }
+    }
+  }
+
+  if (baseline.contains("views") && results.contains("views")) {
+    std::cout << "views:" << std::endl;
+    regressions += Regressed(
+        "layered",
+        results["views"]["layered_ms"].get<double>(),
+        baseline["views"]["layered_ms"].get<double>(),
+        tolerance);
+  }
+
+  return regressions;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  Options options = ParseOptions(argc, argv);
+
+  std::string scene = options.meshFile;
+
+  if (options.syntheticQuads > 0) {
+    const std::string folder = (std::experimental::filesystem::temp_directory_path() /
+                                ("replica-synthetic-" + std::to_string(options.syntheticQuads)))
+                                   .string();
+    std::cout << "Writing synthetic scene to " << folder << "... ";
+    std::cout.flush();
+    WriteSyntheticScene(folder, options.syntheticQuads, kSplitSize, kTileSize);
+    std::cout << "done" << std::endl;
+
+    options.meshFile = folder + "/mesh.ply";
+    options.atlasFolder = folder + "/textures";
+    if (options.surfaceFile.empty()) {
+      options.surfaceFile = folder + "/glass.sur";
+    }
+    scene = "synthetic " + std::to_string(options.syntheticQuads);
+  }
+
+  ASSERT(pangolin::FileExists(options.meshFile));
+  ASSERT(pangolin::FileExists(options.atlasFolder));
+
+  const size_t numFrames = options.numFrames;
+
+  const int width = 1280;
+  const int height = 960;
+
+  // Setup EGL, on Mesa's surfaceless platform when there's no GPU or X server
+  EGLCtx egl;
+
+  egl.PrintInformation();
+
+  if (!checkGLVersion()) {
+    return 1;
+  }
+
+  const std::string renderer((const char*)glGetString(GL_RENDERER));
+  std::cout << "Renderer: " << renderer << std::endl;
+
+  const GLenum frontFace = GL_CCW;
+  glFrontFace(frontFace);
+
+  pangolin::GlTexture render(width, height);
+  pangolin::GlRenderBuffer renderBuffer(width, height);
+  pangolin::GlFramebuffer frameBuffer(render, renderBuffer);
+
+  // The ReplicaRenderer trajectory moving left, or turning on the spot in
+  // the middle of the synthetic room
+  pangolin::OpenGlMatrix T_camera_world_start =
+      pangolin::ModelViewLookAtRDF(0, 0, 4, 0, 0, 0, 0, 1, 0);
+  Eigen::Matrix4d T_new_old = Eigen::Matrix4d::Identity();
+  T_new_old.topRightCorner(3, 1) = Eigen::Vector3d(0.025, 0, 0);
+
+  if (options.syntheticQuads > 0) {
+    T_camera_world_start = pangolin::ModelViewLookAtRDF(4, 3, 1.5, 0, 3, 1.2, 0, 0, 1);
+    T_new_old = Eigen::Matrix4d::Identity();
+    T_new_old.topLeftCorner(3, 3) =
+        Eigen::AngleAxisd(2.0 * M_PI / numFrames, Eigen::Vector3d::UnitY()).toRotationMatrix();
+  }
+
+  pangolin::OpenGlRenderState s_cam(Projection(width, height), T_camera_world_start);
+
+  std::vector<MirrorSurface> mirrors;
+  if (options.surfaceFile.length()) {
+    ASSERT(pangolin::FileExists(options.surfaceFile));
+    std::ifstream file(options.surfaceFile);
+    picojson::value json;
+    picojson::parse(json, file);
+
+    for (size_t i = 0; i < json.size(); i++) {
+      mirrors.emplace_back(json[i]);
+    }
+    std::cout << "Loaded " << mirrors.size() << " mirrors" << std::endl;
+  }
+
+  PTexMeshOptions meshOptions;
+  meshOptions.lodLevels = 2;
+  meshOptions.occluderQuads = kOccluderQuads;
+  meshOptions.traceFile = "load-trace.json";
+
+  PTexMesh ptexMesh(options.meshFile, options.atlasFolder, meshOptions);
+  ptexMesh.SetOcclusionCulling(false);
+
+  // compare the quad paths at full resolution
+  ptexMesh.SetLodLevel(0);
+
+  pangolin::ManagedImage<Eigen::Matrix<uint8_t, 3, 1>> geometryImage(width, height);
+  pangolin::ManagedImage<Eigen::Matrix<uint8_t, 3, 1>> pullingImage(width, height);
+
+  ptexMesh.SetVertexPulling(false);
+  const double geometryMs = RenderFrames(
+      ptexMesh, s_cam, T_new_old, frameBuffer, render, numFrames, geometryImage);
+
+  ptexMesh.SetVertexPulling(true);
+  const double pullingMs =
+      RenderFrames(ptexMesh, s_cam, T_new_old, frameBuffer, render, numFrames, pullingImage);
+
+  // Shading cost with and without the depth prepass
+  pangolin::ManagedImage<Eigen::Matrix<uint8_t, 3, 1>> prepassImage(width, height);
+  uint64_t directFragments = 0;
+  uint64_t prepassFragments = 0;
+
+  ptexMesh.SetCountFragments(true);
+  ptexMesh.SetDepthPrepass(false);
+  const double directMs = RenderFrames(
+      ptexMesh,
+      s_cam,
+      T_new_old,
+      frameBuffer,
+      render,
+      numFrames,
+      pullingImage,
+      &directFragments);
+
+  ptexMesh.SetDepthPrepass(true);
+  const double prepassMs = RenderFrames(
+      ptexMesh,
+      s_cam,
+      T_new_old,
+      frameBuffer,
+      render,
+      numFrames,
+      prepassImage,
+      &prepassFragments);
+
+  ptexMesh.SetDepthPrepass(false);
+  ptexMesh.SetCountFragments(false);
+
+  // Cost of each level of detail, then of picking levels by screen size
+  std::vector<double> lodMs;
+  std::vector<size_t> lodTriangles;
+
+  for (int level = 0; level <= (int)ptexMesh.NumLodLevels(); level++) {
+    ptexMesh.SetLodLevel(level < (int)ptexMesh.NumLodLevels() ? level : -1);
+    lodMs.push_back(RenderFrames(
+        ptexMesh, s_cam, T_new_old, frameBuffer, render, numFrames, prepassImage));
+
+    const std::vector<size_t>& quads = ptexMesh.LastRenderStats().lodQuads;
+    lodTriangles.push_back(std::accumulate(quads.begin(), quads.end(), (size_t)0) * 2);
+  }
+  ptexMesh.SetLodLevel(0);
+
+  // Occlusion culling must only skip submeshes that wouldn't be seen
+  pangolin::ManagedImage<Eigen::Matrix<uint8_t, 3, 1>> unculledImage(width, height);
+  pangolin::ManagedImage<Eigen::Matrix<uint8_t, 3, 1>> occludedImage(width, height);
+
+  const double unculledMs = RenderFrames(
+      ptexMesh, s_cam, T_new_old, frameBuffer, render, numFrames, unculledImage);
+
+  ptexMesh.SetOcclusionCulling(true);
+  const double occludedMs = RenderFrames(
+      ptexMesh, s_cam, T_new_old, frameBuffer, render, numFrames, occludedImage);
+  const size_t occludedSubMeshes = ptexMesh.LastRenderStats().occludedSubMeshes;
+  ptexMesh.SetOcclusionCulling(false);
+
+  size_t differentPixels = 0;
+  size_t occlusionPixels = 0;
+  for (size_t i = 0; i < geometryImage.Area(); i++) {
+    if (geometryImage[i] != pullingImage[i])
+      differentPixels++;
+    if (unculledImage[i] != occludedImage[i])
+      occlusionPixels++;
+  }
+
+  std::cout << "Geometry shader: " << geometryMs << " ms/frame" << std::endl;
+  std::cout << "Vertex pulling:  " << pullingMs << " ms/frame" << std::endl;
+  std::cout << "Differing pixels in last frame: " << differentPixels << std::endl;
+  std::cout << "Without prepass: " << directMs << " ms/frame, "
+            << directFragments / numFrames << " shaded fragments/frame" << std::endl;
+  std::cout << "With prepass:    " << prepassMs << " ms/frame, "
+            << prepassFragments / numFrames << " shaded fragments/frame" << std::endl;
+  std::cout << "Without occlusion culling: " << unculledMs << " ms/frame" << std::endl;
+  std::cout << "With occlusion culling:    " << occludedMs << " ms/frame, "
+            << occludedSubMeshes << " sub-meshes occluded in last frame" << std::endl;
+  std::cout << "Differing pixels with occlusion culling: " << occlusionPixels << std::endl;
+  for (size_t i = 0; i < lodMs.size(); i++) {
+    if (i + 1 < lodMs.size()) {
+      std::cout << "LOD " << i << ":           ";
+    } else {
+      std::cout << "LOD by distance: ";
+    }
+    std::cout << lodMs[i] << " ms/frame, " << lodTriangles[i] << " triangles in last frame"
+              << std::endl;
+  }
+
+  // The whole pipeline at each resolution
+  std::vector<PipelineTimes> pipelineTimes;
+  for (const Eigen::Vector2i& resolution : options.resolutions) {
+    pipelineTimes.push_back(RenderPipeline(
+        ptexMesh,
+        mirrors,
+        options.surfaceFile,
+        resolution(0),
+        resolution(1),
+        T_camera_world_start,
+        T_new_old,
+        frontFace,
+        numFrames));
+
+    const PipelineTimes& times = pipelineTimes.back();
+    std::cout << ResolutionKey(times.width, times.height) << ": " << times.frameMs
+              << " ms/frame, " << 1000.0 / times.frameMs << " frames/s" << std::endl;
+    for (const GpuProfiler::PassStats& s : times.passes) {
+      std::cout << "  " << s.name << ": GPU " << s.gpuMeanMs << " ms, CPU " << s.cpuMeanMs
+                << " ms" << std::endl;
+    }
+  }
+
+  // Many small views a step, one by one and layered
+  const ViewBatchTimes viewTimes =
+      RenderViewBatches(ptexMesh, T_camera_world_start, T_new_old, numFrames);
+
+  std::cout << kNumViews << " views of " << ResolutionKey(kViewSize, kViewSize) << ":"
+            << std::endl;
+  std::cout << "  One by one: " << viewTimes.sequentialMs << " ms/batch, "
+            << 1000.0 * kNumViews / viewTimes.sequentialMs << " views/s" << std::endl;
+  std::cout << "  Layered:    " << viewTimes.layeredMs << " ms/batch, "
+            << 1000.0 * kNumViews / viewTimes.layeredMs << " views/s" << std::endl;
+  std::cout << "  Differing pixels: " << viewTimes.differentPixels << std::endl;
+
+  const picojson::value results =
+      ResultsJson(renderer, scene, numFrames, pipelineTimes, viewTimes);
+  {
+    std::ofstream file(options.resultsFile);
+    ASSERT(file.good(), "Can't write " + options.resultsFile);
+    file << results.serialize(true);
+  }
+  std::cout << "Wrote results to " << options.resultsFile << std::endl;
+
+  size_t regressions = 0;
+  if (!options.baselineFile.empty()) {
+    regressions = CompareToBaseline(
+        results, options.baselineFile, options.tolerance, options.passTolerance);
+    std::cout << regressions << " regressions" << std::endl;
+  }
+
+  return differentPixels == 0 && occlusionPixels == 0 && regressions == 0 ? 0 : 1;
+}
@@ -0,0 +1,256 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// CPU micro-benchmarks of mesh loading and mirror mask generation on
+// synthetic scenes, needing neither a GPU nor the dataset
+#include <MirrorSurface.h>
+#include <PLYParser.h>
+#include <PTexLib.h>
+#include <SyntheticMesh.h>
+
+#include <pangolin/utils/file_utils.h>
+#include <pangolin/utils/picojson.h>
+
+#include <omp.h>
+#include <algorithm>
+#include <chrono>
+#include <experimental/filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+
+namespace {
+
+// Grid cell size of the split, as in the dataset
+constexpr float kSplitSize = 1.0f;
+constexpr int kTileSize = 16;
+
+constexpr int kNumMirrors = 16;
+constexpr int kMaskSize = 1024;
+
+struct Timings {
+  std::vector<double> ms;
+  std::vector<double> pageFaults; // minor, of the whole process
+};
+
+struct Result {
+  std::string stage;
+  size_t size; // quads, or mask side length
+  int threads;
+  Timings timings;
+};
+
+// Times repetitions runs of fn after one untimed warm up run
+Timings Time(const size_t repetitions, const std::function<void()>& fn) {
+  fn();
+
+  Timings timings;
+  for (size_t i = 0; i < repetitions; i++) {
+    const size_t startPageFaults = LoadTrace::MinorPageFaults();
+    const auto start = std::chrono::steady_clock::now();
+    fn();
+    timings.ms.push_back(std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - start)
+                             .count());
+    timings.pageFaults.push_back(LoadTrace::MinorPageFaults() - startPageFaults);
+  }
+  return timings;
+}
+
+double Median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  const size_t n = values.size();
+  return n % 2 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+}
+
+double Mean(const std::vector<double>& values) {
+  double sum = 0.0;
+  for (const double v : values) {
+    sum += v;
+  }
+  return sum / values.size();
+}
+
+// 1, 2, 4, ... up to and including the number of hardware threads
+std::vector<int> ThreadCounts() {
+  const int maxThreads = omp_get_max_threads();
+  std::vector<int> counts;
+  for (int t = 1; t < maxThreads; t *= 2) {
+    counts.push_back(t);
+  }
+  counts.push_back(maxThreads);
+  return counts;
+}
+
+void Report(const Result& r) {
+  const std::vector<double>& ms = r.timings.ms;
+  std::cout << r.stage << ", " << r.size << ", " << r.threads << " threads: median "
+            << Median(ms) << " ms, min " << *std::min_element(ms.begin(), ms.end())
+            << " ms, median " << Median(r.timings.pageFaults) << " minor page faults"
+            << std::endl;
+}
+
+void WriteResults(const std::string& filename, const std::vector<Result>& results) {
+  picojson::array entries;
+  for (const Result& r : results) {
+    const std::vector<double>& times = r.timings.ms;
+    picojson::array ms;
+    for (const double t : times) {
+      ms.push_back(picojson::value(t));
+    }
+
+    picojson::object entry;
+    entry["stage"] = picojson::value(r.stage);
+    entry["size"] = picojson::value((int64_t)r.size);
+    entry["threads"] = picojson::value((int64_t)r.threads);
+    entry["median_ms"] = picojson::value(Median(times));
+    entry["mean_ms"] = picojson::value(Mean(times));
+    entry["min_ms"] = picojson::value(*std::min_element(times.begin(), times.end()));
+    entry["max_ms"] = picojson::value(*std::max_element(times.begin(), times.end()));
+    entry["ms"] = picojson::value(ms);
+    entry["median_minor_page_faults"] = picojson::value(Median(r.timings.pageFaults));
+    entries.push_back(picojson::value(entry));
+  }
+
+  picojson::object json;
+  json["max_threads"] = picojson::value((int64_t)omp_get_max_threads());
+  json["split_size"] = picojson::value((double)kSplitSize);
+  json["results"] = picojson::value(entries);
+
+  std::ofstream file(filename);
+  ASSERT(file.good(), "Can't write " + filename);
+  file << picojson::value(json).serialize(true);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  ASSERT(
+      (argc >= 2 && argc <= 4 && std::string(argv[1]) != "--generate") ||
+          (argc == 4 && std::string(argv[1]) == "--generate"),
+      "Usage: ./ReplicaMeshBench results.json [maxQuads [repetitions]]\n"
+      "       ./ReplicaMeshBench --generate numQuads /path/to/output");
+
+  if (std::string(argv[1]) == "--generate") {
+    const size_t numQuads = std::stoul(argv[2]);
+    const std::string outputFolder(argv[3]);
+
+    WriteSyntheticScene(outputFolder, numQuads, kSplitSize, kTileSize);
+    std::cout << "Wrote synthetic scene to " << outputFolder << std::endl;
+    return 0;
+  }
+
+  const std::string resultsFile(argv[1]);
+  const size_t maxQuads = argc >= 3 ? std::stoul(argv[2]) : 5000000;
+  const size_t repetitions = argc >= 4 ? std::stoul(argv[3]) : 5;
+  ASSERT(repetitions > 0);
+
+  const std::vector<int> threadCounts = ThreadCounts();
+  const int maxThreads = threadCounts.back();
+
+  const std::string tmpFolder =
+      (std::experimental::filesystem::temp_directory_path() / "replica-meshbench").string();
+  std::experimental::filesystem::create_directories(tmpFolder);
+
+  std::vector<Result> results;
+
+  for (const size_t targetQuads : {10000ul, 100000ul, 1000000ul, 5000000ul, 20000000ul}) {
+    if (targetQuads > maxQuads)
+      break;
+
+    const MeshData mesh = GenerateRoomMesh(targetQuads);
+    const size_t numQuads = mesh.ibo.size() / 4;
+
+    // the file stays in the page cache, so this is parsing rather than disk time
+    const std::string plyFile = tmpFolder + "/mesh.ply";
+    WritePLY(mesh, plyFile);
+
+    omp_set_num_threads(1);
+    results.push_back({"parse", numQuads, 1, Time(repetitions, [&]() {
+                         MeshData parsed;
+                         PLYParse(parsed, plyFile);
+                       })});
+    Report(results.back());
+    std::experimental::filesystem::remove(plyFile);
+
+    for (const int threads : threadCounts) {
+      omp_set_num_threads(threads);
+      results.push_back({"split", numQuads, threads, Time(repetitions, [&]() {
+                           PTexMesh::SplitMesh(mesh, kSplitSize);
+                         })});
+      Report(results.back());
+    }
+
+    // as loading with PTexMeshOptions::loadArena, pages stay mapped between runs
+    Arena arena;
+
+    for (const int threads : threadCounts) {
+      omp_set_num_threads(threads);
+      results.push_back({"split (arena)", numQuads, threads, Time(repetitions, [&]() {
+                           {
+                             Arena::Scope scope(&arena);
+                             PTexMesh::SplitMesh(mesh, kSplitSize);
+                           }
+                           arena.Reset();
+                         })});
+      Report(results.back());
+    }
+
+    // per submesh, as when loading
+    const std::vector<MeshData> subMeshes = PTexMesh::SplitMesh(mesh, kSplitSize);
+
+    for (const int threads : threadCounts) {
+      omp_set_num_threads(threads);
+      results.push_back({"adjacency", numQuads, threads, Time(repetitions, [&]() {
+                           std::vector<ArenaVector<uint32_t>> adjFaces(subMeshes.size());
+#pragma omp parallel for
+                           for (size_t i = 0; i < subMeshes.size(); i++) {
+                             PTexMesh::CalculateAdjacency(subMeshes[i], adjFaces[i]);
+                           }
+                         })});
+      Report(results.back());
+    }
+
+    for (const int threads : threadCounts) {
+      omp_set_num_threads(threads);
+      results.push_back({"adjacency (arena)", numQuads, threads, Time(repetitions, [&]() {
+                           {
+                             std::vector<ArenaVector<uint32_t>> adjFaces(subMeshes.size());
+#pragma omp parallel for
+                             for (size_t i = 0; i < subMeshes.size(); i++) {
+                               Arena::Scope scope(&arena);
+                               PTexMesh::CalculateAdjacency(subMeshes[i], adjFaces[i]);
+                             }
+                           }
+                           arena.Reset();
+                         })});
+      Report(results.back());
+    }
+  }
+
+  std::mt19937 rng(0);
+  std::vector<MirrorSurface> mirrors;
+  for (int i = 0; i < kNumMirrors; i++) {
+    const float rx = 0.5f + 1.5f * float(rng() / 4294967296.0);
+    const float ry = 0.5f + 1.5f * float(rng() / 4294967296.0);
+    mirrors.emplace_back(GenerateMirror(
+        Eigen::Vector3f::Zero(), Eigen::Vector3f::UnitX(), Eigen::Vector3f::UnitY(), rx, ry, i));
+  }
+
+  for (const int threads : threadCounts) {
+    omp_set_num_threads(threads);
+    results.push_back({"mask", kMaskSize, threads, Time(repetitions, [&]() {
+                         // rows of each mask are generated in parallel
+                         std::vector<pangolin::ManagedImage<uint8_t>> masks(mirrors.size());
+                         for (size_t i = 0; i < mirrors.size(); i++) {
+                           mirrors[i].GenerateMask(masks[i], kMaskSize, kMaskSize);
+                         }
+                       })});
+    Report(results.back());
+  }
+
+  omp_set_num_threads(maxThreads);
+
+  WriteResults(resultsFile, results);
+  std::cout << "Wrote " << results.size() << " results to " << resultsFile << std::endl;
+
+  return 0;
+}
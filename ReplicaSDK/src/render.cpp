@@ -5,19 +5,77 @@
 
 #include "GLCheck.h"
 #include "MirrorRenderer.h"
-
+#include "PanoramaRenderer.h"
+
+#include <fstream>
+#include <sstream>
+
+// Portable float map of an image stored top row first
+void SavePFM(
+    const pangolin::ManagedImage<Eigen::Matrix<float, 3, 1>>& image,
+    const std::string& filename) {
+  std::ofstream file(filename, std::ios::binary);
+  ASSERT(file.good(), "Can't write " + filename);
+
+  // negative scale for little endian, rows are stored bottom row first
+  file << "PF\n" << image.w << " " << image.h << "\n-1.0\n";
+  for (size_t y = image.h; y-- > 0;) {
+    file.write((const char*)image.RowPtr(y), image.w * sizeof(Eigen::Matrix<float, 3, 1>));
+  }
+}
 
 int main(int argc, char* argv[]) {
-  ASSERT(argc == 3 || argc == 4, "Usage: ./ReplicaRenderer mesh.ply /path/to/atlases [mirrorFile]");
+  // 360 degree equirectangular frames of this width instead, when given
+  int panoramaWidth = 0;
+
+  // exposures, relative to the scene's, of further frames from the same pass
+  std::vector<float> bracketExposures;
+
+  // linear colour before tone mapping, written as float PFM images
+  bool renderHdr = false;
+
+  // per pass GPU and CPU times of every frame, written to profile.csv and
+  // profile.json
+  bool profile = false;
+
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg(argv[i]);
+    if (arg == "--panorama" && i + 1 < argc) {
+      panoramaWidth = std::stoi(argv[++i]);
+    } else if (arg == "--brackets" && i + 1 < argc) {
+      std::stringstream ss(argv[++i]);
+      std::string exposure;
+      while (std::getline(ss, exposure, ',')) {
+        bracketExposures.push_back(std::stof(exposure));
+      }
+    } else if (arg == "--hdr") {
+      renderHdr = true;
+    } else if (arg == "--profile") {
+      profile = true;
+    } else {
+      args.push_back(arg);
+    }
+  }
+
+  ASSERT(
+      args.size() == 2 || args.size() == 3,
+      "Usage: ./ReplicaRenderer mesh.ply /path/to/atlases [mirrorFile] [--panorama width]\n"
+      "       [--brackets 0.5,2,...] [--hdr] [--profile]");
 
-  const std::string meshFile(argv[1]);
-  const std::string atlasFolder(argv[2]);
+  const bool extraOutputs = renderHdr || !bracketExposures.empty();
+  ASSERT(
+      panoramaWidth == 0 || !extraOutputs,
+      "Brackets and HDR output aren't supported in panoramas");
+
+  const std::string meshFile(args[0]);
+  const std::string atlasFolder(args[1]);
   ASSERT(pangolin::FileExists(meshFile));
   ASSERT(pangolin::FileExists(atlasFolder));
 
   std::string surfaceFile;
-  if (argc == 4) {
-    surfaceFile = std::string(argv[3]);
+  if (args.size() == 3) {
+    surfaceFile = args[2];
     ASSERT(pangolin::FileExists(surfaceFile));
   }
 
@@ -44,8 +102,24 @@ int main(int argc, char* argv[]) {
   pangolin::GlRenderBuffer renderBuffer(width, height);
   pangolin::GlFramebuffer frameBuffer(render, renderBuffer);
 
+  // depth is written alongside colour, so it matches it in mirrors too
   pangolin::GlTexture depthTexture(width, height, GL_R32F, false, 0, GL_RED, GL_FLOAT, 0);
-  pangolin::GlFramebuffer depthFrameBuffer(depthTexture, renderBuffer);
+  if (renderDepth || extraOutputs) {
+    frameBuffer.AttachColour(depthTexture);
+  }
+
+  // linear colour and exposure brackets follow depth, written in the same pass
+  std::unique_ptr<pangolin::GlTexture> hdrTexture;
+  std::vector<std::unique_ptr<pangolin::GlTexture>> bracketTextures;
+  if (extraOutputs) {
+    hdrTexture.reset(
+        new pangolin::GlTexture(width, height, GL_RGBA32F, false, 0, GL_RGBA, GL_FLOAT, 0));
+    frameBuffer.AttachColour(*hdrTexture);
+  }
+  for (size_t i = 0; i < bracketExposures.size(); i++) {
+    bracketTextures.emplace_back(new pangolin::GlTexture(width, height));
+    frameBuffer.AttachColour(*bracketTextures.back());
+  }
 
   // Setup a camera
   pangolin::OpenGlRenderState s_cam(
@@ -82,14 +156,42 @@ int main(int argc, char* argv[]) {
   }
 
   const std::string shadir = STR(SHADER_DIR);
-  MirrorRenderer mirrorRenderer(mirrors, width, height, shadir);
+  MirrorRenderer mirrorRenderer(mirrors, width, height, shadir, surfaceFile);
 
   // load mesh and textures
   PTexMesh ptexMesh(meshFile, atlasFolder);
+  ptexMesh.SetDepthOutputScale(depthScale);
 
-  pangolin::ManagedImage<Eigen::Matrix<uint8_t, 3, 1>> image(width, height);
-  pangolin::ManagedImage<float> depthImage(width, height);
-  pangolin::ManagedImage<uint16_t> depthImageInt(width, height);
+  std::vector<PTexMesh::ToneSettings> brackets;
+  for (const float exposure : bracketExposures) {
+    brackets.push_back({exposure * ptexMesh.Exposure(), ptexMesh.Gamma(), ptexMesh.Saturation()});
+  }
+  ptexMesh.SetBrackets(brackets);
+  ptexMesh.SetExtraOutputs(renderDepth || extraOutputs);
+
+  // GPU and CPU time of each pass, written out after the last frame
+  GpuProfiler profiler;
+  if (profile) {
+    profiler.SetRecordHistory(true);
+    ptexMesh.SetProfiler(&profiler);
+    mirrorRenderer.SetProfiler(&profiler);
+  }
+
+  std::unique_ptr<PanoramaRenderer> panorama;
+  if (panoramaWidth > 0) {
+    panorama.reset(new PanoramaRenderer(panoramaWidth, panoramaWidth / 2, shadir, 0, renderDepth));
+    if (profile) {
+      panorama->SetProfiler(&profiler);
+    }
+  }
+
+  const int outputWidth = panorama ? panorama->Width() : width;
+  const int outputHeight = panorama ? panorama->Height() : height;
+
+  pangolin::ManagedImage<Eigen::Matrix<uint8_t, 3, 1>> image(outputWidth, outputHeight);
+  pangolin::ManagedImage<float> depthImage(outputWidth, outputHeight);
+  pangolin::ManagedImage<uint16_t> depthImageInt(outputWidth, outputHeight);
+  pangolin::ManagedImage<Eigen::Matrix<float, 3, 1>> hdrImage(outputWidth, outputHeight);
 
   // Render some frames
   const size_t numFrames = 100;
@@ -97,39 +199,55 @@ int main(int argc, char* argv[]) {
     std::cout << "\rRendering frame " << i + 1 << "/" << numFrames << "... ";
     std::cout.flush();
 
-    // Render
-    frameBuffer.Bind();
-    glPushAttrib(GL_VIEWPORT_BIT);
-    glViewport(0, 0, width, height);
-    glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+    if (profile) {
+      profiler.BeginFrame();
+    }
+
+    if (panorama) {
+      panorama->Render(ptexMesh, s_cam);
+
+      GpuProfiler::Scope scope(profile ? &profiler : nullptr, "download");
+      panorama->Download(image);
+    } else {
+      // Render
+      frameBuffer.Bind();
+      glPushAttrib(GL_VIEWPORT_BIT);
+      glViewport(0, 0, width, height);
+      glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 
-    glEnable(GL_CULL_FACE);
+      glEnable(GL_CULL_FACE);
 
-    ptexMesh.Render(s_cam);
+      ptexMesh.Render(s_cam);
 
-    glDisable(GL_CULL_FACE);
+      glDisable(GL_CULL_FACE);
 
-    glPopAttrib(); //GL_VIEWPORT_BIT
-    frameBuffer.Unbind();
+      glPopAttrib(); //GL_VIEWPORT_BIT
+      frameBuffer.Unbind();
 
-    for (size_t i = 0; i < mirrors.size(); i++) {
-      MirrorSurface& mirror = mirrors[i];
       // capture reflections
-      mirrorRenderer.CaptureReflection(mirror, ptexMesh, s_cam, frontFace);
+      mirrorRenderer.CaptureReflections(mirrors, ptexMesh, s_cam, frontFace);
 
       frameBuffer.Bind();
       glPushAttrib(GL_VIEWPORT_BIT);
       glViewport(0, 0, width, height);
 
-      // render mirror
-      mirrorRenderer.Render(mirror, mirrorRenderer.GetMaskTexture(i), s_cam);
+      // mirrors are only composited into the main colour and depth
+      if (extraOutputs) {
+        const GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        glDrawBuffers(2, drawBuffers);
+      }
+
+      // render mirrors
+      mirrorRenderer.Render(mirrors, s_cam);
 
       glPopAttrib(); //GL_VIEWPORT_BIT
       frameBuffer.Unbind();
-    }
 
-    // Download and save
-    render.Download(image.ptr, GL_RGB, GL_UNSIGNED_BYTE);
+      {
+        GpuProfiler::Scope scope(profile ? &profiler : nullptr, "download");
+        render.Download(image.ptr, GL_RGB, GL_UNSIGNED_BYTE);
+      }
+    }
 
     char filename[1000];
     snprintf(filename, 1000, "frame%06zu.jpg", i);
@@ -139,23 +257,38 @@ int main(int argc, char* argv[]) {
         pangolin::PixelFormatFromString("RGB24"),
         std::string(filename));
 
-    if (renderDepth) {
-      // render depth
-      depthFrameBuffer.Bind();
-      glPushAttrib(GL_VIEWPORT_BIT);
-      glViewport(0, 0, width, height);
-      glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-
-      glEnable(GL_CULL_FACE);
+    for (size_t j = 0; j < bracketTextures.size(); j++) {
+      {
+        GpuProfiler::Scope scope(profile ? &profiler : nullptr, "download");
+        bracketTextures[j]->Download(image.ptr, GL_RGB, GL_UNSIGNED_BYTE);
+      }
 
-      ptexMesh.RenderDepth(s_cam, depthScale);
+      snprintf(filename, 1000, "frame%06zu-bracket%zu.jpg", i, j);
+      pangolin::SaveImage(
+          image.UnsafeReinterpret<uint8_t>(),
+          pangolin::PixelFormatFromString("RGB24"),
+          std::string(filename));
+    }
 
-      glDisable(GL_CULL_FACE);
+    if (renderHdr) {
+      {
+        GpuProfiler::Scope scope(profile ? &profiler : nullptr, "download");
+        hdrTexture->Download(hdrImage.ptr, GL_RGB, GL_FLOAT);
+      }
 
-      glPopAttrib(); //GL_VIEWPORT_BIT
-      depthFrameBuffer.Unbind();
+      snprintf(filename, 1000, "hdr%06zu.pfm", i);
+      SavePFM(hdrImage, std::string(filename));
+    }
 
-      depthTexture.Download(depthImage.ptr, GL_RED, GL_FLOAT);
+    if (renderDepth) {
+      {
+        GpuProfiler::Scope scope(profile ? &profiler : nullptr, "download");
+        if (panorama) {
+          panorama->DownloadDepth(depthImage);
+        } else {
+          depthTexture.Download(depthImage.ptr, GL_RED, GL_FLOAT);
+        }
+      }
 
       // convert to 16-bit int
       for(size_t i = 0; i < depthImage.Area(); i++)
@@ -175,6 +308,14 @@ int main(int argc, char* argv[]) {
   }
   std::cout << "\rRendering frame " << numFrames << "/" << numFrames << "... done" << std::endl;
 
+  if (profile) {
+    profiler.Finish();
+    profiler.WriteCsv("profile.csv");
+    profiler.WriteJson("profile.json");
+    std::cout << "Wrote per pass timings to profile.csv and profile.json, "
+              << profiler.SkippedFrames() << " frames skipped" << std::endl;
+  }
+
   return 0;
 }
 
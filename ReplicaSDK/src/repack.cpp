@@ -0,0 +1,253 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved
+// Rebuild the per-submesh atlases of a scene to match the adaptive partition
+#include <PLYParser.h>
+#include <PTexLib.h>
+
+#include <pangolin/utils/file_utils.h>
+#include <pangolin/utils/picojson.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cmath>
+#include <cstring>
+#include <experimental/filesystem>
+#include <fstream>
+
+namespace {
+
+enum class AtlasFormat { DXT1, RGB, HDR };
+
+struct Atlas {
+  Atlas(const std::string& filename)
+      : numBytes(std::experimental::filesystem::file_size(filename)) {
+    fd = open(filename.c_str(), O_RDONLY, 0);
+    ASSERT(fd >= 0, "Can't open " + filename);
+    data = (const uint8_t*)mmap(NULL, numBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    ASSERT(data != MAP_FAILED, "Can't map " + filename);
+  }
+
+  ~Atlas() {
+    munmap((void*)data, numBytes);
+    close(fd);
+  }
+
+  Atlas(const Atlas&) = delete;
+  Atlas& operator=(const Atlas&) = delete;
+
+  int fd;
+  size_t numBytes;
+  size_t dim;
+  const uint8_t* data;
+};
+
+const char* FormatExtension(const AtlasFormat format) {
+  switch (format) {
+    case AtlasFormat::DXT1:
+      return "dxt1";
+    case AtlasFormat::RGB:
+      return "rgb";
+    case AtlasFormat::HDR:
+      return "hdr";
+  }
+  return "";
+}
+
+// Square atlas size in bytes for a given side length
+double AtlasBytes(const AtlasFormat format, const size_t dim) {
+  switch (format) {
+    case AtlasFormat::DXT1:
+      return dim * dim / 2.0;
+    case AtlasFormat::RGB:
+      return dim * dim * 3;
+    case AtlasFormat::HDR:
+      return dim * dim * 6;
+  }
+  return 0;
+}
+
+// Copy one tile between atlases, DXT1 tiles are copied as whole 4x4 blocks
+void CopyTile(
+    const AtlasFormat format,
+    const uint8_t* src,
+    const size_t srcDim,
+    const size_t srcTile,
+    uint8_t* dst,
+    const size_t dstDim,
+    const size_t dstTile,
+    const size_t tileSize) {
+  const size_t srcWidthInTiles = srcDim / tileSize;
+  const size_t dstWidthInTiles = dstDim / tileSize;
+
+  size_t unitSize = tileSize;
+  size_t unitBytes = 0;
+  size_t srcRow = srcDim;
+  size_t dstRow = dstDim;
+
+  switch (format) {
+    case AtlasFormat::DXT1:
+      unitSize = tileSize / 4;
+      unitBytes = 8;
+      srcRow = srcDim / 4;
+      dstRow = dstDim / 4;
+      break;
+    case AtlasFormat::RGB:
+      unitBytes = 3;
+      break;
+    case AtlasFormat::HDR:
+      unitBytes = 6;
+      break;
+  }
+
+  const size_t srcX = (srcTile % srcWidthInTiles) * unitSize;
+  const size_t srcY = (srcTile / srcWidthInTiles) * unitSize;
+  const size_t dstX = (dstTile % dstWidthInTiles) * unitSize;
+  const size_t dstY = (dstTile / dstWidthInTiles) * unitSize;
+
+  for (size_t y = 0; y < unitSize; y++) {
+    memcpy(
+        &dst[((dstY + y) * dstRow + dstX) * unitBytes],
+        &src[((srcY + y) * srcRow + srcX) * unitBytes],
+        unitSize * unitBytes);
+  }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  ASSERT(
+      argc == 4 || argc == 6,
+      "Usage: ./ReplicaAtlasRepack mesh.ply /path/to/atlases /path/to/output [minFaces maxFaces]");
+
+  const std::string meshFile(argv[1]);
+  const std::string atlasFolder(argv[2]);
+  const std::string outputFolder(argv[3]);
+  ASSERT(pangolin::FileExists(meshFile));
+  ASSERT(pangolin::FileExists(atlasFolder));
+  ASSERT(atlasFolder != outputFolder, "Output folder must differ from the input atlases");
+
+  size_t minFaces = 4096;
+  size_t maxFaces = 32768;
+  if (argc == 6) {
+    minFaces = std::stoul(argv[4]);
+    maxFaces = std::stoul(argv[5]);
+  }
+
+  // Parse parameters of the existing atlases
+  const std::string paramsFile = atlasFolder + "/parameters.json";
+  ASSERT(pangolin::FileExists(paramsFile));
+
+  std::ifstream file(paramsFile);
+  picojson::value json;
+  picojson::parse(json, file);
+
+  ASSERT(json.contains("splitSize"), "Missing splitSize in parameters.json");
+  ASSERT(json.contains("tileSize"), "Missing tileSize in parameters.json");
+  ASSERT(
+      !json.contains("splitMode") || json["splitMode"].get<std::string>() != "adaptive",
+      "Atlases are already repacked");
+
+  const float splitSize = json["splitSize"].get<double>();
+  const size_t tileSize = json["tileSize"].get<int64_t>();
+
+  MeshData mesh;
+  PLYParse(mesh, meshFile);
+  ASSERT(mesh.polygonStride == 4, "Must be a quad mesh!");
+
+  const size_t numFaces = mesh.ibo.size() / 4;
+
+  std::cout << "Partitioning mesh... ";
+  std::cout.flush();
+
+  PTexMesh::MeshPartition oldPartition;
+  if (splitSize > 0.0f) {
+    oldPartition = PTexMesh::PartitionMesh(mesh, splitSize);
+  } else {
+    oldPartition.faces.resize(numFaces);
+    for (size_t i = 0; i < numFaces; i++) {
+      oldPartition.faces[i] = i;
+    }
+    oldPartition.chunkStart = {0, (uint32_t)numFaces};
+  }
+
+  const PTexMesh::MeshPartition newPartition =
+      PTexMesh::PartitionMeshAdaptive(mesh, minFaces, maxFaces);
+
+  std::cout << "done, " << oldPartition.NumChunks() << " -> " << newPartition.NumChunks()
+            << " sub-meshes" << std::endl;
+
+  // Where each face's tile lives in the existing atlases
+  std::vector<uint32_t> oldChunk(numFaces);
+  std::vector<uint32_t> oldTile(numFaces);
+  for (size_t i = 0; i < oldPartition.NumChunks(); i++) {
+    for (size_t j = 0; j < oldPartition.ChunkSize(i); j++) {
+      const uint32_t face = oldPartition.faces[oldPartition.chunkStart[i] + j];
+      oldChunk[face] = i;
+      oldTile[face] = j;
+    }
+  }
+
+  // Map the existing atlases
+  AtlasFormat format = AtlasFormat::DXT1;
+  std::vector<std::unique_ptr<Atlas>> atlases;
+
+  for (size_t i = 0; i < oldPartition.NumChunks(); i++) {
+    const std::string prefix = atlasFolder + "/" + std::to_string(i) + "-color-ptex.";
+
+    if (pangolin::FileExists(prefix + "dxt1")) {
+      format = AtlasFormat::DXT1;
+    } else if (pangolin::FileExists(prefix + "rgb")) {
+      format = AtlasFormat::RGB;
+    } else if (pangolin::FileExists(prefix + "hdr")) {
+      format = AtlasFormat::HDR;
+    } else {
+      ASSERT(false, "Can't parse texture filename " + atlasFolder + "/" + std::to_string(i));
+    }
+
+    atlases.emplace_back(new Atlas(prefix + FormatExtension(format)));
+
+    // We know it's square
+    const size_t dim = std::sqrt(atlases.back()->numBytes / (double)AtlasBytes(format, 1));
+    ASSERT(AtlasBytes(format, dim) == atlases.back()->numBytes, "Atlas is not square");
+    atlases.back()->dim = dim;
+  }
+
+  ASSERT(format != AtlasFormat::DXT1 || tileSize % 4 == 0, "DXT1 tiles must be 4x4 aligned");
+
+  std::experimental::filesystem::create_directories(outputFolder);
+
+  // Assemble the new atlases
+#pragma omp parallel for schedule(dynamic)
+  for (size_t i = 0; i < newPartition.NumChunks(); i++) {
+    const size_t numTiles = newPartition.ChunkSize(i);
+    const size_t widthInTiles = std::ceil(std::sqrt((double)numTiles));
+    const size_t dim = widthInTiles * tileSize;
+
+    std::vector<uint8_t> atlas((size_t)AtlasBytes(format, dim), 0);
+
+    for (size_t j = 0; j < numTiles; j++) {
+      const uint32_t face = newPartition.faces[newPartition.chunkStart[i] + j];
+      const Atlas& src = *atlases[oldChunk[face]];
+      CopyTile(format, src.data, src.dim, oldTile[face], atlas.data(), dim, j, tileSize);
+    }
+
+    const std::string filename =
+        outputFolder + "/" + std::to_string(i) + "-color-ptex." + FormatExtension(format);
+    std::ofstream out(filename, std::ios::binary);
+    out.write((const char*)atlas.data(), atlas.size());
+    ASSERT(out.good(), "Can't write " + filename);
+  }
+
+  // Write parameters for the new atlases
+  json.get<picojson::object>()["splitMode"] = picojson::value("adaptive");
+  json.get<picojson::object>()["minFaces"] = picojson::value((int64_t)minFaces);
+  json.get<picojson::object>()["maxFaces"] = picojson::value((int64_t)maxFaces);
+
+  std::ofstream params(outputFolder + "/parameters.json");
+  params << json.serialize(true);
+
+  std::cout << "Wrote " << newPartition.NumChunks() << " atlases to " << outputFolder
+            << std::endl;
+
+  return 0;
+}
@@ -3,10 +3,42 @@
 
 #include <pangolin/display/display.h>
 #include <pangolin/display/widgets/widgets.h>
+#include <pangolin/gl/glfont.h>
 
 #include "GLCheck.h"
 #include "MirrorRenderer.h"
 
+namespace {
+
+// Rolling per pass times in the top left corner of the view
+void DrawProfile(const GpuProfiler& profiler, const pangolin::Viewport& v) {
+  glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+  glDisable(GL_DEPTH_TEST);
+  glColor3f(1.0f, 1.0f, 1.0f);
+
+  const float lineHeight = 16.0f;
+  float y = v.t() - lineHeight;
+
+  pangolin::GlFont::I().Text("pass: GPU mean/max, CPU mean/max ms").DrawWindow(v.l + 10, y);
+
+  for (const GpuProfiler::PassStats& s : profiler.Stats()) {
+    y -= lineHeight;
+    pangolin::GlFont::I()
+        .Text(
+            "%s: %.2f/%.2f, %.2f/%.2f",
+            s.name.c_str(),
+            s.gpuMeanMs,
+            s.gpuMaxMs,
+            s.cpuMeanMs,
+            s.cpuMaxMs)
+        .DrawWindow(v.l + 10, y);
+  }
+
+  glPopAttrib();
+}
+
+} // namespace
+
 int main(int argc, char* argv[]) {
 
   ASSERT(argc == 3 || argc == 4, "Usage: ./ReplicaViewer mesh.ply textures [glass.sur]");
@@ -88,7 +120,7 @@ int main(int argc, char* argv[]) {
   }
 
   const std::string shadir = STR(SHADER_DIR);
-  MirrorRenderer mirrorRenderer(mirrors, width, height, shadir);
+  MirrorRenderer mirrorRenderer(mirrors, width, height, shadir, surfaceFile);
 
   // load mesh and textures
   PTexMesh ptexMesh(meshFile, atlasFolder);
@@ -101,10 +133,15 @@ int main(int argc, char* argv[]) {
   pangolin::Var<bool> wireframe("ui.Wireframe", false, true);
   pangolin::Var<bool> drawBackfaces("ui.Draw_backfaces", false, true);
   pangolin::Var<bool> drawMirrors("ui.Draw_mirrors", true, true);
+  pangolin::Var<bool> stencilMirrors("ui.Stencil_mirrors", false, true);
   pangolin::Var<bool> drawDepth("ui.Draw_depth", false, true);
+  pangolin::Var<bool> vertexPulling("ui.Vertex_pulling", false, true);
+  pangolin::Var<bool> profile("ui.Profile", false, true);
 
   ptexMesh.SetExposure(exposure);
 
+  GpuProfiler profiler;
+
   while (!pangolin::ShouldQuit()) {
     glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 
@@ -120,6 +157,19 @@ int main(int argc, char* argv[]) {
       ptexMesh.SetSaturation(saturation);
     }
 
+    if (vertexPulling.GuiChanged()) {
+      ptexMesh.SetVertexPulling(vertexPulling);
+    }
+
+    if (profile.GuiChanged()) {
+      ptexMesh.SetProfiler(profile ? &profiler : nullptr);
+      mirrorRenderer.SetProfiler(profile ? &profiler : nullptr);
+    }
+
+    if (profile) {
+      profiler.BeginFrame();
+    }
+
     if (meshView.IsShown()) {
       meshView.Activate(s_cam);
 
@@ -144,15 +194,20 @@ int main(int argc, char* argv[]) {
 
       glDisable(GL_CULL_FACE);
 
-      if (drawMirrors) {
-        for (size_t i = 0; i < mirrors.size(); i++) {
-          MirrorSurface& mirror = mirrors[i];
-          // capture reflections
-          mirrorRenderer.CaptureReflection(mirror, ptexMesh, s_cam, frontFace, drawDepth, depthScale);
+      if (drawMirrors && stencilMirrors) {
+        // draw reflections in place
+        mirrorRenderer.RenderInPlace(mirrors, ptexMesh, s_cam, frontFace, drawDepth, depthScale);
+      } else if (drawMirrors) {
+        // capture reflections
+        mirrorRenderer.CaptureReflections(
+            mirrors, ptexMesh, s_cam, frontFace, drawDepth, depthScale);
+
+        // render mirrors
+        mirrorRenderer.Render(mirrors, s_cam, drawDepth);
+      }
 
-          // render mirror
-          mirrorRenderer.Render(mirror, mirrorRenderer.GetMaskTexture(i), s_cam, drawDepth);
-        }
+      if (profile) {
+        DrawProfile(profiler, meshView.v);
       }
     }
 